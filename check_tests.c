@@ -1,5 +1,17 @@
 #include "matrix_tree.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define check_pid() _getpid()
+#else
+#include <unistd.h>
+#include <sys/wait.h>
+#define check_pid() getpid()
+#endif
 
 void matrix_tree_print_matrix(const double* matrix, uint32_t rows, uint32_t cols) {
     printf("[\n");
@@ -43,6 +55,1476 @@ MatrixTreeNode* matrix_tree_create_leaf_with_data(uint32_t rows, uint32_t cols,
     return node;
 }
 
+static int check_collapse_policies(void);
+
+// Generated shape kernels (default shape list) against a plain C reference
+static int check_shape_kernels(void) {
+    static const uint32_t shapes[][2] = { {2, 2}, {3, 3}, {4, 4}, {8, 8}, {5, 3} };
+    double a[64], b[64], out[64], x[8], y[8];
+    int failed = 0;
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        uint32_t rows = shapes[s][0], cols = shapes[s][1];
+        for (uint32_t i = 0; i < rows * cols; i++) {
+            a[i] = 1.0 + i;
+            b[i] = 0.5 * i - 3.0;
+        }
+        for (uint32_t j = 0; j < cols; j++) x[j] = 2.0 - j;
+
+        MatrixTreeNode* la = matrix_tree_create_leaf_with_data(rows, cols, a);
+        MatrixTreeNode* lb = matrix_tree_create_leaf_with_data(rows, cols, b);
+        MatrixTreeNode* root = matrix_tree_create(rows, cols, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* children[] = {la, lb};
+        matrix_tree_set_internal(root, children, 2);
+
+        matrix_tree_collapse(root, out);
+        matrix_tree_multiply_collapsed(root, x, y);
+        for (uint32_t r = 0; r < rows; r++) {
+            double expect = 0.0;
+            for (uint32_t c = 0; c < cols; c++) {
+                uint32_t i = r * cols + c;
+                if (out[i] != a[i] + b[i]) failed = 1;
+                expect += (a[i] + b[i]) * x[c];
+            }
+            if (fabs(y[r] - expect) > 1e-12 * (1.0 + fabs(expect))) failed = 1;
+        }
+        matrix_tree_destroy(root);
+
+        // The shape list is configurable; a bound kernel must suit this CPU
+        if (matrix_tree_shape_kernel_isa(rows, cols) > matrix_tree_cpu_isa()) failed = 1;
+    }
+    return failed;
+}
+
+// Every operation on the C backend, and trees mixed across backends
+static int check_backends(void) {
+    int saved[MATRIX_TREE_OP_COUNT];
+    int failed = 0;
+
+    for (int op = 0; op < MATRIX_TREE_OP_COUNT; op++) saved[op] = matrix_tree_get_backend(op);
+
+    matrix_tree_set_backend(MATRIX_TREE_OP_ALL, MATRIX_TREE_BACKEND_C);
+    if (check_collapse_policies() != 0) failed = 1;
+
+    double data[] = {1, -2, 3, 4, 5, -6};
+    double out[6];
+    MatrixTreeNode* leaf = matrix_tree_create_leaf_with_data(2, 3, data);
+    matrix_tree_scale(leaf, -0.5);
+    matrix_tree_collapse(leaf, out);
+    for (int i = 0; i < 6; i++) {
+        if (out[i] != -0.5 * data[i]) failed = 1;
+    }
+
+    // Built by C, destroyed by the assembly
+    MatrixTreeNode* root = matrix_tree_create(2, 3, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {leaf};
+    if (matrix_tree_set_internal(root, children, 1) != 0) failed = 1;
+    matrix_tree_set_backend(MATRIX_TREE_OP_DESTROY, MATRIX_TREE_BACKEND_ASM);
+    matrix_tree_destroy(root);
+
+    // The resolver may only bind a level this CPU runs
+    if (matrix_tree_c_kernel_isa() > matrix_tree_cpu_isa()) failed = 1;
+
+    if (matrix_tree_set_backend(MATRIX_TREE_OP_COUNT, MATRIX_TREE_BACKEND_C) == 0) failed = 1;
+    if (matrix_tree_set_backend(MATRIX_TREE_OP_SCALE, 7) == 0) failed = 1;
+
+    for (int op = 0; op < MATRIX_TREE_OP_COUNT; op++) matrix_tree_set_backend(op, saved[op]);
+    return failed;
+}
+
+// With the thresholds at zero every multiply takes the CBLAS path (when
+// built in); it must agree with the built-in kernels
+static int check_blas(void) {
+    const uint32_t n = 9;
+    double a[81], d[9], x[3 * 9], y_ref[3 * 9], y[3 * 9];
+    int failed = 0;
+
+    for (uint32_t i = 0; i < n * n; i++) a[i] = (double)(i % 11) - 3.0;
+    for (uint32_t i = 0; i < n; i++) d[i] = 0.5 * i;
+    for (uint32_t i = 0; i < 3 * n; i++) x[i] = 1.0 - 0.25 * (i % 7);
+
+    MatrixTreeNode* diag = matrix_tree_create_diagonal(n);
+    matrix_tree_set_leaf(diag, d, sizeof(d));
+    MatrixTreeNode* root = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {matrix_tree_create_leaf_with_data(n, n, a), diag};
+    matrix_tree_set_internal(root, children, 2);
+
+    for (int count = 1; count <= 3; count += 2) {
+        matrix_tree_set_blas_thresholds(UINT64_MAX, UINT64_MAX);
+        matrix_tree_multiply_batch(root, x, count, y_ref);
+        matrix_tree_set_blas_thresholds(0, 0);
+        if (matrix_tree_multiply_batch(root, x, count, y) != 0) failed = 1;
+        for (uint32_t i = 0; i < count * n; i++) {
+            if (fabs(y[i] - y_ref[i]) > 1e-12 * (1.0 + fabs(y_ref[i]))) failed = 1;
+        }
+    }
+
+    // Leave the remaining checks on the built-in kernels
+    matrix_tree_set_blas_thresholds(UINT64_MAX, UINT64_MAX);
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// Depth of internal nesting below node (a leaf is 0)
+static int tree_depth(const MatrixTreeNode* node) {
+    if (node->node_type != NODE_TYPE_INTERNAL) return 0;
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    int depth = 0;
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        int d = tree_depth(children[i]);
+        if (d > depth) depth = d;
+    }
+    return depth + 1;
+}
+
+// A chain of 20 nested sums over dense and diagonal leaves, optimized with
+// each policy; the sum must not change
+static int check_optimize(void) {
+    const uint32_t n = 4, links = 20;
+    const uint32_t policies[] = {MATRIX_TREE_OPTIMIZE_DEFAULT, MATRIX_TREE_OPTIMIZE_REBALANCE};
+    double ref[16], out[16], a[16], d[4] = {1, 2, 3, 4};
+    int failed = 0;
+
+    for (int p = 0; p < 2; p++) {
+        MatrixTreeNode* root = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* link = root;
+        for (uint32_t k = 0; k < links; k++) {
+            MatrixTreeNode* leaf;
+            if (k % 3 == 2) {
+                leaf = matrix_tree_create_diagonal(n);
+                matrix_tree_set_leaf(leaf, d, sizeof(d));
+            } else {
+                for (uint32_t i = 0; i < 16; i++) a[i] = (double)(k + i % 5);
+                leaf = matrix_tree_create_leaf_with_data(n, n, a);
+            }
+            MatrixTreeNode* next = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+            MatrixTreeNode* children[] = {leaf, next};
+            matrix_tree_set_internal(link, children, 2);
+            link = next;
+        }
+        matrix_tree_set_internal(link, NULL, 0);
+        matrix_tree_collapse(root, ref);
+
+        if (matrix_tree_optimize(root, policies[p]) != 0) failed = 1;
+        matrix_tree_collapse(root, out);
+        for (int i = 0; i < 16; i++) {
+            if (fabs(out[i] - ref[i]) > 1e-12 * (1.0 + fabs(ref[i]))) failed = 1;
+        }
+
+        // Merged: one dense and one diagonal leaf; rebalanced: 20 leaves in 3 groups
+        if (p == 0 && (root->num_children != 2 || tree_depth(root) != 1)) failed = 1;
+        if (p == 1 && (root->num_children != 3 || tree_depth(root) != 2)) failed = 1;
+        matrix_tree_destroy(root);
+    }
+
+    // Shared nodes: a leaf repeated in one sum, and an inner sum (holding that
+    // leaf too) under two parents. The sum is kept and nothing shared is freed.
+    MatrixTreeNode* leaf = matrix_tree_create_leaf_with_data(2, 2, d);
+    MatrixTreeNode* other = matrix_tree_create_leaf_with_data(2, 2, a);
+    MatrixTreeNode* shared = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* shared_children[] = {other, matrix_tree_create_leaf_with_data(2, 2, d)};
+    matrix_tree_set_internal(shared, shared_children, 2);
+    MatrixTreeNode* p1 = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* p2 = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* p1_children[] = {shared, leaf};
+    MatrixTreeNode* p2_children[] = {shared, matrix_tree_create_leaf_with_data(2, 2, a)};
+    matrix_tree_set_internal(p1, p1_children, 2);
+    matrix_tree_set_internal(p2, p2_children, 2);
+    MatrixTreeNode* root = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {leaf, p1, leaf, p2};
+    matrix_tree_set_internal(root, children, 4);
+    matrix_tree_collapse(root, ref);
+
+    if (matrix_tree_optimize(root, MATRIX_TREE_OPTIMIZE_DEFAULT) != 0) failed = 1;
+    matrix_tree_collapse(root, out);
+    for (int i = 0; i < 4; i++) {
+        if (fabs(out[i] - ref[i]) > 1e-12) failed = 1;
+    }
+    matrix_tree_collapse(shared, out);
+    for (int i = 0; i < 4; i++) {
+        if (out[i] != a[i] + d[i]) failed = 1;
+    }
+
+    // Left: the shared sum twice and one leaf holding the rest
+    MatrixTreeNode** left = (MatrixTreeNode**)root->data_ptr;
+    if (root->num_children != 3) {
+        failed = 1;
+    } else {
+        int sums = 0;
+        for (int i = 0; i < 3; i++) sums += left[i] == shared;
+        if (sums != 2) failed = 1;
+        for (int i = 0; i < 3; i++) {
+            if (left[i] != shared) matrix_tree_destroy(left[i]);
+        }
+    }
+    matrix_tree_destroy(shared);
+    matrix_tree_destroy_shallow(root);
+    return failed;
+}
+
+// Builds, scales and destroys trees of its own while the caller freezes
+static int freeze_churn_thread(void* arg) {
+    (void)arg;
+    double v[] = {1, 2, 3, 4};
+    for (int round = 0; round < 2000; round++) {
+        MatrixTreeNode* root = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* children[] = {matrix_tree_create_leaf_with_data(2, 2, v),
+                                      matrix_tree_create_leaf_with_data(2, 2, v)};
+        matrix_tree_set_internal(root, children, 2);
+        matrix_tree_scale(root, 0.5);
+        matrix_tree_destroy(root);
+    }
+    return 0;
+}
+
+// Manual freeze/thaw keeps the sum through a scale; auto mode freezes idle
+// children and thaws one when a leaf inside it changes
+static int check_freeze(void) {
+    double a[] = {1, 2, 3, 4}, b[] = {0.5, -1, 2, 0}, c[] = {3, 3, -3, 1}, ref[4], out[4];
+    int failed = 0;
+
+    for (int mode = 0; mode < 2; mode++) {
+        MatrixTreeNode* la = matrix_tree_create_leaf_with_data(2, 2, a);
+        MatrixTreeNode* inner = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* root = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* inner_children[] = {la, matrix_tree_create_leaf_with_data(2, 2, b)};
+        MatrixTreeNode* children[] = {inner, matrix_tree_create_leaf_with_data(2, 2, c)};
+        matrix_tree_set_internal(inner, inner_children, 2);
+        matrix_tree_set_internal(root, children, 2);
+        for (int i = 0; i < 4; i++) ref[i] = a[i] + b[i] + c[i];
+
+        if (mode == 0) {
+            if (matrix_tree_freeze(inner, 1) != 0 || !matrix_tree_is_frozen(inner)) failed = 1;
+            if (inner->node_type != NODE_TYPE_LEAF) failed = 1;
+            matrix_tree_scale(root, 2.0);
+            if (matrix_tree_thaw(inner) != 0 || inner->node_type != NODE_TYPE_INTERNAL) failed = 1;
+            matrix_tree_collapse(root, out);
+            for (int i = 0; i < 4; i++) {
+                if (out[i] != 2.0 * ref[i]) failed = 1;
+            }
+            if (matrix_tree_thaw(inner) == 0) failed = 1;
+            if (matrix_tree_freeze(inner, 0) != 0 || matrix_tree_is_frozen(inner)) failed = 1;
+            matrix_tree_collapse(root, out);
+            for (int i = 0; i < 4; i++) {
+                if (out[i] != 2.0 * ref[i]) failed = 1;
+            }
+        } else {
+            matrix_tree_freeze_auto(root, 2);
+            matrix_tree_collapse(root, out);
+            if (matrix_tree_is_frozen(inner)) failed = 1;
+            matrix_tree_collapse(root, out);
+            if (!matrix_tree_is_frozen(inner)) failed = 1;
+
+            matrix_tree_set_leaf(la, c, sizeof(c));
+            matrix_tree_collapse(root, out);
+            if (matrix_tree_is_frozen(inner)) failed = 1;
+            for (int i = 0; i < 4; i++) {
+                if (out[i] != c[i] + b[i] + c[i]) failed = 1;
+            }
+            matrix_tree_collapse(root, out);
+            matrix_tree_collapse(root, out);
+            if (!matrix_tree_is_frozen(inner)) failed = 1;
+        }
+
+        // Destroying the root also releases kept originals and stops watching it
+        matrix_tree_destroy(root);
+    }
+
+    // Optimize leaves frozen sums alone: both stay frozen and thaw intact
+    MatrixTreeNode* sums[2];
+    for (int j = 0; j < 2; j++) {
+        sums[j] = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* leaves[] = {matrix_tree_create_leaf_with_data(2, 2, j ? b : a),
+                                    matrix_tree_create_leaf_with_data(2, 2, c)};
+        matrix_tree_set_internal(sums[j], leaves, 2);
+        if (matrix_tree_freeze(sums[j], 1) != 0) failed = 1;
+    }
+    MatrixTreeNode* root = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    matrix_tree_set_internal(root, sums, 2);
+    if (matrix_tree_optimize(root, MATRIX_TREE_OPTIMIZE_DEFAULT) != 0 || root->num_children != 2) failed = 1;
+    MatrixTreeNode* fresh = matrix_tree_create(2, 2, NODE_TYPE_LEAF);
+    if (matrix_tree_is_frozen(fresh)) failed = 1;
+    matrix_tree_destroy(fresh);
+    for (int j = 0; j < 2; j++) {
+        if (!matrix_tree_is_frozen(sums[j]) || matrix_tree_thaw(sums[j]) != 0) failed = 1;
+    }
+    matrix_tree_collapse(root, out);
+    for (int i = 0; i < 4; i++) {
+        if (out[i] != a[i] + b[i] + 2.0 * c[i]) failed = 1;
+    }
+
+    // Auto-frozen children moved under new groups by a rebalance still thaw
+    // when a leaf inside them changes
+    MatrixTreeNode* watched = matrix_tree_create(1, 1, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* groups[10];
+    MatrixTreeNode* first = NULL;
+    double one = 1.0, hundred = 100.0, sum;
+    for (int j = 0; j < 10; j++) {
+        MatrixTreeNode* leaf = matrix_tree_create_leaf_with_data(1, 1, &one);
+        if (j == 0) first = leaf;
+        groups[j] = matrix_tree_create(1, 1, NODE_TYPE_INTERNAL);
+        matrix_tree_set_internal(groups[j], &leaf, 1);
+    }
+    matrix_tree_set_internal(watched, groups, 10);
+    matrix_tree_freeze_auto(watched, 1);
+    for (int e = 0; e < 3; e++) matrix_tree_collapse(watched, &sum);
+    for (int j = 0; j < 10; j++) {
+        if (!matrix_tree_is_frozen(groups[j])) failed = 1;
+    }
+    if (matrix_tree_optimize(watched, MATRIX_TREE_OPTIMIZE_REBALANCE) != 0) failed = 1;
+    matrix_tree_set_leaf(first, &hundred, sizeof(hundred));
+    for (int e = 0; e < 3; e++) {
+        if (matrix_tree_collapse(watched, &sum) != 0 || sum != 109.0) failed = 1;
+    }
+    matrix_tree_destroy(watched);
+
+    // Freezing here while another thread changes and destroys its own trees
+    thrd_t churn;
+    int churning = thrd_create(&churn, freeze_churn_thread, NULL) == thrd_success;
+    for (int round = 0; round < 500; round++) {
+        if (matrix_tree_freeze(sums[round % 2], 1) != 0 || matrix_tree_thaw(sums[round % 2]) != 0) failed = 1;
+    }
+    if (churning) thrd_join(churn, NULL);
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// Every level's sum from one pass against a separate collapse of each node
+static int check_all_levels(void) {
+    double a[] = {1, 2, 3, 4}, b[] = {-1, 0.5, 2, 0}, d[] = {10, 20}, ref[4];
+    int failed = 0;
+
+    // root{ g1{ a, g2{ b, diag }, empty }, a }
+    MatrixTreeNode* diag = matrix_tree_create_diagonal(2);
+    matrix_tree_set_leaf(diag, d, sizeof(d));
+    MatrixTreeNode* g2 = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* g2_children[] = {matrix_tree_create_leaf_with_data(2, 2, b), diag};
+    matrix_tree_set_internal(g2, g2_children, 2);
+    MatrixTreeNode* empty = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    matrix_tree_set_internal(empty, NULL, 0);
+    MatrixTreeNode* g1 = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* g1_children[] = {matrix_tree_create_leaf_with_data(2, 2, a), g2, empty};
+    matrix_tree_set_internal(g1, g1_children, 3);
+    MatrixTreeNode* root = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* root_children[] = {g1, matrix_tree_create_leaf_with_data(2, 2, a)};
+    matrix_tree_set_internal(root, root_children, 2);
+
+    MatrixTreeNode* order[] = {root, g1, g2, empty};
+    double given[4];
+    double* outputs[4] = {NULL, given, NULL, NULL};
+    if (matrix_tree_count_internal(root) != 4) failed = 1;
+    if (matrix_tree_collapse_all_levels(root, outputs) != 0 || outputs[1] != given) failed = 1;
+
+    for (int n = 0; n < 4 && !failed; n++) {
+        matrix_tree_collapse(order[n], ref);
+        for (int i = 0; i < 4; i++) {
+            if (outputs[n][i] != ref[i]) failed = 1;
+        }
+    }
+
+    free(outputs[0]);
+    free(outputs[2]);
+    free(outputs[3]);
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// Random weight rows over three children against scale + multiply per draw
+static int check_weighted(void) {
+    double a[] = {1, 2, 3, 4, 5, 6}, b[] = {-1, 0, 2, 1, 1, -3}, c[] = {0.5, 0.5, 0, 0, 2, 1};
+    double x[] = {1, -2, 0.5}, w[4 * 3], y[4 * 2];
+    double* data[] = {a, b, c};
+    int failed = 0;
+
+    MatrixTreeNode* root = matrix_tree_create(2, 3, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[3];
+    for (int j = 0; j < 3; j++) children[j] = matrix_tree_create_leaf_with_data(2, 3, data[j]);
+    matrix_tree_set_internal(root, children, 3);
+
+    srand(7);
+    for (int i = 0; i < 12; i++) w[i] = (double)rand() / RAND_MAX - 0.5;
+    if (matrix_tree_multiply_weighted(root, x, w, 4, y) != 0) failed = 1;
+
+    for (int s = 0; s < 4; s++) {
+        for (int r = 0; r < 2; r++) {
+            double want = 0.0;
+            for (int j = 0; j < 3; j++) {
+                for (int k = 0; k < 3; k++) want += w[s * 3 + j] * data[j][r * 3 + k] * x[k];
+            }
+            if (fabs(y[s * 2 + r] - want) > 1e-12 * (1.0 + fabs(want))) failed = 1;
+        }
+    }
+
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// Gradient step on dense, symmetric and banded leaves with child weights,
+// a batch of two pairs, and a leaf shared by two children
+static int check_update(void) {
+    double a[9], s[6] = {1, 2, 3, 4, 5, 6}, band[9] = {0, 1, 2, 3, 4, 5, 6, 7, 0};
+    double g[6] = {1, -2, 0.5, 0, 1, 1}, x[6] = {2, 1, -1, 1, 0, 3};
+    double before[3][9], after[9];
+    const double lr = 0.1, weights[] = {0.5, 2.0};
+    int failed = 0;
+
+    for (int i = 0; i < 9; i++) a[i] = i - 4.0;
+    MatrixTreeNode* dense = matrix_tree_create_leaf_with_data(3, 3, a);
+    MatrixTreeNode* sym = matrix_tree_create_symmetric(3);
+    MatrixTreeNode* banded = matrix_tree_create_banded(3, 1);
+    matrix_tree_set_leaf(sym, s, sizeof(s));
+    matrix_tree_set_leaf(banded, band, sizeof(band));
+    MatrixTreeNode* leaves[] = {dense, sym, banded};
+    for (int l = 0; l < 3; l++) matrix_tree_collapse(leaves[l], before[l]);
+
+    MatrixTreeNode* inner = matrix_tree_create(3, 3, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* root = matrix_tree_create(3, 3, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* inner_children[] = {dense, sym};
+    MatrixTreeNode* children[] = {inner, banded};
+    matrix_tree_set_internal(inner, inner_children, 2);
+    matrix_tree_set_internal(root, children, 2);
+    if (matrix_tree_update_leaves(root, g, x, lr, weights) != 0) failed = 1;
+
+    // Expected change of each full matrix entry for weight w
+    for (int l = 0; l < 3; l++) {
+        double w = l < 2 ? weights[0] : weights[1];
+        matrix_tree_collapse(leaves[l], after);
+        for (int r = 0; r < 3; r++) {
+            for (int c = 0; c < 3; c++) {
+                double grad = g[r] * x[c];
+                if (l == 1 && r != c) grad += g[c] * x[r];
+                if (l == 2 && abs(r - c) > 1) grad = 0.0;
+                double want = before[l][r * 3 + c] - lr * w * grad;
+                if (fabs(after[r * 3 + c] - want) > 1e-12) failed = 1;
+            }
+        }
+    }
+
+    // Batch of two pairs on a leaf shared by both children (weights 1 + 2)
+    matrix_tree_collapse(dense, before[0]);
+    MatrixTreeNode* shared = matrix_tree_create(3, 3, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* shared_children[] = {dense, dense};
+    matrix_tree_set_internal(shared, shared_children, 2);
+    const double shared_weights[] = {1.0, 2.0};
+    if (matrix_tree_update_leaves_batch(shared, g, x, 2, lr, shared_weights) != 0) failed = 1;
+    matrix_tree_collapse(dense, after);
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            double want = before[0][r * 3 + c] - lr * 3.0 * (g[r] * x[c] + g[3 + r] * x[3 + c]);
+            if (fabs(after[r * 3 + c] - want) > 1e-12) failed = 1;
+        }
+    }
+
+    // The shared node does not own its children
+    matrix_tree_destroy_shallow(shared);
+    matrix_tree_destroy(root);
+
+    // Under a frozen sum the kept leaves take the step and the sum follows
+    double one = 1.0, sum;
+    MatrixTreeNode* frozen = matrix_tree_create(1, 1, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* frozen_children[] = {matrix_tree_create_leaf_with_data(1, 1, &one),
+                                         matrix_tree_create_leaf_with_data(1, 1, &one)};
+    matrix_tree_set_internal(frozen, frozen_children, 2);
+    root = matrix_tree_create(1, 1, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* root_children[] = {frozen, matrix_tree_create_leaf_with_data(1, 1, &one)};
+    matrix_tree_set_internal(root, root_children, 2);
+    if (matrix_tree_freeze(frozen, 1) != 0) failed = 1;
+    if (matrix_tree_update_leaves(root, &one, &one, 1.0, NULL) != 0) failed = 1;
+    if (matrix_tree_collapse(root, &sum) != 0 || sum != 0.0) failed = 1;
+    if (matrix_tree_thaw(frozen) != 0 || matrix_tree_collapse(root, &sum) != 0 || sum != 0.0) failed = 1;
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// A spec listed breadth-first (root, inner sum, dense leaf, identity, then
+// the inner sum's diagonal and banded leaves) against the same tree built
+// node by node: pre-order layout, results, in-place value changes and the
+// spec checks
+static int check_build(void) {
+    const uint32_t n = 6;
+    double values[36 + 6 + 18], full[36], ref[36], x[6], y[6], y_ref[6];
+    for (int i = 0; i < 60; i++) values[i] = (double)(i % 7) - 3.0;
+    for (uint32_t i = 0; i < n; i++) x[i] = 1.0 + i;
+
+    MatrixTreeBuildNode nodes[] = {
+        {NODE_TYPE_INTERNAL, n, n, -1, 0, 0},
+        {NODE_TYPE_INTERNAL, n, n, 0, 0, 0},
+        {NODE_TYPE_LEAF, n, n, 0, 0, 0},
+        {NODE_TYPE_SCALED_IDENTITY, n, n, 0, 59, 0},
+        {NODE_TYPE_DIAGONAL, n, n, 1, 36, 0},
+        {NODE_TYPE_BANDED, n, n, 1, 42, 1},
+    };
+    MatrixTreeBuildSpec spec = {nodes, 6, values, 60};
+    MatrixTreeNode* built = matrix_tree_build(&spec);
+    if (!built) return 1;
+
+    MatrixTreeNode* dg = matrix_tree_create_diagonal(n);
+    MatrixTreeNode* bd = matrix_tree_create_banded(n, 1);
+    matrix_tree_set_leaf(dg, values + 36, 6 * sizeof(double));
+    matrix_tree_set_leaf(bd, values + 42, 18 * sizeof(double));
+    MatrixTreeNode* inner = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* inner_children[] = {dg, bd};
+    matrix_tree_set_internal(inner, inner_children, 2);
+    MatrixTreeNode* root = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {inner, matrix_tree_create_leaf_with_data(n, n, values),
+                                  matrix_tree_create_scaled_identity(n, values[59])};
+    matrix_tree_set_internal(root, children, 3);
+
+    // Pre-order: root, inner sum, its two leaves, dense leaf, identity
+    MatrixTreeNode** top = (MatrixTreeNode**)built->data_ptr;
+    MatrixTreeNode** sub = (MatrixTreeNode**)built[1].data_ptr;
+    int failed = built->num_children != 3 || top[0] != &built[1] || top[1] != &built[4] ||
+                 top[2] != &built[5] || sub[0] != &built[2] || sub[1] != &built[3];
+
+    matrix_tree_collapse(built, full);
+    matrix_tree_collapse(root, ref);
+    for (int i = 0; i < 36; i++) {
+        if (fabs(full[i] - ref[i]) > 1e-12) failed = 1;
+    }
+    matrix_tree_multiply_collapsed(built, x, y);
+    matrix_tree_multiply_collapsed(root, x, y_ref);
+    for (uint32_t i = 0; i < n; i++) {
+        if (fabs(y[i] - y_ref[i]) > 1e-12) failed = 1;
+    }
+
+    // Values change in place
+    double ones[36];
+    for (int i = 0; i < 36; i++) ones[i] = 1.0;
+    if (matrix_tree_set_leaf(&built[4], ones, sizeof(ones)) != 0) failed = 1;
+    matrix_tree_set_leaf(children[1], ones, sizeof(ones));
+    matrix_tree_scale(built, 2.0);
+    matrix_tree_scale(root, 2.0);
+    matrix_tree_collapse(built, full);
+    matrix_tree_collapse(root, ref);
+    for (int i = 0; i < 36; i++) {
+        if (fabs(full[i] - ref[i]) > 1e-12) failed = 1;
+    }
+    matrix_tree_build_free(built);
+    matrix_tree_destroy(root);
+
+    // Without data every leaf is zero
+    spec.data = NULL;
+    built = matrix_tree_build(&spec);
+    if (!built) {
+        failed = 1;
+    } else {
+        matrix_tree_collapse(built, full);
+        for (int i = 0; i < 36; i++) {
+            if (full[i] != 0.0) failed = 1;
+        }
+        matrix_tree_build_free(built);
+    }
+    spec.data = values;
+
+    // Rejected: data past the end, a later or leaf parent, a shape mismatch
+    nodes[3].data_offset = 60;
+    if (matrix_tree_build(&spec)) failed = 1;
+    nodes[3].data_offset = 59;
+    nodes[2].parent = 4;
+    if (matrix_tree_build(&spec)) failed = 1;
+    nodes[2].parent = 0;
+    nodes[4].parent = 2;
+    if (matrix_tree_build(&spec)) failed = 1;
+    nodes[4].parent = 1;
+    nodes[5].rows = 5;
+    if (matrix_tree_build(&spec)) failed = 1;
+    return failed;
+}
+
+// Nodes and children arrays built on worker threads, freed here (remote
+// frees), while the workers exit and park their pools; then wide arrays past
+// the largest size class, and a shallow destroy of a node sharing children
+typedef struct PoolBuild {
+    MatrixTreeNode* root;
+    uint32_t children;
+} PoolBuild;
+
+static int pool_build_thread(void* arg) {
+    PoolBuild* build = arg;
+    MatrixTreeNode** children = malloc(build->children * sizeof(MatrixTreeNode*));
+    if (!children) return 0;
+    build->root = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    for (uint32_t i = 0; i < build->children; i++) children[i] = matrix_tree_create_scaled_identity(2, 1.0);
+    matrix_tree_set_internal(build->root, children, build->children);
+    free(children);
+    return 1;
+}
+
+static int check_pool(void) {
+    const uint32_t widths[] = {3, 40, 700};
+    int failed = 0;
+
+    for (int round = 0; round < 2; round++) {
+        PoolBuild builds[3];
+        thrd_t workers[3];
+        for (int t = 0; t < 3; t++) {
+            builds[t] = (PoolBuild){ NULL, widths[t] };
+            if (thrd_create(&workers[t], pool_build_thread, &builds[t]) != thrd_success) return 1;
+        }
+        for (int t = 0; t < 3; t++) {
+            int ok = 0;
+            double out[4];
+            thrd_join(workers[t], &ok);
+            if (!ok || matrix_tree_collapse(builds[t].root, out) != 0 || out[0] != widths[t] || out[1] != 0.0) {
+                failed = 1;
+            }
+            matrix_tree_destroy(builds[t].root);
+        }
+    }
+
+    MatrixTreeNode* leaf = matrix_tree_create_scaled_identity(2, 3.0);
+    MatrixTreeNode* owner = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* alias = matrix_tree_create(2, 2, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {leaf};
+    matrix_tree_set_internal(owner, children, 1);
+    matrix_tree_set_internal(alias, children, 1);
+    matrix_tree_destroy_shallow(alias);
+    double out[4];
+    if (matrix_tree_collapse(owner, out) != 0 || out[3] != 3.0) failed = 1;
+    matrix_tree_destroy(owner);
+    return failed;
+}
+
+// The calling thread's workspace grows once, is reused by repeated calls,
+// and regrows after a trim; a worker thread gets a pool of its own
+static int workspace_thread(void* arg) {
+    (void)arg;
+    const double x[4] = {1, 2, 3, 4}, w = 1.0;
+    double y[4];
+    MatrixTreeNode* leaf = matrix_tree_create_scaled_identity(4, 2.0);
+    int ok = matrix_tree_workspace_size() == 0 && matrix_tree_multiply_weighted(leaf, x, &w, 1, y) == 0 &&
+             matrix_tree_workspace_size() > 0 && y[3] == 8.0;
+    matrix_tree_destroy(leaf);
+    return ok;
+}
+
+static int check_workspace(void) {
+    double a[64], x[8], y[8], out[64];
+    int failed = 0;
+
+    for (int i = 0; i < 64; i++) a[i] = i * 0.5;
+    for (int i = 0; i < 8; i++) x[i] = 1.0;
+    MatrixTreeNode* root = matrix_tree_create(8, 8, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {matrix_tree_create_leaf_with_data(8, 8, a),
+                                  matrix_tree_create_scaled_identity(8, 1.0)};
+    matrix_tree_set_internal(root, children, 2);
+
+    double w[2] = {1.0, 2.0};
+    matrix_tree_multiply_weighted(root, x, w, 1, y);
+    matrix_tree_collapse(root, out);
+    size_t high = matrix_tree_workspace_size();
+    for (int i = 0; i < 3; i++) {
+        matrix_tree_multiply_weighted(root, x, w, 1, y);
+        matrix_tree_collapse(root, out);
+    }
+    if (high == 0 || matrix_tree_workspace_size() != high) failed = 1;
+
+    matrix_tree_workspace_trim();
+    if (matrix_tree_workspace_size() != 0) failed = 1;
+    if (matrix_tree_collapse(root, out) != 0 || out[9] != a[9] + 1.0) failed = 1;
+
+    thrd_t worker;
+    int ok = 0;
+    if (thrd_create(&worker, workspace_thread, NULL) != thrd_success) {
+        failed = 1;
+    } else if (thrd_join(worker, &ok) != thrd_success || !ok) {
+        failed = 1;
+    }
+
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// Top-k over children with known response norms, including a structured
+// and an internal child, with and without products and across threads
+static int check_top_k(void) {
+    enum { N = 4, CHILDREN = 9 };
+    const double x[N] = {1.0, -1.0, 2.0, 0.5};
+    MatrixTreeNode* root = matrix_tree_create(N, N, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[CHILDREN];
+    double full[CHILDREN][N * N], prod[CHILDREN][N], want[CHILDREN];
+    int failed = 0;
+
+    for (int c = 0; c < CHILDREN - 2; c++) {
+        double a[N * N];
+        for (int i = 0; i < N * N; i++) a[i] = (double)(((c + 3) * (i + 1)) % 7) - 3.0;
+        children[c] = matrix_tree_create_leaf_with_data(N, N, a);
+    }
+    children[CHILDREN - 2] = matrix_tree_create_scaled_identity(N, 4.0);
+    matrix_tree_collapse(children[0], full[0]);
+    MatrixTreeNode* inner = matrix_tree_create(N, N, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* inner_children[] = {matrix_tree_create_leaf_with_data(N, N, full[0]),
+                                        matrix_tree_create_scaled_identity(N, -1.0)};
+    matrix_tree_set_internal(inner, inner_children, 2);
+    children[CHILDREN - 1] = inner;
+    matrix_tree_set_internal(root, children, CHILDREN);
+
+    for (int c = 0; c < CHILDREN; c++) {
+        matrix_tree_collapse(children[c], full[c]);
+        want[c] = 0.0;
+        for (int r = 0; r < N; r++) {
+            prod[c][r] = 0.0;
+            for (int j = 0; j < N; j++) prod[c][r] += full[c][r * N + j] * x[j];
+            want[c] += prod[c][r] * prod[c][r];
+        }
+        want[c] = sqrt(want[c]);
+    }
+
+    const uint32_t thread_counts[] = {1, 4};
+    for (int t = 0; t < 2; t++) {
+        uint64_t idx[3];
+        double norms[3], results[3 * N];
+        if (matrix_tree_top_k_children(root, x, 3, thread_counts[t], idx, norms, results) != 3) failed = 1;
+        for (int i = 0; i < 3 && !failed; i++) {
+            // Nothing left out ranks above the last pick
+            if (fabs(norms[i] - want[idx[i]]) > 1e-12) failed = 1;
+            if (i > 0 && norms[i] > norms[i - 1]) failed = 1;
+            for (int r = 0; r < N; r++) {
+                if (fabs(results[i * N + r] - prod[idx[i]][r]) > 1e-12) failed = 1;
+            }
+        }
+        for (int c = 0; c < CHILDREN && !failed; c++) {
+            int picked = c == (int)idx[0] || c == (int)idx[1] || c == (int)idx[2];
+            if (!picked && want[c] > norms[2]) failed = 1;
+        }
+    }
+
+    // k above the child count returns every child; indices alone are enough
+    uint64_t all[CHILDREN + 2];
+    if (matrix_tree_top_k_children(root, x, CHILDREN + 2, 2, all, NULL, NULL) != CHILDREN) failed = 1;
+
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// Per-element statistics over three children (dense, internal, diagonal),
+// single- and multi-threaded, against a direct two-pass computation
+static int check_child_stats(void) {
+    const uint32_t n = 80;
+    size_t total = (size_t)n * n;
+    double* data = malloc(3 * total * sizeof(double));
+    double* full = malloc(3 * total * sizeof(double));
+    double* out = malloc(4 * total * sizeof(double));
+    double diag[80];
+    int failed = !data || !full || !out;
+
+    if (!failed) {
+        for (size_t i = 0; i < 3 * total; i++) data[i] = (double)((i * 7) % 19) - 9.0;
+        for (uint32_t i = 0; i < n; i++) diag[i] = 0.5 * i;
+
+        MatrixTreeNode* dg = matrix_tree_create_diagonal(n);
+        matrix_tree_set_leaf(dg, diag, sizeof(diag));
+        MatrixTreeNode* inner = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* inner_children[] = {matrix_tree_create_leaf_with_data(n, n, data + total),
+                                            matrix_tree_create_leaf_with_data(n, n, data + 2 * total)};
+        matrix_tree_set_internal(inner, inner_children, 2);
+        MatrixTreeNode* root = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* children[] = {matrix_tree_create_leaf_with_data(n, n, data), inner, dg};
+        matrix_tree_set_internal(root, children, 3);
+        for (int j = 0; j < 3; j++) matrix_tree_collapse(children[j], full + j * total);
+
+        const uint32_t thread_counts[] = {1, 3};
+        for (int t = 0; t < 2; t++) {
+            double *mean = out, *var = out + total, *lo = out + 2 * total, *hi = out + 3 * total;
+            if (matrix_tree_child_stats(root, mean, var, lo, hi, thread_counts[t]) != 0) failed = 1;
+            for (size_t i = 0; i < total; i++) {
+                double a = full[i], b = full[total + i], c = full[2 * total + i];
+                double m = (a + b + c) / 3.0;
+                double v = ((a - m) * (a - m) + (b - m) * (b - m) + (c - m) * (c - m)) / 3.0;
+                double mn = fmin(a, fmin(b, c)), mx = fmax(a, fmax(b, c));
+                if (fabs(mean[i] - m) > 1e-12 || fabs(var[i] - v) > 1e-10 || lo[i] != mn || hi[i] != mx) failed = 1;
+            }
+        }
+
+        // Outputs are optional; an empty internal node has no statistics
+        if (matrix_tree_child_stats(root, NULL, out, NULL, NULL, 2) != 0) failed = 1;
+        MatrixTreeNode* empty = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+        if (matrix_tree_child_stats(empty, out, NULL, NULL, NULL, 1) == 0) failed = 1;
+        matrix_tree_destroy(empty);
+        matrix_tree_destroy(root);
+    }
+
+    free(data);
+    free(full);
+    free(out);
+    return failed;
+}
+
+// Reductions of a tree mixing a dense leaf with every structured kind,
+// against the collapsed matrix
+static int check_reductions(void) {
+    const uint32_t n = 70;
+    size_t total = (size_t)n * n;
+    double* dense = malloc(total * sizeof(double));
+    double* full = malloc(total * sizeof(double));
+    double* packed = malloc((size_t)n * (n + 1) / 2 * sizeof(double));
+    double* band = malloc((size_t)n * 5 * sizeof(double));
+    double* diag = malloc(n * sizeof(double));
+    int failed = !dense || !full || !packed || !band || !diag;
+
+    if (!failed) {
+        for (size_t i = 0; i < total; i++) dense[i] = (double)(i % 11) - 5.0;
+        for (size_t i = 0; i < (size_t)n * (n + 1) / 2; i++) packed[i] = 0.5 * (double)(i % 3);
+        for (size_t i = 0; i < (size_t)n * 5; i++) band[i] = (double)(i % 4) - 1.5;
+        for (uint32_t i = 0; i < n; i++) diag[i] = i * 0.1;
+
+        MatrixTreeNode* sym = matrix_tree_create_symmetric(n);
+        MatrixTreeNode* dg = matrix_tree_create_diagonal(n);
+        MatrixTreeNode* id = matrix_tree_create_scaled_identity(n, 2.5);
+        MatrixTreeNode* bd = matrix_tree_create_banded(n, 2);
+        matrix_tree_set_leaf(sym, packed, (size_t)n * (n + 1) / 2 * sizeof(double));
+        matrix_tree_set_leaf(dg, diag, n * sizeof(double));
+        matrix_tree_set_leaf(bd, band, (size_t)n * 5 * sizeof(double));
+        MatrixTreeNode* root = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* children[] = {matrix_tree_create_leaf_with_data(n, n, dense), sym, dg, id, bd};
+        matrix_tree_set_internal(root, children, 5);
+        matrix_tree_collapse(root, full);
+
+        double want_sum = 0.0, want_trace = 0.0, want_sq = 0.0;
+        for (size_t i = 0; i < total; i++) {
+            want_sum += full[i];
+            want_sq += full[i] * full[i];
+        }
+        for (uint32_t i = 0; i < n; i++) want_trace += full[(size_t)i * n + i];
+
+        double sum, trace, fro;
+        if (matrix_tree_sum(root, &sum) != 0 || fabs(sum - want_sum) > 1e-9) failed = 1;
+        if (matrix_tree_trace(root, &trace) != 0 || fabs(trace - want_trace) > 1e-9) failed = 1;
+        if (matrix_tree_frobenius_norm(root, &fro) != 0 || fabs(fro - sqrt(want_sq)) > 1e-9) failed = 1;
+
+        // A lone dense leaf, non-square
+        MatrixTreeNode* wide = matrix_tree_create_leaf_with_data(2, 3, dense);
+        if (matrix_tree_trace(wide, &trace) != 0 || trace != dense[0] + dense[4]) failed = 1;
+        matrix_tree_destroy(wide);
+        matrix_tree_destroy(root);
+    }
+
+    free(dense);
+    free(full);
+    free(packed);
+    free(band);
+    free(diag);
+    return failed;
+}
+
+// Elementwise ops between a dense+diagonal tree and a dense+symmetric tree,
+// large enough to span several tiles
+static int check_elementwise(void) {
+    const uint32_t n = 96;
+    size_t total = (size_t)n * n;
+    double* a = malloc(total * sizeof(double));
+    double* b = malloc(total * sizeof(double));
+    double* full_a = malloc(total * sizeof(double));
+    double* full_b = malloc(total * sizeof(double));
+    double* out = malloc(total * sizeof(double));
+    double* diag = malloc(n * sizeof(double));
+    double* packed = malloc((size_t)n * (n + 1) / 2 * sizeof(double));
+    int failed = !a || !b || !full_a || !full_b || !out || !diag || !packed;
+
+    if (!failed) {
+        for (size_t i = 0; i < total; i++) {
+            a[i] = (double)(i % 13) - 6.0;
+            b[i] = 0.25 * (double)(i % 7);
+        }
+        for (uint32_t i = 0; i < n; i++) diag[i] = i + 1.0;
+        for (size_t i = 0; i < (size_t)n * (n + 1) / 2; i++) packed[i] = (double)(i % 5) - 2.0;
+
+        MatrixTreeNode* da = matrix_tree_create_diagonal(n);
+        MatrixTreeNode* sb = matrix_tree_create_symmetric(n);
+        matrix_tree_set_leaf(da, diag, n * sizeof(double));
+        matrix_tree_set_leaf(sb, packed, (size_t)n * (n + 1) / 2 * sizeof(double));
+        MatrixTreeNode* ta = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* tb = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+        MatrixTreeNode* ca[] = {matrix_tree_create_leaf_with_data(n, n, a), da};
+        MatrixTreeNode* cb[] = {matrix_tree_create_leaf_with_data(n, n, b), sb};
+        matrix_tree_set_internal(ta, ca, 2);
+        matrix_tree_set_internal(tb, cb, 2);
+        matrix_tree_collapse(ta, full_a);
+        matrix_tree_collapse(tb, full_b);
+
+        const int ops[] = {MATRIX_TREE_ELEMENTWISE_ADD, MATRIX_TREE_ELEMENTWISE_SUB, MATRIX_TREE_ELEMENTWISE_HADAMARD};
+        for (int o = 0; o < 3; o++) {
+            if (matrix_tree_elementwise(ta, tb, ops[o], out) != 0) failed = 1;
+            for (size_t i = 0; i < total; i++) {
+                double want = o == 0 ? full_a[i] + full_b[i] : o == 1 ? full_a[i] - full_b[i] : full_a[i] * full_b[i];
+                if (fabs(out[i] - want) > 1e-12) failed = 1;
+            }
+        }
+
+        // Shape mismatch and unknown op are rejected
+        MatrixTreeNode* small = matrix_tree_create_diagonal(n - 1);
+        if (matrix_tree_elementwise(ta, small, MATRIX_TREE_ELEMENTWISE_ADD, out) == 0) failed = 1;
+        if (matrix_tree_elementwise(ta, tb, 3, out) == 0) failed = 1;
+        matrix_tree_destroy(small);
+        matrix_tree_destroy(ta);
+        matrix_tree_destroy(tb);
+    }
+
+    free(a);
+    free(b);
+    free(full_a);
+    free(full_b);
+    free(out);
+    free(diag);
+    free(packed);
+    return failed;
+}
+
+// Autotune into a scratch cache, reload it, and collapse at odd tile sizes
+static int check_tuning(void) {
+    const char* path = "check_tests.cache/check_tests.tune";    // Directory made by the store
+    MatrixTreeTuning before, tuned, loaded, odd;
+    int failed = 0;
+
+    matrix_tree_get_tuning(&before);
+    if (matrix_tree_autotune(path) != 0) failed = 1;
+    matrix_tree_get_tuning(&tuned);
+
+    MatrixTreeTuning reset;
+    matrix_tree_get_tuning(&reset);
+    reset.tile_elems = MATRIX_TREE_MAX_TILE_ELEMS;
+    reset.stream_threshold = MATRIX_TREE_STREAM_THRESHOLD;
+    matrix_tree_set_tuning(&reset);
+    if (matrix_tree_tune_load(path) != 0) failed = 1;
+    matrix_tree_get_tuning(&loaded);
+    if (loaded.tile_elems != tuned.tile_elems ||
+        loaded.stream_threshold != tuned.stream_threshold ||
+        loaded.c_backend_ops != tuned.c_backend_ops) failed = 1;
+
+    // A backend picked by hand outlasts a later autotune and load
+    int scale_backend = matrix_tree_get_backend(MATRIX_TREE_OP_SCALE);
+    int picked = scale_backend == MATRIX_TREE_BACKEND_C ? MATRIX_TREE_BACKEND_ASM : MATRIX_TREE_BACKEND_C;
+    matrix_tree_set_backend(MATRIX_TREE_OP_SCALE, picked);
+    if (matrix_tree_autotune(path) != 0 || matrix_tree_tune_load(path) != 0 ||
+        matrix_tree_get_backend(MATRIX_TREE_OP_SCALE) != picked) failed = 1;
+    matrix_tree_set_backend(MATRIX_TREE_OP_SCALE, scale_backend);
+    remove(path);
+    remove("check_tests.cache");
+
+    MatrixTreeTuning too_big = {MATRIX_TREE_MAX_TILE_ELEMS + 1, 0, 0};
+    if (matrix_tree_set_tuning(&too_big) == 0) failed = 1;
+
+    // Threshold 0 streams every AUTO collapse through 7-element tiles
+    odd = before;
+    odd.tile_elems = 7;
+    odd.stream_threshold = 0;
+    matrix_tree_set_tuning(&odd);
+    if (check_collapse_policies() != 0) failed = 1;
+    matrix_tree_set_tuning(&before);
+    return failed;
+}
+
+// Packed symmetric leaves mixed with dense ones, against the expanded matrix
+static int check_structured_n(uint32_t n) {
+    size_t packed = (size_t)n * (n + 1) / 2, total = (size_t)n * n;
+    double* p = malloc(packed * sizeof(double));
+    double* dense = malloc(total * sizeof(double));
+    double* full = malloc(total * sizeof(double));
+    double* out = malloc(total * sizeof(double));
+    double* x = malloc(n * sizeof(double));
+    double* y = malloc(n * sizeof(double));
+    int failed = 0;
+
+    for (size_t i = 0; i < packed; i++) p[i] = 0.25 * (double)(i % 23) - 1.0;
+    for (uint32_t r = 0, k = 0; r < n; r++) {
+        for (uint32_t c = r; c < n; c++, k++) full[r * n + c] = full[c * n + r] = p[k];
+        x[r] = 1.0 - 0.125 * r;
+    }
+    for (size_t i = 0; i < total; i++) dense[i] = (double)(i % 7);
+
+    MatrixTreeNode* sym = matrix_tree_create_symmetric(n);
+    if (!sym || matrix_tree_set_leaf(sym, p, packed * sizeof(double)) != 0) return 1;
+    MatrixTreeNode* leaf = matrix_tree_create_leaf_with_data(n, n, dense);
+    MatrixTreeNode* root = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {sym, leaf};
+    matrix_tree_set_internal(root, children, 2);
+
+    matrix_tree_scale(sym, 2.0);
+    matrix_tree_collapse(root, out);
+    for (size_t i = 0; i < total; i++) {
+        if (out[i] != 2.0 * full[i] + dense[i]) failed = 1;
+    }
+
+    // Mixed tree multiplies through the collapse, the lone leaf through SYMV
+    MatrixTreeNode* nodes[] = {root, sym};
+    for (int t = 0; t < 2; t++) {
+        matrix_tree_multiply_collapsed(nodes[t], x, y);
+        for (uint32_t r = 0; r < n; r++) {
+            double expect = 0.0;
+            for (uint32_t c = 0; c < n; c++) expect += (2.0 * full[r * n + c] + (t ? 0.0 : dense[r * n + c])) * x[c];
+            if (fabs(y[r] - expect) > 1e-10 * (1.0 + fabs(expect))) failed = 1;
+        }
+    }
+
+    matrix_tree_destroy(root);
+    free(p);
+    free(dense);
+    free(full);
+    free(out);
+    free(x);
+    free(y);
+    return failed;
+}
+
+// Diagonal, scaled-identity and banded leaves, alone and on a dense leaf
+static int check_band_kinds(uint32_t n) {
+    const uint32_t b = 2, w = 2 * b + 1;
+    size_t total = (size_t)n * n;
+    double* band = malloc(n * w * sizeof(double));
+    double* diag = malloc(n * sizeof(double));
+    double* dense = malloc(total * sizeof(double));
+    double* full = calloc(total, sizeof(double));
+    double* out = malloc(total * sizeof(double));
+    double* x = malloc(n * sizeof(double));
+    double* y = malloc(n * sizeof(double));
+    int failed = 0;
+
+    for (uint32_t r = 0; r < n; r++) {
+        diag[r] = 1.0 + r;
+        x[r] = 0.5 - 0.25 * r;
+        for (uint32_t j = 0; j < w; j++) {
+            band[r * w + j] = 0.125 * (r + j) - 1.0;
+            int64_t c = (int64_t)r + j - b;
+            if (c >= 0 && c < n) full[r * n + c] += band[r * w + j];
+        }
+        full[r * n + r] += diag[r] + 3.0;      // diagonal + 1.5 I scaled by 2
+    }
+    for (size_t i = 0; i < total; i++) dense[i] = (double)(i % 5) - 2.0;
+
+    MatrixTreeNode* lb = matrix_tree_create_banded(n, b);
+    MatrixTreeNode* ld = matrix_tree_create_diagonal(n);
+    MatrixTreeNode* li = matrix_tree_create_scaled_identity(n, 1.5);
+    if (!lb || !ld || !li) return 1;
+    if (matrix_tree_set_leaf(lb, band, n * w * sizeof(double)) != 0) failed = 1;
+    if (matrix_tree_set_leaf(ld, diag, n * sizeof(double)) != 0) failed = 1;
+    matrix_tree_scale(li, 2.0);
+
+    MatrixTreeNode* structured = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* kinds[] = {lb, ld, li};
+    matrix_tree_set_internal(structured, kinds, 3);
+    MatrixTreeNode* leaf = matrix_tree_create_leaf_with_data(n, n, dense);
+    MatrixTreeNode* root = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* top[] = {structured, leaf};
+    matrix_tree_set_internal(root, top, 2);
+
+    // Structured-only subtree, then the mixed tree
+    MatrixTreeNode* nodes[] = {structured, root};
+    for (int t = 0; t < 2; t++) {
+        matrix_tree_collapse(nodes[t], out);
+        for (size_t i = 0; i < total; i++) {
+            if (fabs(out[i] - full[i] - (t ? dense[i] : 0.0)) > 1e-12) failed = 1;
+        }
+        matrix_tree_multiply_collapsed(nodes[t], x, y);
+        for (uint32_t r = 0; r < n; r++) {
+            double expect = 0.0;
+            for (uint32_t c = 0; c < n; c++) expect += (full[r * n + c] + (t ? dense[r * n + c] : 0.0)) * x[c];
+            if (fabs(y[r] - expect) > 1e-10 * (1.0 + fabs(expect))) failed = 1;
+        }
+    }
+
+    matrix_tree_destroy(root);
+    free(band);
+    free(diag);
+    free(dense);
+    free(full);
+    free(out);
+    free(x);
+    free(y);
+    return failed;
+}
+
+static int check_structured(void) {
+    // 4x4 takes the generated-kernel path, 37x37 spans several tiles
+    if (matrix_tree_create_symmetric(0) != NULL) return 1;
+    if (matrix_tree_create_banded(4, 4) != NULL) return 1;
+    return check_structured_n(4) || check_structured_n(37) ||
+           check_band_kinds(4) || check_band_kinds(37);
+}
+
+// Column-major and blocked collapse against the row-major result, on a
+// nested 37x29 tree spanning several tiles
+static int check_layouts(void) {
+    const uint32_t rows = 37, cols = 29;
+    const uint32_t blocks[] = {0, 5, 32, 48};
+    double a[37 * 29], ref[37 * 29], out[64 * 64];
+    int failed = 0;
+
+    for (uint32_t i = 0; i < rows * cols; i++) a[i] = (double)(i % 19) - 6.0;
+    MatrixTreeNode* leaf = matrix_tree_create_leaf_with_data(rows, cols, a);
+    MatrixTreeNode* inner = matrix_tree_create(rows, cols, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* root = matrix_tree_create(rows, cols, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* inner_children[] = {matrix_tree_create_leaf_with_data(rows, cols, a)};
+    MatrixTreeNode* children[] = {leaf, inner};
+    matrix_tree_set_internal(inner, inner_children, 1);
+    matrix_tree_set_internal(root, children, 2);
+    matrix_tree_collapse(root, ref);
+
+    if (matrix_tree_collapse_layout(root, out, MATRIX_TREE_LAYOUT_COL_MAJOR, 0) != 0) failed = 1;
+    for (uint32_t r = 0; r < rows; r++) {
+        for (uint32_t c = 0; c < cols; c++) {
+            if (out[c * rows + r] != ref[r * cols + c]) failed = 1;
+        }
+    }
+
+    for (int k = 0; k < 4; k++) {
+        uint32_t b = blocks[k] ? blocks[k] : MATRIX_TREE_BLOCK_DIM;
+        uint32_t brows = (rows + b - 1) / b, bcols = (cols + b - 1) / b;
+        for (uint32_t i = 0; i < 64 * 64; i++) out[i] = -1.0;
+        if (matrix_tree_collapse_layout(root, out, MATRIX_TREE_LAYOUT_BLOCKED, blocks[k]) != 0) failed = 1;
+        for (uint32_t r = 0; r < brows * b; r++) {
+            for (uint32_t c = 0; c < bcols * b; c++) {
+                double want = r < rows && c < cols ? ref[r * cols + c] : 0.0;
+                if (out[((r / b) * bcols + c / b) * b * b + (r % b) * b + c % b] != want) failed = 1;
+            }
+        }
+    }
+
+    if (matrix_tree_collapse_layout(root, out, 7, 0) == 0) failed = 1;
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// Sparse x against the tree and against each collapsed layout
+static int check_sparse(void) {
+    const uint32_t rows = 11, cols = 13, b = MATRIX_TREE_BLOCK_DIM;
+    const uint32_t index[] = {12, 0, 7, 8};
+    const double value[] = {2.0, -1.0, 0.5, 3.0};
+    double a[11 * 13], x[13] = {0}, y_ref[11], y[11];
+    double col_major[11 * 13], blocked[16 * 16] = {0};
+    int failed = 0;
+
+    for (uint32_t i = 0; i < rows * cols; i++) a[i] = (double)(i % 17) - 4.0;
+    for (int k = 0; k < 4; k++) x[index[k]] = value[k];
+    for (uint32_t r = 0; r < rows; r++) {
+        for (uint32_t c = 0; c < cols; c++) {
+            col_major[c * rows + r] = 2.0 * a[r * cols + c];
+            blocked[((r / b) * 2 + c / b) * b * b + (r % b) * b + c % b] = 2.0 * a[r * cols + c];
+        }
+    }
+
+    MatrixTreeNode* la = matrix_tree_create_leaf_with_data(rows, cols, a);
+    MatrixTreeNode* lb = matrix_tree_create_leaf_with_data(rows, cols, a);
+    MatrixTreeNode* root = matrix_tree_create(rows, cols, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {la, lb};
+    matrix_tree_set_internal(root, children, 2);
+    matrix_tree_multiply_collapsed(root, x, y_ref);
+
+    if (matrix_tree_multiply_sparse(root, index, value, 4, y) != 0) failed = 1;
+    for (uint32_t r = 0; r < rows; r++) {
+        if (fabs(y[r] - y_ref[r]) > 1e-12 * (1.0 + fabs(y_ref[r]))) failed = 1;
+    }
+
+    const double* layouts[] = {NULL, col_major, blocked};
+    double collapsed[11 * 13];
+    matrix_tree_collapse(root, collapsed);
+    layouts[0] = collapsed;
+    for (uint32_t l = 0; l < 3; l++) {
+        if (matrix_tree_multiply_sparse_collapsed(layouts[l], rows, cols, l, 0, index, value, 4, y) != 0) {
+            failed = 1;
+        }
+        for (uint32_t r = 0; r < rows; r++) {
+            if (fabs(y[r] - y_ref[r]) > 1e-12 * (1.0 + fabs(y_ref[r]))) failed = 1;
+        }
+    }
+
+    // Blocks of another size, as collapse_layout writes them
+    if (matrix_tree_collapse_layout(root, blocked, MATRIX_TREE_LAYOUT_BLOCKED, 16) != 0 ||
+        matrix_tree_multiply_sparse_collapsed(blocked, rows, cols, MATRIX_TREE_LAYOUT_BLOCKED, 16, index, value,
+                                              4, y) != 0) {
+        failed = 1;
+    }
+    for (uint32_t r = 0; r < rows; r++) {
+        if (fabs(y[r] - y_ref[r]) > 1e-12 * (1.0 + fabs(y_ref[r]))) failed = 1;
+    }
+
+    const uint32_t bad[] = {13};
+    if (matrix_tree_multiply_sparse(root, bad, value, 1, y) == 0) failed = 1;
+    matrix_tree_destroy(root);
+
+    // Structured leaves, columns at both edges and inside the band
+    const uint32_t n = 9;
+    const uint32_t sindex[] = {0, 4, 8, 5};
+    double packed[45], diag[9], band[9 * 5], sx[9] = {0}, sy[9], sy_ref[9];
+    for (int i = 0; i < 45; i++) packed[i] = (double)(i % 7) - 3.0;
+    for (uint32_t i = 0; i < n; i++) diag[i] = 1.0 + i;
+    for (int i = 0; i < 45; i++) band[i] = (double)(i % 5) - 2.0;
+    for (int k = 0; k < 4; k++) sx[sindex[k]] = value[k];
+
+    MatrixTreeNode* sym = matrix_tree_create_symmetric(n);
+    MatrixTreeNode* dg = matrix_tree_create_diagonal(n);
+    MatrixTreeNode* bd = matrix_tree_create_banded(n, 2);
+    matrix_tree_set_leaf(sym, packed, sizeof(packed));
+    matrix_tree_set_leaf(dg, diag, sizeof(diag));
+    matrix_tree_set_leaf(bd, band, sizeof(band));
+    root = matrix_tree_create(n, n, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* kinds[] = {sym, dg, matrix_tree_create_scaled_identity(n, -1.5), bd};
+    matrix_tree_set_internal(root, kinds, 4);
+    matrix_tree_multiply_collapsed(root, sx, sy_ref);
+    if (matrix_tree_multiply_sparse(root, sindex, value, 4, sy) != 0) failed = 1;
+    for (uint32_t r = 0; r < n; r++) {
+        if (fabs(sy[r] - sy_ref[r]) > 1e-12 * (1.0 + fabs(sy_ref[r]))) failed = 1;
+    }
+    matrix_tree_destroy(root);
+    return failed;
+}
+
+// Publish a tree, attach it and evaluate the attached copy
+static int check_shared_memory(void) {
+    double a[] = {1, 2, 3, 4, 5, 6}, b[] = {-1, 0.5, 2, 8, 0, 3};
+    double x[] = {1, -1, 2}, out[6], y[2], y_ref[2];
+    char name[64];
+    int failed = 0;
+
+    snprintf(name, sizeof(name), "matrix_tree_check_%d", (int)check_pid());
+    MatrixTreeNode* la = matrix_tree_create_leaf_with_data(2, 3, a);
+    MatrixTreeNode* lb = matrix_tree_create_leaf_with_data(2, 3, b);
+    MatrixTreeNode* root = matrix_tree_create(2, 3, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* children[] = {la, lb};
+    matrix_tree_set_internal(root, children, 2);
+    matrix_tree_multiply_collapsed(root, x, y_ref);
+
+    if (matrix_tree_publish(root, name) != 0) failed = 1;
+    matrix_tree_destroy(root);
+
+    MatrixTreeNode* shared = matrix_tree_attach(name);
+    if (!shared) {
+        failed = 1;
+    } else {
+        matrix_tree_collapse(shared, out);
+        for (int i = 0; i < 6; i++) {
+            if (out[i] != a[i] + b[i]) failed = 1;
+        }
+        matrix_tree_multiply_collapsed(shared, x, y);
+        if (y[0] != y_ref[0] || y[1] != y_ref[1]) failed = 1;
+        matrix_tree_detach(shared);
+    }
+
+    if (matrix_tree_unpublish(name) != 0) failed = 1;
+    if (matrix_tree_attach(name) != NULL) failed = 1;
+    return failed;
+}
+
+#ifndef _WIN32
+// Serve a published tree from a child process to several concurrent clients
+static int check_server(void) {
+    double a[] = {1, 2, 3, 4, 5, 6};
+    char name[64], path[64];
+    int failed = 0;
+
+    snprintf(name, sizeof(name), "matrix_tree_serve_%d", (int)check_pid());
+    snprintf(path, sizeof(path), "/tmp/matrix_tree_check_%d.sock", (int)check_pid());
+    MatrixTreeNode* leaf = matrix_tree_create_leaf_with_data(2, 3, a);
+    if (matrix_tree_publish(leaf, name) != 0) failed = 1;
+    matrix_tree_destroy(leaf);
+
+    pid_t server = fork();
+    if (server == 0) _exit(matrix_tree_serve(path, 2000, NULL) == 0 ? 0 : 1);
+
+    // Clients race the server's bind; each retries its first connect
+    pid_t clients[4];
+    for (int k = 0; k < 4; k++) {
+        clients[k] = fork();
+        if (clients[k] == 0) {
+            double x[3] = {1.0 + k, -1.0, 0.5}, y[2];
+            int rc = -1;
+            for (int tries = 0; tries < 200 && rc != 0; tries++) {
+                rc = matrix_tree_remote_multiply(path, name, x, 3, y, 2);
+                if (rc != 0) usleep(5000);
+            }
+            int ok = rc == 0 && y[0] == a[0] * x[0] + a[1] * x[1] + a[2] * x[2] &&
+                     y[1] == a[3] * x[0] + a[4] * x[1] + a[5] * x[2];
+            _exit(ok ? 0 : 1);
+        }
+    }
+    for (int k = 0; k < 4; k++) {
+        int status;
+        waitpid(clients[k], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    }
+
+    double x[2] = {1, 1}, y[2];
+    if (matrix_tree_remote_multiply(path, name, x, 2, y, 2) == 0) failed = 1;   // wrong length
+
+    // A republish under the same name is served from then on
+    double b[] = {-1, 0, 2, 4, 1, 1}, x3[3] = {1, 2, 3};
+    leaf = matrix_tree_create_leaf_with_data(2, 3, b);
+    if (matrix_tree_publish(leaf, name) != 0) failed = 1;
+    matrix_tree_destroy(leaf);
+    if (matrix_tree_remote_multiply(path, name, x3, 3, y, 2) != 0 || y[0] != 5.0 || y[1] != 9.0) failed = 1;
+    if (matrix_tree_remote_shutdown(path) != 0) failed = 1;
+
+    int status;
+    waitpid(server, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    matrix_tree_unpublish(name);
+    return failed;
+}
+#endif
+
+// Consumer thread pops results while the main thread pushes past capacity
+typedef struct PipelineCheck {
+    MatrixTreePipeline* pipeline;
+    const double* a;
+    int count;
+    int failed;
+} PipelineCheck;
+
+static int pipeline_consumer(void* arg) {
+    PipelineCheck* c = arg;
+    double y[2];
+
+    for (int k = 0; k < c->count; k++) {
+        double x0 = k, x1 = -1.0, x2 = 0.25 * k;
+        if (matrix_tree_pipeline_pop(c->pipeline, y) != 0 ||
+            y[0] != c->a[0] * x0 + c->a[1] * x1 + c->a[2] * x2 ||
+            y[1] != c->a[3] * x0 + c->a[4] * x1 + c->a[5] * x2) {
+            c->failed = 1;
+        }
+    }
+    if (matrix_tree_pipeline_pop(c->pipeline, y) != -1) c->failed = 1;   // closed and drained
+    return 0;
+}
+
+// Producer thread for the shared-ring check: pushes {k, id, 0} in order
+typedef struct PipelineProducer {
+    MatrixTreePipeline* pipeline;
+    int id;
+    int count;
+    int failed;
+} PipelineProducer;
+
+static int pipeline_producer(void* arg) {
+    PipelineProducer* p = arg;
+    for (int k = 0; k < p->count; k++) {
+        double x[3] = {k, p->id, 0.0};
+        if (matrix_tree_pipeline_push(p->pipeline, x) != 0) p->failed = 1;
+    }
+    return 0;
+}
+
+static int check_pipeline(void) {
+    double a[] = {1, 2, 3, 4, 5, 6};
+    MatrixTreeNode* leaf = matrix_tree_create_leaf_with_data(2, 3, a);
+    PipelineCheck c = {matrix_tree_pipeline_create(leaf, 4, 3), a, 50, 0};
+    thrd_t consumer;
+
+    matrix_tree_destroy(leaf);
+    if (!c.pipeline || thrd_create(&consumer, pipeline_consumer, &c) != thrd_success) return 1;
+    for (int k = 0; k < c.count; k++) {
+        double x[3] = {k, -1.0, 0.25 * k};
+        if (matrix_tree_pipeline_push(c.pipeline, x) != 0) c.failed = 1;
+    }
+    matrix_tree_pipeline_close(c.pipeline);
+    thrd_join(consumer, NULL);
+
+    double x[3] = {0};
+    if (matrix_tree_pipeline_push(c.pipeline, x) != -1) c.failed = 1;
+    matrix_tree_pipeline_destroy(c.pipeline);
+
+    // Two producers share a small ring: every vector comes back exactly once,
+    // and each producer's vectors in its push order
+    leaf = matrix_tree_create_leaf_with_data(2, 3, a);
+    MatrixTreePipeline* shared = matrix_tree_pipeline_create(leaf, 3, 2);
+    matrix_tree_destroy(leaf);
+    if (!shared) return 1;
+    PipelineProducer producers[2] = {{shared, 1, 200, 0}, {shared, 2, 200, 0}};
+    thrd_t threads[2];
+    int started = 0;
+    while (started < 2 && thrd_create(&threads[started], pipeline_producer, &producers[started]) == thrd_success) {
+        started++;
+    }
+    if (started < 2) c.failed = 1;
+
+    int next[3] = {0, 0, 0};
+    double y[2];
+    for (int n = 0; n < producers[0].count * started; n++) {
+        if (matrix_tree_pipeline_pop(shared, y) != 0) {
+            c.failed = 1;
+            break;
+        }
+        int id = (int)((4.0 * y[0] - y[1]) / 3.0);      // y = {k + 2 id, 4 k + 5 id}
+        int k = (int)y[0] - 2 * id;
+        if (id < 1 || id > 2 || k != next[id]++) c.failed = 1;
+    }
+    for (int t = 0; t < started; t++) {
+        thrd_join(threads[t], NULL);
+        c.failed |= producers[t].failed;
+    }
+    matrix_tree_pipeline_close(shared);
+    if (matrix_tree_pipeline_pop(shared, y) != -1) c.failed = 1;
+    matrix_tree_pipeline_destroy(shared);
+    return c.failed;
+}
+
+// Nested tree larger than one collapse tile, collapsed with every store policy
+static int check_collapse_policies(void) {
+    const uint32_t rows = 37, cols = 61;
+    const size_t n = (size_t)rows * cols;
+    double* a = malloc(n * sizeof(double));
+    double* b = malloc(n * sizeof(double));
+    double* out = malloc((n + 1) * sizeof(double));
+    double x[61], y[37];
+    int failed = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        a[i] = (double)i;
+        b[i] = 0.5 * (double)(n - i);
+    }
+    for (uint32_t j = 0; j < cols; j++) x[j] = 1.0 + 0.25 * j;
+
+    MatrixTreeNode* la = matrix_tree_create_leaf_with_data(rows, cols, a);
+    MatrixTreeNode* lb = matrix_tree_create_leaf_with_data(rows, cols, b);
+    MatrixTreeNode* inner = matrix_tree_create(rows, cols, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* pair[] = {la, lb};
+    matrix_tree_set_internal(inner, pair, 2);
+    MatrixTreeNode* lc = matrix_tree_create_leaf_with_data(rows, cols, a);
+    MatrixTreeNode* root = matrix_tree_create(rows, cols, NODE_TYPE_INTERNAL);
+    MatrixTreeNode* top[] = {inner, lc};
+    matrix_tree_set_internal(root, top, 2);
+
+    const uint32_t policies[] = {
+        MATRIX_TREE_COLLAPSE_AUTO, MATRIX_TREE_COLLAPSE_STREAM, MATRIX_TREE_COLLAPSE_CACHED
+    };
+    for (int p = 0; p < 3; p++) {
+        // Offset by one element so streaming also covers a misaligned head
+        for (int off = 0; off < 2; off++) {
+            matrix_tree_collapse_ex(root, out + off, policies[p]);
+            for (size_t i = 0; i < n; i++) {
+                if (out[off + i] != 2.0 * a[i] + b[i]) failed = 1;
+            }
+        }
+    }
+
+    matrix_tree_multiply_collapsed(root, x, y);
+    for (uint32_t r = 0; r < rows; r++) {
+        double expect = 0.0;
+        for (uint32_t j = 0; j < cols; j++) {
+            size_t i = (size_t)r * cols + j;
+            expect += (2.0 * a[i] + b[i]) * x[j];
+        }
+        if (fabs(y[r] - expect) > 1e-9 * fabs(expect)) failed = 1;
+    }
+
+    // Batch of three: x, 2x and x again must give y, 2y, y
+    double xs[3 * 61], ys[3 * 37];
+    for (uint32_t j = 0; j < cols; j++) {
+        xs[j] = x[j];
+        xs[cols + j] = 2.0 * x[j];
+        xs[2 * cols + j] = x[j];
+    }
+    if (matrix_tree_multiply_batch(root, xs, 3, ys) != 0) failed = 1;
+    for (uint32_t r = 0; r < rows; r++) {
+        if (fabs(ys[r] - y[r]) > 1e-9 * fabs(y[r]) ||
+            fabs(ys[rows + r] - 2.0 * y[r]) > 1e-9 * fabs(y[r]) || ys[2 * rows + r] != ys[r]) failed = 1;
+    }
+
+    matrix_tree_destroy(root);
+    free(a);
+    free(b);
+    free(out);
+    return failed;
+}
+
 int main() {
     printf("===  Matrix-Tree Assembly Implementation ===\n");
     
@@ -60,6 +1542,101 @@ int main() {
     matrix_tree_print(leaf, 0);
 
     matrix_tree_destroy(leaf);
+
+    if (check_collapse_policies() != 0) {
+        printf("Collapse check failed\n");
+        return 1;
+    }
+    if (check_shape_kernels() != 0) {
+        printf("Shape kernel check failed\n");
+        return 1;
+    }
+    if (check_backends() != 0) {
+        printf("Backend check failed\n");
+        return 1;
+    }
+    if (check_blas() != 0) {
+        printf("BLAS check failed\n");
+        return 1;
+    }
+    if (check_tuning() != 0) {
+        printf("Tuning check failed\n");
+        return 1;
+    }
+    if (check_structured() != 0) {
+        printf("Structured leaf check failed\n");
+        return 1;
+    }
+    if (check_optimize() != 0) {
+        printf("Optimize check failed\n");
+        return 1;
+    }
+    if (check_freeze() != 0) {
+        printf("Freeze check failed\n");
+        return 1;
+    }
+    if (check_all_levels() != 0) {
+        printf("All-levels collapse check failed\n");
+        return 1;
+    }
+    if (check_weighted() != 0) {
+        printf("Weighted combination check failed\n");
+        return 1;
+    }
+    if (check_update() != 0) {
+        printf("Leaf update check failed\n");
+        return 1;
+    }
+    if (check_build() != 0) {
+        printf("Bulk build check failed\n");
+        return 1;
+    }
+    if (check_pool() != 0) {
+        printf("Node pool check failed\n");
+        return 1;
+    }
+    if (check_workspace() != 0) {
+        printf("Workspace check failed\n");
+        return 1;
+    }
+    if (check_top_k() != 0) {
+        printf("Top-k check failed\n");
+        return 1;
+    }
+    if (check_child_stats() != 0) {
+        printf("Child statistics check failed\n");
+        return 1;
+    }
+    if (check_reductions() != 0) {
+        printf("Reduction check failed\n");
+        return 1;
+    }
+    if (check_elementwise() != 0) {
+        printf("Elementwise check failed\n");
+        return 1;
+    }
+    if (check_layouts() != 0) {
+        printf("Layout collapse check failed\n");
+        return 1;
+    }
+    if (check_sparse() != 0) {
+        printf("Sparse multiply check failed\n");
+        return 1;
+    }
+    if (check_shared_memory() != 0) {
+        printf("Shared memory check failed\n");
+        return 1;
+    }
+    if (check_pipeline() != 0) {
+        printf("Pipeline check failed\n");
+        return 1;
+    }
+#ifndef _WIN32
+    if (check_server() != 0) {
+        printf("Server check failed\n");
+        return 1;
+    }
+#endif
     printf("Test passed!\n");
 
     printf("\nPress Enter to exit...");
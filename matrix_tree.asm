@@ -12,9 +12,26 @@ OPTION CASEMAP:NONE
     err_bad_alloc   BYTE "Error: Allocation failed", 0Ah, 0
     err_bad_dim     BYTE "Error: Invalid dimensions", 0Ah, 0
 
-.data?
     ALIGN 8
-    temp_buffer     BYTE 8192 DUP(?)    ; Temporary computation buffer
+    ; Runtime tuning (see matrix_tree_tune.c); defaults match matrix_tree.h
+    ; Outputs at least this many bytes are collapsed with non-temporal stores
+    matrix_tree_stream_threshold QWORD 4194304
+    ; Doubles per collapse tile (1..TILE_ELEMS)
+    matrix_tree_tile_elems       QWORD 1024
+    ; Nonzero once matrix_tree_runtime_init has run
+    matrix_tree_runtime_ready     QWORD 0
+
+.data?
+    ALIGN 16
+    temp_buffer     BYTE 8192 DUP(?)    ; Temporary computation buffer (one collapse tile)
+
+; Node types and collapse flags (must match matrix_tree.h)
+NODE_TYPE_LEAF              EQU 0
+NODE_TYPE_INTERNAL          EQU 1     ; Higher types are structured leaves (matrix_tree_structured.c)
+MATRIX_TREE_COLLAPSE_STREAM EQU 1
+MATRIX_TREE_COLLAPSE_CACHED EQU 2
+TILE_ELEMS                  EQU 1024    ; temp_buffer capacity in doubles
+SHAPE_KERNEL_SIZE           EQU 24      ; MatrixTreeShapeKernel: rows, cols, add, gemv
 
 .code
 
@@ -23,15 +40,27 @@ EXTERN malloc:PROC
 EXTERN free:PROC
 EXTERN memset:PROC
 EXTERN memcpy:PROC
+EXTERN matrix_tree_node_alloc:PROC
+EXTERN matrix_tree_node_free:PROC
+EXTERN matrix_tree_children_alloc:PROC
+EXTERN matrix_tree_children_free:PROC
+EXTERN matrix_tree_runtime_init:PROC
+EXTERN matrix_tree_structured_accumulate:PROC
+EXTERN matrix_tree_leaf_elems:PROC
+EXTERN matrix_tree_shape_kernels:QWORD
+EXTERN matrix_tree_shape_kernel_count:QWORD
 
 ; Public functions
-PUBLIC matrix_tree_create
-PUBLIC matrix_tree_destroy
-PUBLIC matrix_tree_set_leaf
-PUBLIC matrix_tree_set_internal
-PUBLIC matrix_tree_collapse
-PUBLIC matrix_tree_multiply_collapsed
-PUBLIC matrix_tree_scale
+PUBLIC matrix_tree_asm_create
+PUBLIC matrix_tree_asm_destroy
+PUBLIC matrix_tree_asm_set_leaf
+PUBLIC matrix_tree_asm_set_internal
+PUBLIC matrix_tree_asm_collapse_ex
+PUBLIC matrix_tree_asm_multiply_collapsed
+PUBLIC matrix_tree_asm_scale
+PUBLIC matrix_tree_stream_threshold
+PUBLIC matrix_tree_tile_elems
+PUBLIC matrix_tree_runtime_ready
 
 ; Data Structure Layout (in memory):
 ; TreeNode structure (32 bytes):
@@ -41,11 +70,11 @@ PUBLIC matrix_tree_scale
 ;   +16: data_ptr (8 bytes) - points to matrix data if leaf, or children array if internal
 ;   +24: num_children (8 bytes) - only used for internal nodes
 
-; Function: matrix_tree_create
+; Function: matrix_tree_asm_create
 ; Creates a new matrix tree node
 ; Args: rcx = rows, rdx = cols, r8 = node_type (0=leaf, 1=internal)
 ; Returns: rax = pointer to new node, or NULL on failure
-matrix_tree_create PROC FRAME
+matrix_tree_asm_create PROC FRAME
     push rbp
     .pushreg rbp
     mov rbp, rsp
@@ -73,9 +102,8 @@ matrix_tree_create PROC FRAME
     test r13, r13
     jz create_error
 
-    ; Allocate TreeNode structure (32 bytes)
-    mov rcx, 32
-    call malloc
+    ; Allocate TreeNode structure (32 bytes, node pool)
+    call matrix_tree_node_alloc
     test rax, rax
     jz create_error
 
@@ -124,7 +152,7 @@ create_done:
 
 create_cleanup:
     mov rcx, rbx
-    call free
+    call matrix_tree_node_free
 create_error:
     xor eax, eax
     pop r14
@@ -134,13 +162,13 @@ create_error:
     add rsp, 60h
     pop rbp
     ret
-matrix_tree_create ENDP
+matrix_tree_asm_create ENDP
 
-; Function: matrix_tree_destroy
+; Function: matrix_tree_asm_destroy
 ; Recursively destroys a matrix tree node and all children
 ; Args: rcx = pointer to node
 ; Returns: void
-matrix_tree_destroy PROC FRAME
+matrix_tree_asm_destroy PROC FRAME
     push rbp
     .pushreg rbp
     mov rbp, rsp
@@ -184,15 +212,16 @@ destroy_loop:
 
     ; Destroy child at index r14
     mov rcx, QWORD PTR [r12+r14*8]
-    call matrix_tree_destroy
+    call matrix_tree_asm_destroy
 
     inc r14
     jmp destroy_loop
 
 destroy_children_done:
-    ; Free children array
+    ; Free children array (back to its size class)
     mov rcx, r12
-    call free
+    mov rdx, r13
+    call matrix_tree_children_free
     jmp destroy_node
 
 destroy_leaf:
@@ -205,7 +234,7 @@ destroy_leaf:
 destroy_node:
     ; Free the node itself
     mov rcx, rbx
-    call free
+    call matrix_tree_node_free
 
 destroy_done:
     pop r14
@@ -215,13 +244,13 @@ destroy_done:
     add rsp, 60h
     pop rbp
     ret
-matrix_tree_destroy ENDP
+matrix_tree_asm_destroy ENDP
 
-; Function: matrix_tree_set_leaf
+; Function: matrix_tree_asm_set_leaf
 ; Sets the matrix data for a leaf node
 ; Args: rcx = node pointer, rdx = data pointer, r8 = data_size
 ; Returns: rax = 0 on success, -1 on error
-matrix_tree_set_leaf PROC FRAME
+matrix_tree_asm_set_leaf PROC FRAME
     push rbp
     .pushreg rbp
     mov rbp, rsp
@@ -272,13 +301,13 @@ setleaf_error:
     add rsp, 40h
     pop rbp
     ret
-matrix_tree_set_leaf ENDP
+matrix_tree_asm_set_leaf ENDP
 
-; Function: matrix_tree_set_internal
+; Function: matrix_tree_asm_set_internal
 ; Sets children for an internal node
 ; Args: rcx = node pointer, rdx = children array, r8 = num_children
 ; Returns: rax = 0 on success, -1 on error
-matrix_tree_set_internal PROC FRAME
+matrix_tree_asm_set_internal PROC FRAME
     push rbp
     .pushreg rbp
     mov rbp, rsp
@@ -302,11 +331,9 @@ matrix_tree_set_internal PROC FRAME
     cmp rax, 1
     jne setinternal_error
 
-    ; Allocate array for child pointers
-    mov rax, r13
-    shl rax, 3                  ; * 8 bytes per pointer
-    mov rcx, rax
-    call malloc
+    ; Allocate array for child pointers (children pool)
+    mov rcx, r13
+    call matrix_tree_children_alloc
     test rax, rax
     jz setinternal_error
 
@@ -338,19 +365,18 @@ setinternal_error:
     add rsp, 40h
     pop rbp
     ret
-matrix_tree_set_internal ENDP
-
-; Function: matrix_tree_collapse
-; Collapses a tree into a single matrix by summing all leaf nodes
-; Args: rcx = node pointer, rdx = output buffer (pre-allocated)
+matrix_tree_asm_set_internal ENDP
+
+; Function: matrix_tree_asm_collapse_ex
+; Collapses a tree into a single matrix with an explicit store policy
+; The sum is accumulated one temp_buffer tile at a time and each finished tile
+; is written to the output exactly once. When streaming, that final write uses
+; non-temporal stores (movntpd) so the output never displaces the working set.
+; Args: rcx = node pointer, rdx = output buffer (pre-allocated), r8 = flags
 ; Returns: rax = 0 on success, -1 on error
-matrix_tree_collapse PROC FRAME
+matrix_tree_asm_collapse_ex PROC FRAME
     push rbp
     .pushreg rbp
-    mov rbp, rsp
-    .setframe rbp, 0
-    sub rsp, 60h
-    .allocstack 60h
     push rbx
     .pushreg rbx
     push r12
@@ -361,19 +387,29 @@ matrix_tree_collapse PROC FRAME
     .pushreg r14
     push r15
     .pushreg r15
+    sub rsp, 38h                ; Shadow space + [rsp+20h] tile length, [rsp+28h] shape kernel
+    .allocstack 38h
     .endprolog
 
-    mov rbx, rcx                ; node
-    mov r12, rdx                ; output buffer
+    ; Register kernels and load cached tuning on first use
+    cmp matrix_tree_runtime_ready, 0
+    jne collapse_tuned
+    mov rbx, rcx
+    mov r12, rdx
+    mov r13, r8
+    call matrix_tree_runtime_init
+    mov rcx, rbx
+    mov rdx, r12
+    mov r8, r13
+collapse_tuned:
 
-    ; Check node type
-    mov rax, QWORD PTR [rbx]
-    test rax, rax
-    jz collapse_leaf
+    test rcx, rcx
+    jz collapse_error
+    test rdx, rdx
+    jz collapse_error
 
-    ; Internal node - recursively collapse children and sum
-    mov r13, QWORD PTR [rbx+16] ; children array
-    mov r14, QWORD PTR [rbx+24] ; num_children
+    mov rbx, rcx                ; node
+    mov r12, rdx                ; output buffer
 
     ; Get matrix dimensions
     mov eax, DWORD PTR [rbx+8]  ; rows
@@ -381,87 +417,240 @@ matrix_tree_collapse PROC FRAME
     imul rax, rcx
     mov r15, rax                ; total elements
 
-    ; Zero output buffer
-    mov rcx, r12
-    xor edx, edx
+    ; Pick the store policy: r13 = 1 streams the final write pass
+    xor r13, r13
+    test r8, MATRIX_TREE_COLLAPSE_CACHED
+    jnz collapse_policy_done
+    mov r13, 1
+    test r8, MATRIX_TREE_COLLAPSE_STREAM
+    jnz collapse_policy_done
+    mov rax, r15
+    shl rax, 3
+    cmp rax, matrix_tree_stream_threshold
+    jae collapse_policy_done
+    xor r13, r13
+collapse_policy_done:
+
+    ; A leaf written through the cache is a plain copy
+    cmp QWORD PTR [rbx], NODE_TYPE_LEAF
+    jne collapse_tiled
+    test r13, r13
+    jnz collapse_tiled
+
+    mov rcx, r12                ; dest
+    mov rdx, QWORD PTR [rbx+16] ; source
     mov r8, r15
+    shl r8, 3                   ; size
+    call memcpy
+    jmp collapse_done
+
+collapse_tiled:
+    ; A single-tile output with a generated kernel for its shape adds whole leaves
+    mov QWORD PTR [rsp+28h], 0
+    cmp r15, matrix_tree_tile_elems
+    ja collapse_tile_start
+    mov rcx, rbx
+    call find_shape_kernel
+    test rax, rax
+    jz collapse_tile_start
+    mov rax, QWORD PTR [rax+8]  ; add kernel
+    mov QWORD PTR [rsp+28h], rax
+
+collapse_tile_start:
+    xor r14, r14                ; tile start (element index)
+collapse_tile_loop:
+    cmp r14, r15
+    jge collapse_fence
+
+    ; Tile length = min(tile_elems, total - start)
+    mov rax, r15
+    sub rax, r14
+    mov rcx, matrix_tree_tile_elems
+    cmp rax, rcx
+    cmova rax, rcx
+    mov QWORD PTR [rsp+20h], rax
+
+    ; Zero the tile
+    lea rcx, temp_buffer
+    xor edx, edx
+    mov r8, rax
     shl r8, 3
     call memset
 
-    ; Sum all children
-    xor rax, rax                ; child index
-
-collapse_sum_loop:
-    cmp rax, r14
-    jge collapse_done
-
-    ; Save counter
-    mov QWORD PTR [rbp-8], rax
+    ; Add every leaf's slice of this tile
+    mov rcx, rbx
+    mov rdx, r14
+    mov r8, QWORD PTR [rsp+20h]
+    mov r9, QWORD PTR [rsp+28h]
+    call collapse_accumulate
 
-    ; Collapse child into temp buffer
-    mov rcx, QWORD PTR [r13+rax*8]
+    ; Write the finished tile to the output
+    lea rcx, [r12+r14*8]        ; destination
     lea rdx, temp_buffer
-    call matrix_tree_collapse
-
-    ; Restore counter
-    mov rax, QWORD PTR [rbp-8]
+    mov r8, QWORD PTR [rsp+20h] ; element count
+    test r13, r13
+    jnz collapse_stream_tile
 
-    ; Add temp buffer to output
-    xor rdx, rdx                ; element counter
-collapse_add_loop:
-    cmp rdx, r15
-    jge collapse_next_child
+    shl r8, 3
+    call memcpy
+    jmp collapse_next_tile
+
+collapse_stream_tile:
+    xor r9, r9
+    test rcx, 8                 ; movntpd needs a 16-byte aligned target
+    jz collapse_stream_pairs
+    movsd xmm0, QWORD PTR [rdx]
+    movsd QWORD PTR [rcx], xmm0
+    inc r9
+collapse_stream_pairs:
+    lea rax, [r9+1]
+    cmp rax, r8
+    jge collapse_stream_tail
+    movupd xmm0, XMMWORD PTR [rdx+r9*8]
+    movntpd XMMWORD PTR [rcx+r9*8], xmm0
+    add r9, 2
+    jmp collapse_stream_pairs
+collapse_stream_tail:
+    cmp r9, r8
+    jge collapse_next_tile
+    movsd xmm0, QWORD PTR [rdx+r9*8]
+    movsd QWORD PTR [rcx+r9*8], xmm0
+
+collapse_next_tile:
+    add r14, matrix_tree_tile_elems
+    jmp collapse_tile_loop
+
+collapse_fence:
+    test r13, r13
+    jz collapse_done
+    sfence                      ; Make streamed stores globally visible
 
-    ; Load and add doubles
-    movsd xmm0, QWORD PTR [r12+rdx*8]
-    lea rcx, temp_buffer
-    movsd xmm1, QWORD PTR [rcx+rdx*8]
-    addsd xmm0, xmm1
-    movsd QWORD PTR [r12+rdx*8], xmm0
+collapse_done:
+    xor eax, eax
+collapse_return:
+    add rsp, 38h
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
 
-    inc rdx
-    jmp collapse_add_loop
+collapse_error:
+    mov rax, -1
+    jmp collapse_return
+matrix_tree_asm_collapse_ex ENDP
 
-collapse_next_child:
-    mov rax, QWORD PTR [rbp-8]
-    inc rax
-    jmp collapse_sum_loop
+; Function: collapse_accumulate (internal)
+; Adds elements [start, start + len) of every leaf under a node into temp_buffer
+; Args: rcx = node pointer, rdx = start element, r8 = len (<= TILE_ELEMS),
+;       r9 = whole-leaf add kernel (only when the tile is the whole matrix) or 0
+; Returns: void
+collapse_accumulate PROC FRAME
+    push rbp
+    .pushreg rbp
+    push rbx
+    .pushreg rbx
+    push r12
+    .pushreg r12
+    push r13
+    .pushreg r13
+    push r14
+    .pushreg r14
+    push r15
+    .pushreg r15
+    sub rsp, 28h                ; Shadow space + [rsp+20h] add kernel
+    .allocstack 28h
+    .endprolog
 
-collapse_leaf:
-    ; Leaf node - copy data to output
-    mov eax, DWORD PTR [rbx+8]  ; rows
-    mov ecx, DWORD PTR [rbx+12] ; cols
-    imul rax, rcx
-    shl rax, 3
+    mov rbx, rcx                ; node
+    mov r12, rdx                ; start
+    mov r13, r8                 ; len
+    mov QWORD PTR [rsp+20h], r9
 
-    mov rcx, r12                ; dest
-    mov rdx, QWORD PTR [rbx+16] ; source
-    mov r8, rax                 ; size
-    call memcpy
+    mov rax, QWORD PTR [rbx]
+    cmp rax, NODE_TYPE_INTERNAL
+    je accumulate_internal
+    cmp rax, NODE_TYPE_LEAF
+    jne accumulate_structured
 
-collapse_done:
-    xor eax, eax
+    test r9, r9
+    jz accumulate_generic
+    lea rcx, temp_buffer
+    mov rdx, QWORD PTR [rbx+16]
+    call r9
+    jmp accumulate_done
+
+accumulate_generic:
+    ; Leaf node - temp[i] += data[start + i]
+    mov rdx, QWORD PTR [rbx+16]
+    lea rdx, [rdx+r12*8]
+    lea r10, temp_buffer
+    xor r9, r9
+accumulate_pairs:
+    lea rax, [r9+1]
+    cmp rax, r13
+    jge accumulate_tail
+    movupd xmm0, XMMWORD PTR [r10+r9*8]
+    movupd xmm1, XMMWORD PTR [rdx+r9*8]
+    addpd xmm0, xmm1
+    movupd XMMWORD PTR [r10+r9*8], xmm0
+    add r9, 2
+    jmp accumulate_pairs
+accumulate_tail:
+    cmp r9, r13
+    jge accumulate_done
+    movsd xmm0, QWORD PTR [r10+r9*8]
+    addsd xmm0, QWORD PTR [rdx+r9*8]
+    movsd QWORD PTR [r10+r9*8], xmm0
+    jmp accumulate_done
+
+accumulate_structured:
+    ; Packed/structured leaf - expands its slice of the tile in C
+    mov rcx, rbx
+    lea rdx, temp_buffer
+    mov r8, r12
+    mov r9, r13
+    call matrix_tree_structured_accumulate
+    jmp accumulate_done
+
+accumulate_internal:
+    ; Internal node - accumulate every child over the same tile
+    mov r14, QWORD PTR [rbx+16] ; children array
+    mov r15, QWORD PTR [rbx+24] ; num_children
+    xor rbx, rbx                ; child counter
+accumulate_children_loop:
+    cmp rbx, r15
+    jge accumulate_done
+    mov rcx, QWORD PTR [r14+rbx*8]
+    mov rdx, r12
+    mov r8, r13
+    mov r9, QWORD PTR [rsp+20h]
+    call collapse_accumulate
+    inc rbx
+    jmp accumulate_children_loop
+
+accumulate_done:
+    add rsp, 28h
     pop r15
     pop r14
     pop r13
     pop r12
     pop rbx
-    add rsp, 60h
     pop rbp
     ret
-matrix_tree_collapse ENDP
+collapse_accumulate ENDP
 
-; Function: matrix_tree_multiply_collapsed
+; Function: matrix_tree_asm_multiply_collapsed
 ; Multiplies collapsed matrix by vector: y = A*x
+; The collapse is produced tile by tile in temp_buffer and consumed immediately,
+; so trees of any size are supported without a full-size scratch matrix.
 ; Args: rcx = node, rdx = input vector x, r8 = output vector y
 ; Returns: rax = 0 on success
-matrix_tree_multiply_collapsed PROC FRAME
+matrix_tree_asm_multiply_collapsed PROC FRAME
     push rbp
     .pushreg rbp
-    mov rbp, rsp
-    .setframe rbp, 0
-    sub rsp, 60h
-    .allocstack 60h
     push rbx
     .pushreg rbx
     push r12
@@ -472,77 +661,184 @@ matrix_tree_multiply_collapsed PROC FRAME
     .pushreg r14
     push r15
     .pushreg r15
+    sub rsp, 38h                ; Shadow space + [rsp+20h] tile length, [rsp+28h] shape kernel
+    .allocstack 38h
     .endprolog
 
     mov rbx, rcx                ; node
     mov r12, rdx                ; x vector
     mov r13, r8                 ; y vector
 
-    ; Collapse tree to temp buffer
-    mov rcx, rbx
-    lea rdx, temp_buffer
-    call matrix_tree_collapse
+    ; Register kernels and load cached tuning on first use
+    cmp matrix_tree_runtime_ready, 0
+    jne mvcollapse_tuned
+    call matrix_tree_runtime_init
+mvcollapse_tuned:
 
     ; Get dimensions
     mov eax, DWORD PTR [rbx+8]  ; rows
     mov ecx, DWORD PTR [rbx+12] ; cols
-    mov r14d, eax               ; rows
-    mov r15d, ecx               ; cols
+    imul rax, rcx
+    mov r15, rax                ; total elements
 
-    ; Perform matrix-vector multiplication
-    xor r8, r8                  ; row counter
-mvcollapse_row_loop:
-    cmp r8d, r14d
+    ; Single-tile shapes with generated kernels skip the generic loops
+    mov QWORD PTR [rsp+28h], 0
+    cmp r15, matrix_tree_tile_elems
+    ja mvcollapse_generic
+    mov rcx, rbx
+    call find_shape_kernel
+    mov QWORD PTR [rsp+28h], rax
+    test rax, rax
+    jz mvcollapse_generic
+
+    lea rcx, temp_buffer
+    xor edx, edx
+    mov r8, r15
+    shl r8, 3
+    call memset
+
+    mov rcx, rbx
+    xor edx, edx
+    mov r8, r15
+    mov rax, QWORD PTR [rsp+28h]
+    mov r9, QWORD PTR [rax+8]   ; add kernel
+    call collapse_accumulate
+
+    lea rcx, temp_buffer
+    mov rdx, r12
+    mov r8, r13
+    mov rax, QWORD PTR [rsp+28h]
+    call QWORD PTR [rax+16]     ; gemv kernel
+    jmp mvcollapse_done
+
+mvcollapse_generic:
+    ; Zero y; rows are accumulated across tile boundaries
+    mov rcx, r13
+    xor edx, edx
+    mov r8d, DWORD PTR [rbx+8]
+    shl r8, 3
+    call memset
+
+    xor r14, r14                ; tile start (element index)
+mvcollapse_tile_loop:
+    cmp r14, r15
     jge mvcollapse_done
 
-    ; Compute dot product for this row
+    ; Tile length = min(tile_elems, total - start)
+    mov rax, r15
+    sub rax, r14
+    mov rcx, matrix_tree_tile_elems
+    cmp rax, rcx
+    cmova rax, rcx
+    mov QWORD PTR [rsp+20h], rax
+
+    ; Collapse this tile into temp_buffer
+    lea rcx, temp_buffer
+    xor edx, edx
+    mov r8, rax
+    shl r8, 3
+    call memset
+
+    mov rcx, rbx
+    mov rdx, r14
+    mov r8, QWORD PTR [rsp+20h]
+    xor r9, r9
+    call collapse_accumulate
+
+    ; Locate the tile start: r8 = row, r9 = col
+    mov ecx, DWORD PTR [rbx+12] ; cols
+    mov rax, r14
+    xor edx, edx
+    div rcx
+    mov r8, rax
+    mov r9, rdx
+
+    lea r10, temp_buffer
+    xor r11, r11                ; element within tile
+    mov rdx, QWORD PTR [rsp+20h] ; tile length
+
+    ; Perform matrix-vector multiplication over the tile
+mvcollapse_row_loop:
+    ; Partial dot product for the current row
     xorpd xmm0, xmm0            ; accumulator
-    xor r9, r9                  ; col counter
 
 mvcollapse_col_loop:
-    cmp r9d, r15d
-    jge mvcollapse_store
-
-    ; Compute offset: row * cols + col
-    mov rax, r8
-    imul rax, r15
-    add rax, r9
+    cmp r11, rdx
+    jge mvcollapse_flush
 
     ; Load matrix element and vector element
-    lea r10, temp_buffer
-    movsd xmm1, QWORD PTR [r10+rax*8]
+    movsd xmm1, QWORD PTR [r10+r11*8]
     movsd xmm2, QWORD PTR [r12+r9*8]
 
     ; Multiply and accumulate
     mulsd xmm1, xmm2
     addsd xmm0, xmm1
 
+    inc r11
     inc r9
-    jmp mvcollapse_col_loop
+    cmp r9, rcx
+    jl mvcollapse_col_loop
 
 mvcollapse_store:
-    ; Store result
+    ; Row complete - add to y[row]
+    addsd xmm0, QWORD PTR [r13+r8*8]
     movsd QWORD PTR [r13+r8*8], xmm0
     inc r8
+    xor r9, r9
     jmp mvcollapse_row_loop
 
+mvcollapse_flush:
+    ; Tile ended mid-row - carry the partial sum into y[row]
+    test r9, r9
+    jz mvcollapse_next_tile
+    addsd xmm0, QWORD PTR [r13+r8*8]
+    movsd QWORD PTR [r13+r8*8], xmm0
+
+mvcollapse_next_tile:
+    add r14, matrix_tree_tile_elems
+    jmp mvcollapse_tile_loop
+
 mvcollapse_done:
     xor eax, eax
+    add rsp, 38h
     pop r15
     pop r14
     pop r13
     pop r12
     pop rbx
-    add rsp, 60h
     pop rbp
     ret
-matrix_tree_multiply_collapsed ENDP
+matrix_tree_asm_multiply_collapsed ENDP
+
+; Function: find_shape_kernel (internal)
+; Looks up the registered generated kernel for a node's shape
+; Args: rcx = node pointer
+; Returns: rax = matrix_tree_shape_kernels entry, or 0 if none
+find_shape_kernel PROC
+    mov rax, QWORD PTR [rcx+8]  ; rows | cols << 32
+    lea rcx, matrix_tree_shape_kernels
+    mov rdx, matrix_tree_shape_kernel_count
+find_kernel_loop:
+    test rdx, rdx
+    jz find_kernel_none
+    cmp rax, QWORD PTR [rcx]
+    je find_kernel_found
+    add rcx, SHAPE_KERNEL_SIZE
+    dec rdx
+    jmp find_kernel_loop
+find_kernel_found:
+    mov rax, rcx
+    ret
+find_kernel_none:
+    xor eax, eax
+    ret
+find_shape_kernel ENDP
 
-; Function: matrix_tree_scale
+; Function: matrix_tree_asm_scale
 ; Scales a matrix tree by a scalar: A' = s * A
 ; Args: rcx = node, xmm0 = scalar
 ; Returns: void
-matrix_tree_scale PROC FRAME
+matrix_tree_asm_scale PROC FRAME
     push rbp
     .pushreg rbp
     mov rbp, rsp
@@ -566,6 +862,8 @@ matrix_tree_scale PROC FRAME
     mov rax, QWORD PTR [rbx]
     test rax, rax
     jz scale_leaf
+    cmp rax, NODE_TYPE_INTERNAL
+    jne scale_structured
 
     ; Internal node - scale all children
     mov r12, QWORD PTR [rbx+16] ; children
@@ -578,7 +876,7 @@ scale_children_loop:
 
     mov rcx, QWORD PTR [r12+r14*8]
     movsd xmm0, QWORD PTR [rbp-8]
-    call matrix_tree_scale
+    call matrix_tree_asm_scale
 
     inc r14
     jmp scale_children_loop
@@ -593,6 +891,16 @@ scale_leaf:
     mov r13, QWORD PTR [rbx+16] ; data
     xor r14, r14
     movsd xmm15, QWORD PTR [rbp-8] ; Load scalar
+    jmp scale_loop
+
+scale_structured:
+    ; Structured leaf - scale just the stored elements
+    mov rcx, rbx
+    call matrix_tree_leaf_elems
+    mov r12, rax
+    mov r13, QWORD PTR [rbx+16]
+    xor r14, r14
+    movsd xmm15, QWORD PTR [rbp-8]
 
 scale_loop:
     cmp r14, r12
@@ -613,6 +921,6 @@ scale_done:
     add rsp, 60h
     pop rbp
     ret
-matrix_tree_scale ENDP
+matrix_tree_asm_scale ENDP
 
 END
\ No newline at end of file
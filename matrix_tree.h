@@ -5,27 +5,321 @@
 #include <stddef.h>
 
 // Node types
-#define NODE_TYPE_LEAF     0
-#define NODE_TYPE_INTERNAL 1
+#define NODE_TYPE_LEAF            0
+#define NODE_TYPE_INTERNAL        1
+#define NODE_TYPE_SYMMETRIC       2   // Packed upper triangle, rows == cols
+#define NODE_TYPE_DIAGONAL        3   // n diagonal values
+#define NODE_TYPE_SCALED_IDENTITY 4   // One value s: s * I
+#define NODE_TYPE_BANDED          5   // num_children sub/superdiagonals each side
+
+// Collapse store policy (flags for matrix_tree_collapse_ex)
+#define MATRIX_TREE_COLLAPSE_AUTO   0   // Stream once output reaches the threshold
+#define MATRIX_TREE_COLLAPSE_STREAM 1   // Always write output with non-temporal stores
+#define MATRIX_TREE_COLLAPSE_CACHED 2   // Never use non-temporal stores
+
+// Output size (bytes) at which AUTO switches to non-temporal stores (default)
+#define MATRIX_TREE_STREAM_THRESHOLD (4u * 1024u * 1024u)
+
+// Collapse tile capacity in doubles (size of the assembly temp_buffer)
+#define MATRIX_TREE_MAX_TILE_ELEMS 1024
 
 // Tree node structure (must match assembly layout)
 typedef struct MatrixTreeNode {
-    uint64_t node_type;      // 0 = leaf, 1 = internal
+    uint64_t node_type;      // NODE_TYPE_*
     uint32_t rows;
     uint32_t cols;
     void* data_ptr;          // Matrix data or children array
     uint64_t num_children;
 } MatrixTreeNode;
 
-// Function prototypes (implemented in assembly)
+// Dense matrix layouts for collapsed results
+#define MATRIX_TREE_LAYOUT_ROW_MAJOR 0
+#define MATRIX_TREE_LAYOUT_COL_MAJOR 1
+#define MATRIX_TREE_LAYOUT_BLOCKED   2   // Square blocks, MATRIX_TREE_BLOCK_DIM by default
+#define MATRIX_TREE_BLOCK_DIM        8
+
+// Instruction set levels (x86-64 psABI levels) of the kernel variants
+#define MATRIX_TREE_ISA_SSE2   0   // x86-64 baseline
+#define MATRIX_TREE_ISA_AVX2   1   // x86-64-v3: AVX2, FMA, BMI1/2
+#define MATRIX_TREE_ISA_AVX512 2   // x86-64-v4: AVX-512 F/BW/CD/DQ/VL
+
+// Backends an operation can be dispatched to
+#define MATRIX_TREE_BACKEND_ASM 0   // Hand-written assembly (default)
+#define MATRIX_TREE_BACKEND_C   1   // Portable C, built per ISA level
+
+// Operations selectable per backend
+#define MATRIX_TREE_OP_CREATE       0
+#define MATRIX_TREE_OP_DESTROY      1
+#define MATRIX_TREE_OP_SET_LEAF     2
+#define MATRIX_TREE_OP_SET_INTERNAL 3
+#define MATRIX_TREE_OP_COLLAPSE     4
+#define MATRIX_TREE_OP_MULTIPLY     5
+#define MATRIX_TREE_OP_SCALE        6
+#define MATRIX_TREE_OP_COUNT        7
+#define MATRIX_TREE_OP_ALL          (-1)
+
+// Runtime tuning parameters read by the kernels
+typedef struct MatrixTreeTuning {
+    uint64_t tile_elems;        // Doubles per collapse tile (1..MATRIX_TREE_MAX_TILE_ELEMS)
+    uint64_t stream_threshold;  // Output bytes at which AUTO collapse streams
+    uint64_t c_backend_ops;     // Bit (1 << MATRIX_TREE_OP_*) set = C backend
+} MatrixTreeTuning;
+
+// Function prototypes (dispatched to the assembly or C backend)
 extern MatrixTreeNode* matrix_tree_create(uint32_t rows, uint32_t cols, uint64_t node_type);
 extern void matrix_tree_destroy(MatrixTreeNode* node);
 extern int matrix_tree_set_leaf(MatrixTreeNode* node, const double* data, size_t data_size);
 extern int matrix_tree_set_internal(MatrixTreeNode* node, MatrixTreeNode** children, uint64_t num_children);
 extern int matrix_tree_collapse(MatrixTreeNode* node, double* output);
+extern int matrix_tree_collapse_ex(MatrixTreeNode* node, double* output, uint32_t flags);
 extern int matrix_tree_multiply_collapsed(MatrixTreeNode* node, const double* x, double* y);
 extern void matrix_tree_scale(MatrixTreeNode* node, double scalar);
 
+// Elementwise tree-tree operations (C implementation): output = A op B for
+// two trees of one shape, in one tiled pass without full-size collapses
+#define MATRIX_TREE_ELEMENTWISE_ADD      0
+#define MATRIX_TREE_ELEMENTWISE_SUB      1
+#define MATRIX_TREE_ELEMENTWISE_HADAMARD 2
+
+int matrix_tree_elementwise(MatrixTreeNode* a, MatrixTreeNode* b, int op, double* output);
+
+// Collapse straight into a MATRIX_TREE_LAYOUT_* (C implementation). BLOCKED
+// uses block_dim x block_dim blocks (0 = MATRIX_TREE_BLOCK_DIM) and needs
+// room for rows and cols padded to a block multiple; padding is zeroed.
+int matrix_tree_collapse_layout(MatrixTreeNode* node, double* output, uint32_t layout, uint32_t block_dim);
+
+// y[v] = A x[v] for count vectors (x: count x cols, y: count x rows), one
+// collapse pass shared by all of them
+int matrix_tree_multiply_batch(MatrixTreeNode* node, const double* x, uint64_t count, double* y);
+
+// Backend registry (C implementations, matrix_tree_backend.c)
+// $MATRIX_TREE_BACKEND overrides the default or tuned choice at startup:
+// "asm", "c", or per operation, e.g. "collapse=c,multiply=asm".
+int matrix_tree_set_backend(int op, int backend);     // op may be MATRIX_TREE_OP_ALL
+int matrix_tree_get_backend(int op);
+const char* matrix_tree_backend_name(int backend);
+
+// Tuning (C implementations, matrix_tree_tune.c)
+// The cache file defaults to $MATRIX_TREE_TUNE_CACHE, else the user cache
+// directory; pass NULL to use it. Kernels load it automatically on first use.
+// Loaded or measured backends are only applied while no backend was chosen
+// through $MATRIX_TREE_BACKEND or matrix_tree_set_backend; set_tuning always
+// applies its own.
+int matrix_tree_autotune(const char* cache_path);
+int matrix_tree_tune_load(const char* cache_path);
+void matrix_tree_get_tuning(MatrixTreeTuning* tuning);
+int matrix_tree_set_tuning(const MatrixTreeTuning* tuning);
+
+// Kernel registry (C implementations, matrix_tree_kernels.c)
+// Shapes listed in MATRIX_TREE_KERNEL_SHAPES at build time get generated,
+// fully unrolled collapse and multiply kernels, used whenever the whole
+// matrix fits one collapse tile.
+int matrix_tree_cpu_isa(void);
+int matrix_tree_shape_kernel_isa(uint32_t rows, uint32_t cols);   // -1 if none
+// ISA level of the C backend variant bound for this CPU (matrix_tree_c.c)
+int matrix_tree_c_kernel_isa(void);
+
+// Structural optimization (C implementation, matrix_tree_optimize.c)
+// Rewrites a tree in place, keeping the root node, into an equivalent cheaper
+// shape. FLATTEN splices nested sums into their parent, MERGE_LEAVES adds
+// sibling leaves of the same kind into one leaf, and REBALANCE (which implies
+// FLATTEN) regroups wide sums into balanced trees of MATRIX_TREE_OPTIMIZE_FANOUT
+// children. Pointers to inner nodes and leaves do not survive, except shared
+// ones, frozen leaves and an auto-freeze root, which are left in place.
+// Attached shared-memory trees cannot be optimized.
+#define MATRIX_TREE_OPTIMIZE_FLATTEN      1
+#define MATRIX_TREE_OPTIMIZE_MERGE_LEAVES 2
+#define MATRIX_TREE_OPTIMIZE_REBALANCE    4
+#define MATRIX_TREE_OPTIMIZE_DEFAULT      (MATRIX_TREE_OPTIMIZE_FLATTEN | MATRIX_TREE_OPTIMIZE_MERGE_LEAVES)
+#define MATRIX_TREE_OPTIMIZE_FANOUT       8
+
+int matrix_tree_optimize(MatrixTreeNode* root, uint32_t policy);
+
+// Weighted child combinations (C implementation, matrix_tree_weighted.c)
+// y (samples x rows) row s = sum_j weights[s * num_children + j] * A_j x over
+// the direct children A_j of node (a leaf counts as one child). Each A_j x
+// is computed once, so the cost is one pass over the data plus
+// samples x children x rows for the combinations.
+int matrix_tree_multiply_weighted(MatrixTreeNode* node, const double* x, const double* weights,
+                                  uint64_t samples, double* y);
+
+// Leaf gradient updates (C implementation, matrix_tree_update.c)
+// For y = sum_j w_j A_j x over the direct children of node (child_weights
+// NULL = all 1), applies A -= lr w_j g x^T in place to every leaf below child
+// j. A leaf reached through several children is updated once with the summed
+// weight. Structured leaves take the gradient of their stored values. The
+// batch form applies count (g, x) pairs, g: count x rows, x: count x cols.
+int matrix_tree_update_leaves(MatrixTreeNode* node, const double* g, const double* x, double lr,
+                              const double* child_weights);
+int matrix_tree_update_leaves_batch(MatrixTreeNode* node, const double* g, const double* x, uint64_t count,
+                                    double lr, const double* child_weights);
+
+// Reductions (C implementation, matrix_tree_reduce.c)
+// Sum of all entries, trace (min(rows, cols) leading diagonal entries) and
+// Frobenius norm of the collapsed matrix, without a full-size collapse
+int matrix_tree_sum(MatrixTreeNode* node, double* result);
+int matrix_tree_trace(MatrixTreeNode* node, double* result);
+int matrix_tree_frobenius_norm(MatrixTreeNode* node, double* result);
+
+// Node pools (C implementation, matrix_tree_pool.c)
+// Nodes and children arrays come from per-thread slab pools, so they are
+// released through the library, never with free(). matrix_tree_destroy_shallow
+// frees a node and its own storage (children array or leaf data) but not its
+// children, for nodes whose children are owned elsewhere.
+void matrix_tree_destroy_shallow(MatrixTreeNode* node);
+
+// Bulk building (C implementation, matrix_tree_build.c)
+// Builds a whole tree from a flat spec in one allocation, laid out in
+// pre-order. nodes[0] is the root (parent -1); every other node names an
+// earlier internal node of the same shape as its parent, and siblings keep
+// their spec order. Leaves take their values from data + data_offset in the
+// compact form matrix_tree_set_leaf takes (NULL data = all zeros). Values of
+// built trees may change (set_leaf, scale, leaf updates) but their structure
+// may not (no set_internal, optimize or freeze), and they are released with
+// matrix_tree_build_free, never matrix_tree_destroy.
+typedef struct MatrixTreeBuildNode {
+    uint64_t node_type;         // NODE_TYPE_*
+    uint32_t rows;
+    uint32_t cols;
+    int64_t parent;             // Index of the parent node, -1 for the root
+    uint64_t data_offset;       // Leaves: first value in spec data (doubles)
+    uint64_t bandwidth;         // NODE_TYPE_BANDED only
+} MatrixTreeBuildNode;
+
+typedef struct MatrixTreeBuildSpec {
+    const MatrixTreeBuildNode* nodes;
+    uint64_t num_nodes;
+    const double* data;
+    uint64_t data_elems;        // Doubles in data
+} MatrixTreeBuildSpec;
+
+MatrixTreeNode* matrix_tree_build(const MatrixTreeBuildSpec* spec);
+void matrix_tree_build_free(MatrixTreeNode* root);
+
+// Per-thread workspace (C implementation, matrix_tree_workspace.c)
+// Evaluation scratch is kept per thread at its high-water mark and reused, so
+// steady-state calls do not allocate. Size reports the calling thread's pool
+// in bytes; trim releases it (it regrows on demand and is freed at thread exit).
+size_t matrix_tree_workspace_size(void);
+void matrix_tree_workspace_trim(void);
+
+// Top-k children by response (C implementation, matrix_tree_topk.c)
+// Finds the k direct children A_i with the largest ||A_i x|| (a leaf counts
+// as one child), keeping only a bounded heap of k candidates. Writes their
+// indices best first, plus optionally their norms and products (k x rows);
+// children are split over up to `threads` threads. Returns the number found
+// (min(k, children)) or -1.
+int matrix_tree_top_k_children(MatrixTreeNode* node, const double* x, uint32_t k, uint32_t threads,
+                               uint64_t* indices, double* norms, double* results);
+
+// Per-element statistics across children (C implementation, matrix_tree_stats.c)
+// For an internal node, the mean, population variance, min and max of every
+// entry over its direct children, in one pass; a leaf counts as one child.
+// Any output may be NULL. Output tiles are split over up to `threads` threads
+// (0 or 1 = the calling thread only).
+int matrix_tree_child_stats(MatrixTreeNode* node, double* mean, double* variance, double* min, double* max,
+                            uint32_t threads);
+
+// Per-level sums (C implementation, matrix_tree_levels.c)
+// Writes the collapsed block of every internal node, in pre-order, to
+// outputs[0 .. matrix_tree_count_internal(root) - 1], computing each parent
+// from its children's results in one post-order pass. NULL slots are
+// allocated with malloc and handed back for the caller to free.
+uint64_t matrix_tree_count_internal(const MatrixTreeNode* root);
+int matrix_tree_collapse_all_levels(MatrixTreeNode* root, double** outputs);
+
+// Subtree freezing (C implementation, matrix_tree_freeze.c)
+// matrix_tree_freeze turns an internal node, in place, into a dense leaf
+// holding its collapsed sum. With keep set the original children are kept
+// aside and matrix_tree_thaw restores them (changes made inside them while
+// frozen show after the thaw); without it they are destroyed. Auto mode
+// watches one root: its direct children left unmodified for idle_evals
+// evaluations of the root are frozen, and thawed again when something inside
+// them is modified (idle_evals 0 or a NULL root stops watching). The freeze
+// state is shared by all threads and locked, so trees may be modified and
+// destroyed on other threads meanwhile; the lock is only taken while
+// something is frozen or watched. Evaluating the watched root freezes and
+// thaws its children in place, so a watched tree must be evaluated by one
+// thread at a time, like any tree being modified.
+int matrix_tree_freeze(MatrixTreeNode* node, int keep);
+int matrix_tree_thaw(MatrixTreeNode* node);
+int matrix_tree_is_frozen(const MatrixTreeNode* node);
+int matrix_tree_freeze_auto(MatrixTreeNode* root, uint32_t idle_evals);
+
+// External BLAS (C implementations, matrix_tree_blas.c)
+// Builds configured with -DMATRIX_TREE_USE_CBLAS=ON send multiplies of
+// matrices with at least gemv_elems elements (single and batched) and
+// column-major sparse axpys of at least axpy_elems rows to the linked CBLAS,
+// whichever backend is selected. Defaults come from the MATRIX_TREE_BLAS_*_MIN
+// CMake settings.
+int matrix_tree_blas_enabled(void);
+void matrix_tree_set_blas_thresholds(uint64_t gemv_elems, uint64_t axpy_elems);
+
+// Structured leaves (C implementations, matrix_tree_structured.c)
+// Stored compactly and usable anywhere a dense leaf is. matrix_tree_set_leaf
+// takes the compact form: for NODE_TYPE_SYMMETRIC the upper triangle row by
+// row, n * (n + 1) / 2 doubles; for NODE_TYPE_DIAGONAL the n diagonal
+// values; for NODE_TYPE_SCALED_IDENTITY the scalar; for NODE_TYPE_BANDED
+// 2 * bandwidth + 1 values per row covering columns r - bandwidth ..
+// r + bandwidth (entries outside the matrix are ignored).
+MatrixTreeNode* matrix_tree_create_symmetric(uint32_t n);
+MatrixTreeNode* matrix_tree_create_diagonal(uint32_t n);
+MatrixTreeNode* matrix_tree_create_scaled_identity(uint32_t n, double scalar);
+MatrixTreeNode* matrix_tree_create_banded(uint32_t n, uint32_t bandwidth);    // bandwidth < n
+
+// Sparse input multiply (C implementations, matrix_tree_sparse.c)
+// x is given as nnz (index, value) pairs; only those columns are read.
+// The collapsed variant takes A in a MATRIX_TREE_LAYOUT_*. BLOCKED stores
+// block_dim x block_dim blocks (0 = MATRIX_TREE_BLOCK_DIM) row-major, each
+// block row-major inside, with rows and cols padded to a block multiple, as
+// matrix_tree_collapse_layout writes them with the same block_dim.
+int matrix_tree_multiply_sparse(MatrixTreeNode* node, const uint32_t* index, const double* value,
+                                uint64_t nnz, double* y);
+int matrix_tree_multiply_sparse_collapsed(const double* a, uint32_t rows, uint32_t cols, uint32_t layout,
+                                          uint32_t block_dim, const uint32_t* index, const double* value,
+                                          uint64_t nnz, double* y);
+
+// Shared-memory publishing (C implementations, matrix_tree_shm.c)
+// publish copies a tree into the named shared-memory segment (replacing any
+// earlier one); attach maps it read-only in any process. Attached trees share
+// the matrix data, support collapse and multiply only, and are released with
+// matrix_tree_detach, never matrix_tree_destroy.
+int matrix_tree_publish(const MatrixTreeNode* root, const char* name);
+int matrix_tree_unpublish(const char* name);
+MatrixTreeNode* matrix_tree_attach(const char* name);
+void matrix_tree_detach(MatrixTreeNode* root);
+
+// Evaluation server (C implementations, matrix_tree_server.c; POSIX only)
+// matrix_tree_serve answers multiply requests for published trees over a
+// Unix domain socket until matrix_tree_remote_shutdown. Requests arriving
+// within batch_window_us of each other are coalesced per tree into one
+// matrix_tree_multiply_batch call.
+typedef struct MatrixTreeServeStats {
+    uint64_t requests;          // Multiply requests answered
+    uint64_t batches;           // Batched evaluations that answered them
+} MatrixTreeServeStats;
+
+int matrix_tree_serve(const char* socket_path, uint32_t batch_window_us, MatrixTreeServeStats* stats);
+int matrix_tree_remote_multiply(const char* socket_path, const char* tree_name,
+                                const double* x, uint32_t cols, double* y, uint32_t rows);
+int matrix_tree_remote_shutdown(const char* socket_path);
+
+// Streaming pipeline (C implementations, matrix_tree_pipeline.c)
+// A compute thread evaluates pushed x vectors in micro-batches of up to
+// max_batch against a collapse cached at create time; results come back from
+// pop in push order. Both rings hold `capacity` vectors: push blocks while the
+// input ring is full and the compute thread stalls while the output ring is
+// full. After close, pop drains the remaining results and then returns -1.
+// Several threads may push and pop; vectors keep the order their pushes
+// claimed a slot.
+typedef struct MatrixTreePipeline MatrixTreePipeline;
+
+MatrixTreePipeline* matrix_tree_pipeline_create(MatrixTreeNode* root, uint32_t capacity, uint32_t max_batch);
+int matrix_tree_pipeline_push(MatrixTreePipeline* pipeline, const double* x);
+int matrix_tree_pipeline_pop(MatrixTreePipeline* pipeline, double* y);
+void matrix_tree_pipeline_close(MatrixTreePipeline* pipeline);
+void matrix_tree_pipeline_destroy(MatrixTreePipeline* pipeline);
+
 // Helper function prototypes (C implementations)
 void matrix_tree_print(MatrixTreeNode* node, int depth);
 MatrixTreeNode* matrix_tree_create_leaf_with_data(uint32_t rows, uint32_t cols, const double* data);
@@ -0,0 +1,225 @@
+// Matrix-Tree backend registry
+// The exported matrix_tree_* operations dispatch per operation to either the
+// hand-written assembly (matrix_tree_asm_*) or the portable C backend
+// (matrix_tree_c_*). Selection comes from, in increasing precedence: the
+// default (assembly), the autotune cache, $MATRIX_TREE_BACKEND, and explicit
+// matrix_tree_set_backend() calls.
+
+#include "matrix_tree_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+static int op_backend[MATRIX_TREE_OP_COUNT];
+static int backend_chosen;      // Set by the environment or set_backend
+
+static const char* const op_names[MATRIX_TREE_OP_COUNT] = {
+    "create", "destroy", "set_leaf", "set_internal", "collapse", "multiply", "scale"
+};
+
+static int backend_from_name(const char* name, size_t len) {
+    if (len == 3 && strncmp(name, "asm", 3) == 0) return MATRIX_TREE_BACKEND_ASM;
+    if (len == 1 && name[0] == 'c') return MATRIX_TREE_BACKEND_C;
+    return -1;
+}
+
+const char* matrix_tree_backend_name(int backend) {
+    switch (backend) {
+    case MATRIX_TREE_BACKEND_ASM: return "asm";
+    case MATRIX_TREE_BACKEND_C:   return "c";
+    default:                      return "unknown";
+    }
+}
+
+int matrix_tree_set_backend(int op, int backend) {
+    if (backend != MATRIX_TREE_BACKEND_ASM && backend != MATRIX_TREE_BACKEND_C) return -1;
+    // Cache and environment first, so this selection is not replaced by them
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    if (op == MATRIX_TREE_OP_ALL) {
+        for (int i = 0; i < MATRIX_TREE_OP_COUNT; i++) op_backend[i] = backend;
+        backend_chosen = 1;
+        return 0;
+    }
+    if (op < 0 || op >= MATRIX_TREE_OP_COUNT) return -1;
+
+    op_backend[op] = backend;
+    backend_chosen = 1;
+    return 0;
+}
+
+int matrix_tree_get_backend(int op) {
+    if (op < 0 || op >= MATRIX_TREE_OP_COUNT) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+    return op_backend[op];
+}
+
+uint64_t matrix_tree_backend_mask(void) {
+    uint64_t mask = 0;
+    for (int i = 0; i < MATRIX_TREE_OP_COUNT; i++) {
+        if (op_backend[i] == MATRIX_TREE_BACKEND_C) mask |= 1ull << i;
+    }
+    return mask;
+}
+
+// Tuned selections give way to one made by the user
+int matrix_tree_backend_chosen(void) {
+    return backend_chosen;
+}
+
+void matrix_tree_set_backend_mask(uint64_t mask) {
+    for (int i = 0; i < MATRIX_TREE_OP_COUNT; i++) {
+        op_backend[i] = (mask >> i) & 1 ? MATRIX_TREE_BACKEND_C : MATRIX_TREE_BACKEND_ASM;
+    }
+}
+
+// $MATRIX_TREE_BACKEND: "asm", "c", or a list such as "collapse=c,scale=asm"
+static void backend_env_init(void) {
+    const char* env = getenv("MATRIX_TREE_BACKEND");
+    if (!env) return;
+
+    while (*env) {
+        size_t len = strcspn(env, ",");
+        const char* eq = memchr(env, '=', len);
+
+        if (!eq) {
+            int backend = backend_from_name(env, len);
+            if (backend >= 0) matrix_tree_set_backend(MATRIX_TREE_OP_ALL, backend);
+        } else {
+            size_t name_len = (size_t)(eq - env);
+            int backend = backend_from_name(eq + 1, len - name_len - 1);
+            for (int i = 0; i < MATRIX_TREE_OP_COUNT && backend >= 0; i++) {
+                if (strlen(op_names[i]) == name_len && strncmp(env, op_names[i], name_len) == 0) {
+                    op_backend[i] = backend;
+                    backend_chosen = 1;
+                }
+            }
+        }
+
+        env += len;
+        if (*env == ',') env++;
+    }
+}
+
+static once_flag runtime_once = ONCE_FLAG_INIT;
+static _Thread_local int runtime_initializing;
+
+// ready is published only once everything is bound, so a thread that sees
+// it set never dispatches through half-built tables
+static void runtime_init_once(void) {
+    runtime_initializing = 1;
+    matrix_tree_kernels_init();
+    matrix_tree_c_init();
+    matrix_tree_tune_init();
+    backend_env_init();
+    runtime_initializing = 0;
+    atomic_store_explicit(&matrix_tree_runtime_ready, 1, memory_order_release);
+}
+
+// Called by the kernels and dispatchers on first use. The steps above call
+// back into the library, and those nested calls must not wait on the once.
+void matrix_tree_runtime_init(void) {
+    if (runtime_initializing) return;
+    call_once(&runtime_once, runtime_init_once);
+}
+
+#define DISPATCH_INIT() \
+    do { if (!matrix_tree_runtime_ready) matrix_tree_runtime_init(); } while (0)
+
+#define USE_C(op) (op_backend[op] == MATRIX_TREE_BACKEND_C)
+
+// Structured leaves are built, filled and (when alone) multiplied by
+// matrix_tree_structured.c whichever backend is selected
+MatrixTreeNode* matrix_tree_create(uint32_t rows, uint32_t cols, uint64_t node_type) {
+    DISPATCH_INIT();
+    if (matrix_tree_is_structured(node_type)) return matrix_tree_structured_create(rows, cols, node_type, 0);
+    if (USE_C(MATRIX_TREE_OP_CREATE)) return matrix_tree_c_create(rows, cols, node_type);
+    return matrix_tree_asm_create(rows, cols, node_type);
+}
+
+void matrix_tree_destroy(MatrixTreeNode* node) {
+    DISPATCH_INIT();
+    matrix_tree_freeze_release(node);
+    if (USE_C(MATRIX_TREE_OP_DESTROY)) {
+        matrix_tree_c_destroy(node);
+    } else {
+        matrix_tree_asm_destroy(node);
+    }
+}
+
+int matrix_tree_set_leaf(MatrixTreeNode* node, const double* data, size_t data_size) {
+    DISPATCH_INIT();
+    matrix_tree_freeze_touched(node);
+    if (node && matrix_tree_is_structured(node->node_type)) {
+        return matrix_tree_structured_set(node, data, data_size);
+    }
+    if (USE_C(MATRIX_TREE_OP_SET_LEAF)) return matrix_tree_c_set_leaf(node, data, data_size);
+    return matrix_tree_asm_set_leaf(node, data, data_size);
+}
+
+int matrix_tree_set_internal(MatrixTreeNode* node, MatrixTreeNode** children, uint64_t num_children) {
+    DISPATCH_INIT();
+    matrix_tree_freeze_touched(node);
+    if (USE_C(MATRIX_TREE_OP_SET_INTERNAL)) {
+        return matrix_tree_c_set_internal(node, children, num_children);
+    }
+    return matrix_tree_asm_set_internal(node, children, num_children);
+}
+
+int matrix_tree_collapse_ex(MatrixTreeNode* node, double* output, uint32_t flags) {
+    DISPATCH_INIT();
+    matrix_tree_freeze_evaluated(node);
+    if (USE_C(MATRIX_TREE_OP_COLLAPSE)) return matrix_tree_c_collapse_ex(node, output, flags);
+    return matrix_tree_asm_collapse_ex(node, output, flags);
+}
+
+int matrix_tree_collapse(MatrixTreeNode* node, double* output) {
+    return matrix_tree_collapse_ex(node, output, MATRIX_TREE_COLLAPSE_AUTO);
+}
+
+// Row-major goes through the selected collapse backend; the other layouts
+// are C only
+int matrix_tree_collapse_layout(MatrixTreeNode* node, double* output, uint32_t layout, uint32_t block_dim) {
+    DISPATCH_INIT();
+    if (layout == MATRIX_TREE_LAYOUT_ROW_MAJOR) return matrix_tree_collapse(node, output);
+    matrix_tree_freeze_evaluated(node);
+    return matrix_tree_c_collapse_layout(node, output, layout, block_dim);
+}
+
+// C only: both operands are collapsed tile by tile in one pass
+int matrix_tree_elementwise(MatrixTreeNode* a, MatrixTreeNode* b, int op, double* output) {
+    DISPATCH_INIT();
+    matrix_tree_freeze_evaluated(a);
+    matrix_tree_freeze_evaluated(b);
+    return matrix_tree_c_elementwise(a, b, op, output);
+}
+
+int matrix_tree_multiply_collapsed(MatrixTreeNode* node, const double* x, double* y) {
+    DISPATCH_INIT();
+    matrix_tree_freeze_evaluated(node);
+    if (matrix_tree_structured_only(node)) return matrix_tree_structured_multiply(node, x, y);
+    if (matrix_tree_blas_multiply(node, x, 1, y) == 0) return 0;
+    if (USE_C(MATRIX_TREE_OP_MULTIPLY)) return matrix_tree_c_multiply_collapsed(node, x, y);
+    return matrix_tree_asm_multiply_collapsed(node, x, y);
+}
+
+// C only: the batch shares each collapsed tile across all vectors
+int matrix_tree_multiply_batch(MatrixTreeNode* node, const double* x, uint64_t count, double* y) {
+    DISPATCH_INIT();
+    if (!node || !x || !y) return -1;
+    if (count == 1) return matrix_tree_multiply_collapsed(node, x, y);
+    matrix_tree_freeze_evaluated(node);
+    if (matrix_tree_blas_multiply(node, x, count, y) == 0) return 0;
+    return matrix_tree_c_multiply_batch(node, x, count, y);
+}
+
+void matrix_tree_scale(MatrixTreeNode* node, double scalar) {
+    DISPATCH_INIT();
+    matrix_tree_freeze_touched(node);
+    matrix_tree_freeze_scaled(node, scalar);
+    if (USE_C(MATRIX_TREE_OP_SCALE)) {
+        matrix_tree_c_scale(node, scalar);
+    } else {
+        matrix_tree_asm_scale(node, scalar);
+    }
+}
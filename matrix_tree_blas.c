@@ -0,0 +1,93 @@
+// Matrix-Tree external BLAS routing
+// Builds configured with MATRIX_TREE_USE_CBLAS hand large multiplies to the
+// linked CBLAS. Since A is the sum of its leaves, y = A x is accumulated leaf
+// by leaf: one dgemv (or dgemm for several vectors) per dense leaf with
+// beta = 1, and the structured kernels for structured leaves. That reads every
+// leaf once, like a collapse, without going through a tile. Below the
+// thresholds, or without CBLAS, the built-in kernels are used.
+
+#include "matrix_tree_internal.h"
+#include <string.h>
+
+#ifdef MATRIX_TREE_HAVE_CBLAS
+#include <cblas.h>
+#endif
+
+#ifndef MATRIX_TREE_BLAS_GEMV_MIN
+#define MATRIX_TREE_BLAS_GEMV_MIN 65536
+#endif
+#ifndef MATRIX_TREE_BLAS_AXPY_MIN
+#define MATRIX_TREE_BLAS_AXPY_MIN 4096
+#endif
+
+static uint64_t blas_gemv_min = MATRIX_TREE_BLAS_GEMV_MIN;
+static uint64_t blas_axpy_min = MATRIX_TREE_BLAS_AXPY_MIN;
+
+int matrix_tree_blas_enabled(void) {
+#ifdef MATRIX_TREE_HAVE_CBLAS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void matrix_tree_set_blas_thresholds(uint64_t gemv_elems, uint64_t axpy_elems) {
+    blas_gemv_min = gemv_elems;
+    blas_axpy_min = axpy_elems;
+}
+
+#ifdef MATRIX_TREE_HAVE_CBLAS
+// y (count x rows) += node applied to x (count x cols)
+static void blas_accumulate(const MatrixTreeNode* node, const double* x, uint64_t count, double* y) {
+    int rows = (int)node->rows, cols = (int)node->cols;
+
+    switch (node->node_type) {
+    case NODE_TYPE_INTERNAL: {
+        MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+        for (uint64_t i = 0; i < node->num_children; i++) blas_accumulate(children[i], x, count, y);
+        break;
+    }
+    case NODE_TYPE_LEAF:
+        if (count == 1) {
+            cblas_dgemv(CblasRowMajor, CblasNoTrans, rows, cols, 1.0,
+                        (const double*)node->data_ptr, cols, x, 1, 1.0, y, 1);
+        } else {
+            // Y += X A^T with A row-major rows x cols
+            cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, (int)count, rows, cols, 1.0,
+                        x, cols, (const double*)node->data_ptr, cols, 1.0, y, rows);
+        }
+        break;
+    default:
+        for (uint64_t v = 0; v < count; v++) {
+            matrix_tree_structured_gemv(node, x + v * node->cols, y + v * node->rows);
+        }
+        break;
+    }
+}
+#endif
+
+int matrix_tree_blas_multiply(const MatrixTreeNode* node, const double* x, uint64_t count, double* y) {
+#ifdef MATRIX_TREE_HAVE_CBLAS
+    if ((uint64_t)node->rows * node->cols < blas_gemv_min) return -1;
+
+    memset(y, 0, count * node->rows * sizeof(double));
+    blas_accumulate(node, x, count, y);
+    return 0;
+#else
+    (void)node;
+    (void)x;
+    (void)count;
+    (void)y;
+    return -1;
+#endif
+}
+
+void matrix_tree_blas_axpy(double* y, double a, const double* x, size_t n) {
+#ifdef MATRIX_TREE_HAVE_CBLAS
+    if (n >= blas_axpy_min) {
+        cblas_daxpy((int)n, a, x, 1, y, 1);
+        return;
+    }
+#endif
+    matrix_tree_c_bound_kernels()->axpy(y, a, x, n);
+}
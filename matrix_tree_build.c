@@ -0,0 +1,159 @@
+// Matrix-Tree bulk builder
+// matrix_tree_build turns a flat spec (kinds, shapes, parent indices and
+// offsets into one value buffer) into a tree held in a single allocation, in
+// place of a create and set call per node plus their separate mallocs. The
+// spec is checked and measured first, then laid out in pre-order, so a
+// collapse walks nodes, child links and leaf data front to back.
+//
+// Block layout:
+//   BuildBlock | nodes (pre-order) | children arrays | leaf data (64-byte aligned)
+
+#include "matrix_tree_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#define BUILD_ALIGN 64
+
+// Block header; a full cache line so the nodes after it start on one
+typedef struct BuildBlock {
+    uint64_t node_count;
+    uint64_t bytes;
+    uint64_t reserved[6];
+} BuildBlock;
+
+static uint64_t build_align(uint64_t n) {
+    return (n + BUILD_ALIGN - 1) & ~(uint64_t)(BUILD_ALIGN - 1);
+}
+
+// Checks one spec node; returns its stored leaf doubles (0 for internal) or -1
+static int64_t build_check(const MatrixTreeBuildSpec* spec, uint64_t i) {
+    const MatrixTreeBuildNode* n = &spec->nodes[i];
+    if (n->rows == 0 || n->cols == 0) return -1;
+
+    if (i == 0) {
+        if (n->parent != -1) return -1;
+    } else {
+        // Parents come first, which also rules out cycles
+        if (n->parent < 0 || (uint64_t)n->parent >= i) return -1;
+        const MatrixTreeBuildNode* p = &spec->nodes[n->parent];
+        if (p->node_type != NODE_TYPE_INTERNAL || p->rows != n->rows || p->cols != n->cols) return -1;
+    }
+
+    if (n->node_type == NODE_TYPE_INTERNAL) return 0;
+    if (n->node_type != NODE_TYPE_LEAF &&
+        !matrix_tree_structured_valid(n->node_type, n->rows, n->cols, n->bandwidth)) {
+        return -1;
+    }
+
+    MatrixTreeNode shape = { n->node_type, n->rows, n->cols, NULL,
+                             n->node_type == NODE_TYPE_BANDED ? n->bandwidth : 0 };
+    uint64_t elems = matrix_tree_leaf_elems(&shape);
+    if (spec->data && (n->data_offset > spec->data_elems || elems > spec->data_elems - n->data_offset)) {
+        return -1;
+    }
+    return (int64_t)elems;
+}
+
+MatrixTreeNode* matrix_tree_build(const MatrixTreeBuildSpec* spec) {
+    if (!spec || !spec->nodes || spec->num_nodes == 0) return NULL;
+    uint64_t n = spec->num_nodes;
+
+    // Scratch: subtree sizes (later the pre-order), next free pre-order slot
+    // under each node, pre-order position of each node, and leaf sizes
+    uint64_t* scratch = matrix_tree_workspace(MATRIX_TREE_WS_CALL, 4 * n * sizeof(uint64_t));
+    if (!scratch) return NULL;
+    uint64_t *size = scratch, *next = size + n, *pos = next + n, *elems = pos + n;
+
+    uint64_t data_bytes = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        int64_t e = build_check(spec, i);
+        if (e < 0) return NULL;
+        elems[i] = (uint64_t)e;
+        data_bytes += build_align(elems[i] * sizeof(double));
+        size[i] = 1;
+    }
+
+    // Subtree sizes bottom-up, then each child takes the next slot after its
+    // elder siblings' subtrees, in spec order
+    for (uint64_t i = n - 1; i > 0; i--) size[spec->nodes[i].parent] += size[i];
+    pos[0] = 0;
+    next[0] = 1;
+    for (uint64_t i = 1; i < n; i++) {
+        uint64_t parent = (uint64_t)spec->nodes[i].parent;
+        pos[i] = next[parent];
+        next[parent] += size[i];
+        next[i] = pos[i] + 1;
+    }
+    uint64_t* order = size;
+    uint64_t* count = next;
+    for (uint64_t i = 0; i < n; i++) {
+        order[pos[i]] = i;
+        count[i] = 0;
+    }
+    for (uint64_t i = 1; i < n; i++) count[spec->nodes[i].parent]++;
+
+    // Every node but the root sits in exactly one children array
+    uint64_t links_start = sizeof(BuildBlock) + n * sizeof(MatrixTreeNode);
+    uint64_t data_start = build_align(links_start + (n - 1) * sizeof(MatrixTreeNode*));
+    uint64_t total = data_start + data_bytes;
+
+#ifdef _WIN32
+    BuildBlock* block = _aligned_malloc((size_t)total, BUILD_ALIGN);
+#else
+    BuildBlock* block = aligned_alloc(BUILD_ALIGN, (size_t)total);
+#endif
+    if (!block) return NULL;
+    block->node_count = n;
+    block->bytes = total;
+
+    char* base = (char*)block;
+    MatrixTreeNode* nodes = (MatrixTreeNode*)(block + 1);
+    MatrixTreeNode** links = (MatrixTreeNode**)(base + links_start);
+    char* data = base + data_start;
+
+    // Nodes, their children arrays and leaf data all in pre-order
+    for (uint64_t p = 0; p < n; p++) {
+        const MatrixTreeBuildNode* src = &spec->nodes[order[p]];
+        MatrixTreeNode* node = &nodes[p];
+        node->node_type = src->node_type;
+        node->rows = src->rows;
+        node->cols = src->cols;
+        node->num_children = 0;
+
+        if (src->node_type == NODE_TYPE_INTERNAL) {
+            node->data_ptr = links;         // Filled below, num_children counting up
+            links += count[order[p]];
+            continue;
+        }
+        if (src->node_type == NODE_TYPE_BANDED) node->num_children = src->bandwidth;
+
+        size_t bytes = (size_t)elems[order[p]] * sizeof(double);
+        node->data_ptr = data;
+        if (spec->data) {
+            memcpy(data, spec->data + src->data_offset, bytes);
+        } else {
+            memset(data, 0, bytes);
+        }
+        data += build_align(bytes);
+    }
+
+    // Children keep their spec order
+    for (uint64_t i = 1; i < n; i++) {
+        MatrixTreeNode* parent = &nodes[pos[spec->nodes[i].parent]];
+        ((MatrixTreeNode**)parent->data_ptr)[parent->num_children++] = &nodes[pos[i]];
+    }
+    return nodes;
+}
+
+void matrix_tree_build_free(MatrixTreeNode* root) {
+    if (!root) return;
+    BuildBlock* block = (BuildBlock*)root - 1;
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
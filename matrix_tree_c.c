@@ -0,0 +1,421 @@
+// Matrix-Tree portable C backend
+// C implementations of every exported operation, with the same memory layout
+// and tiled collapse as the assembly. The inner loops come from
+// matrix_tree_c_simd.c, built per x86-64 ISA level and bound once at runtime.
+
+#include "matrix_tree_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+// Collapse tiles (the C counterpart of the assembly temp_buffer) live in the
+// calling thread's workspace, so C evaluations on different threads do not
+// share scratch
+static double* c_tile_get(uint32_t slot, size_t elems) {
+    return matrix_tree_workspace(slot, elems * sizeof(double));
+}
+
+// ---------------------------------------------------------------------------
+// ISA level resolver
+
+// Levels built into this library (MATRIX_TREE_C_HAVE_* come from CMake)
+static const MatrixTreeCKernels* const c_levels[] = {
+#ifdef MATRIX_TREE_C_HAVE_V4
+    &matrix_tree_c_kernels_v4,
+#endif
+#ifdef MATRIX_TREE_C_HAVE_V3
+    &matrix_tree_c_kernels_v3,
+#endif
+    &matrix_tree_c_kernels_v1,
+};
+
+static const MatrixTreeCKernels* c_kernels = &matrix_tree_c_kernels_v1;
+
+// Binds the widest level the CPU runs; the baseline always qualifies
+void matrix_tree_c_init(void) {
+    int cpu = matrix_tree_cpu_isa();
+    size_t i = 0;
+    while (c_levels[i]->isa > cpu) i++;
+    c_kernels = c_levels[i];
+}
+
+const MatrixTreeCKernels* matrix_tree_c_bound_kernels(void) {
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+    return c_kernels;
+}
+
+int matrix_tree_c_kernel_isa(void) {
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+    return c_kernels->isa;
+}
+
+// ---------------------------------------------------------------------------
+// Structure
+
+MatrixTreeNode* matrix_tree_c_create(uint32_t rows, uint32_t cols, uint64_t node_type) {
+    if (rows == 0 || cols == 0) return NULL;
+
+    MatrixTreeNode* node = matrix_tree_node_alloc();
+    if (!node) return NULL;
+
+    node->node_type = node_type;
+    node->rows = rows;
+    node->cols = cols;
+    node->data_ptr = NULL;
+    node->num_children = 0;
+
+    if (node_type == NODE_TYPE_LEAF) {
+        node->data_ptr = calloc((size_t)rows * cols, sizeof(double));
+        if (!node->data_ptr) {
+            matrix_tree_node_free(node);
+            return NULL;
+        }
+    }
+    return node;
+}
+
+void matrix_tree_c_destroy(MatrixTreeNode* node) {
+    if (!node) return;
+
+    if (node->node_type == NODE_TYPE_INTERNAL) {
+        MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+        if (children) {
+            for (uint64_t i = 0; i < node->num_children; i++) matrix_tree_c_destroy(children[i]);
+            matrix_tree_children_free(children, node->num_children);
+        }
+    } else {
+        free(node->data_ptr);
+    }
+    matrix_tree_node_free(node);
+}
+
+int matrix_tree_c_set_leaf(MatrixTreeNode* node, const double* data, size_t data_size) {
+    if (node->node_type != NODE_TYPE_LEAF) return -1;
+    size_t size = (size_t)node->rows * node->cols * sizeof(double);
+    if (data_size != size) return -1;
+
+    memcpy(node->data_ptr, data, size);
+    return 0;
+}
+
+int matrix_tree_c_set_internal(MatrixTreeNode* node, MatrixTreeNode** children, uint64_t num_children) {
+    if (node->node_type != NODE_TYPE_INTERNAL) return -1;
+
+    MatrixTreeNode** copy = matrix_tree_children_alloc(num_children);
+    if (!copy) return -1;
+
+    if (num_children) memcpy(copy, children, num_children * sizeof(MatrixTreeNode*));
+    node->data_ptr = copy;
+    node->num_children = num_children;
+    return 0;
+}
+
+// A leaf is its own single child; *node must outlive the returned array
+MatrixTreeNode** matrix_tree_c_children(MatrixTreeNode** node, uint64_t* count) {
+    if ((*node)->node_type != NODE_TYPE_INTERNAL) {
+        *count = 1;
+        return node;
+    }
+    *count = (*node)->num_children;
+    return (MatrixTreeNode**)(*node)->data_ptr;
+}
+
+// ---------------------------------------------------------------------------
+// Arithmetic
+
+// Adds elements [start, start + len) of every leaf under node into the tile
+static void c_accumulate(const MatrixTreeNode* node, double* tile, size_t start, size_t len) {
+    if (node->node_type == NODE_TYPE_LEAF) {
+        c_kernels->add(tile, (const double*)node->data_ptr + start, len);
+        return;
+    }
+    if (node->node_type != NODE_TYPE_INTERNAL) {
+        matrix_tree_structured_accumulate(node, tile, start, len);
+        return;
+    }
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) c_accumulate(children[i], tile, start, len);
+}
+
+// c_accumulate for callers that bring their own tile (and thread)
+void matrix_tree_c_accumulate(const MatrixTreeNode* node, double* tile, uint64_t start, uint64_t len) {
+    c_accumulate(node, tile, start, len);
+}
+
+// Tile length at `start`, honouring the tuned tile size
+static size_t c_tile_len(size_t start, size_t total) {
+    size_t len = total - start;
+    return len < matrix_tree_tile_elems ? len : (size_t)matrix_tree_tile_elems;
+}
+
+static void c_stream_tile(double* dst, const double* c_tile, size_t len) {
+    size_t i = 0;
+    if (((uintptr_t)dst & 15) != 0 && len > 0) {
+        dst[0] = c_tile[0];
+        i = 1;
+    }
+    for (; i + 2 <= len; i += 2) _mm_stream_pd(dst + i, _mm_loadu_pd(c_tile + i));
+    if (i < len) dst[i] = c_tile[i];
+}
+
+int matrix_tree_c_collapse_ex(MatrixTreeNode* node, double* output, uint32_t flags) {
+    if (!node || !output) return -1;
+
+    size_t total = (size_t)node->rows * node->cols;
+    int stream = 0;
+    if (!(flags & MATRIX_TREE_COLLAPSE_CACHED)) {
+        stream = (flags & MATRIX_TREE_COLLAPSE_STREAM) ||
+                 total * sizeof(double) >= matrix_tree_stream_threshold;
+    }
+
+    if (node->node_type == NODE_TYPE_LEAF && !stream) {
+        memcpy(output, node->data_ptr, total * sizeof(double));
+        return 0;
+    }
+
+    double* c_tile = c_tile_get(MATRIX_TREE_WS_TILE, matrix_tree_tile_elems);
+    if (!c_tile) return -1;
+
+    for (size_t start = 0; start < total; start += matrix_tree_tile_elems) {
+        size_t len = c_tile_len(start, total);
+        memset(c_tile, 0, len * sizeof(double));
+        c_accumulate(node, c_tile, start, len);
+        if (stream) {
+            c_stream_tile(output + start, c_tile, len);
+        } else {
+            memcpy(output + start, c_tile, len * sizeof(double));
+        }
+    }
+
+    if (stream) _mm_sfence();
+    return 0;
+}
+
+// Sum of squares of the collapsed matrix, one tile at a time; a lone dense
+// leaf is read in place
+int matrix_tree_c_sum_squares(const MatrixTreeNode* node, double* squares) {
+    size_t total = (size_t)node->rows * node->cols;
+    if (node->node_type == NODE_TYPE_LEAF) {
+        const double* data = (const double*)node->data_ptr;
+        *squares = c_kernels->dot(data, data, total);
+        return 0;
+    }
+
+    double* c_tile = c_tile_get(MATRIX_TREE_WS_TILE, matrix_tree_tile_elems);
+    if (!c_tile) return -1;
+
+    *squares = 0.0;
+    for (size_t start = 0; start < total; start += matrix_tree_tile_elems) {
+        size_t len = c_tile_len(start, total);
+        memset(c_tile, 0, len * sizeof(double));
+        c_accumulate(node, c_tile, start, len);
+        *squares += c_kernels->dot(c_tile, c_tile, len);
+    }
+    return 0;
+}
+
+// Both trees are collapsed tile by tile side by side and combined in cache,
+// so the only full-size stream is the output
+int matrix_tree_c_elementwise(MatrixTreeNode* a, MatrixTreeNode* b, int op, double* output) {
+    if (!a || !b || !output || a->rows != b->rows || a->cols != b->cols) return -1;
+    if (op < MATRIX_TREE_ELEMENTWISE_ADD || op > MATRIX_TREE_ELEMENTWISE_HADAMARD) return -1;
+
+    size_t total = (size_t)a->rows * a->cols;
+    int stream = total * sizeof(double) >= matrix_tree_stream_threshold;
+    double* c_tile = c_tile_get(MATRIX_TREE_WS_TILE, matrix_tree_tile_elems);
+    double* c_tile_b = c_tile_get(MATRIX_TREE_WS_TILE_B, matrix_tree_tile_elems);
+    if (!c_tile || !c_tile_b) return -1;
+
+    for (size_t start = 0; start < total; start += matrix_tree_tile_elems) {
+        size_t len = c_tile_len(start, total);
+        memset(c_tile, 0, len * sizeof(double));
+        memset(c_tile_b, 0, len * sizeof(double));
+        c_accumulate(a, c_tile, start, len);
+        c_accumulate(b, c_tile_b, start, len);
+
+        if (op == MATRIX_TREE_ELEMENTWISE_ADD) {
+            c_kernels->add(c_tile, c_tile_b, len);
+        } else if (op == MATRIX_TREE_ELEMENTWISE_SUB) {
+            c_kernels->sub(c_tile, c_tile_b, len);
+        } else {
+            c_kernels->mul(c_tile, c_tile_b, len);
+        }
+
+        if (stream) {
+            c_stream_tile(output + start, c_tile, len);
+        } else {
+            memcpy(output + start, c_tile, len * sizeof(double));
+        }
+    }
+
+    if (stream) _mm_sfence();
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Collapse into column-major or blocked output
+//
+// The tile becomes a th x tw rectangle of the matrix (one c_accumulate per row
+// segment) and is scattered straight into the target layout, so each output
+// run is a contiguous column piece or block row instead of a strided transpose
+// of a finished row-major matrix.
+
+// Rectangle about as square as the tuned tile allows, sides rounded to the
+// layout unit (a block, or a cache line of doubles for column-major); the tile
+// grows to a whole block when blocks are larger than the tuned tile
+static void c_layout_tile(size_t rows, size_t cols, size_t unit, size_t* th, size_t* tw) {
+    size_t cap = (size_t)matrix_tree_tile_elems;
+    if (cap < unit * unit) cap = unit * unit;
+
+    size_t side = 1;
+    while ((side + 1) * (side + 1) <= cap) side++;
+    if (side >= unit) side -= side % unit;
+
+    *tw = cols < side ? cols : side;
+    *th = cap / *tw;
+    if (*th >= unit) *th -= *th % unit;
+    if (*th > rows) *th = rows;
+}
+
+static void c_store_col_major(double* out, const double* c_tile, size_t rows, size_t r0, size_t c0,
+                              size_t th, size_t tw) {
+    for (size_t j = 0; j < tw; j++) {
+        double* col = out + (c0 + j) * rows + r0;
+        for (size_t i = 0; i < th; i++) col[i] = c_tile[i * tw + j];
+    }
+}
+
+static void c_store_blocked(double* out, const double* c_tile, size_t cols, size_t b, size_t r0, size_t c0,
+                            size_t th, size_t tw) {
+    size_t bcols = (cols + b - 1) / b;
+    for (size_t i = 0; i < th; i++) {
+        size_t r = r0 + i;
+        double* brow = out + (r / b) * bcols * b * b + (r % b) * b;
+        for (size_t j = 0; j < tw;) {
+            size_t c = c0 + j;
+            size_t run = b - c % b;
+            if (run > tw - j) run = tw - j;
+            memcpy(brow + (c / b) * b * b + c % b, c_tile + i * tw + j, run * sizeof(double));
+            j += run;
+        }
+    }
+}
+
+// Padding past rows x cols in the edge blocks reads as zero
+static void c_zero_block_padding(double* out, size_t rows, size_t cols, size_t b) {
+    size_t brows = (rows + b - 1) / b, bcols = (cols + b - 1) / b;
+
+    if (cols % b) {
+        size_t pad = b - cols % b;
+        for (size_t r = 0; r < brows * b; r++) {
+            double* brow = out + ((r / b) * bcols + bcols - 1) * b * b + (r % b) * b;
+            memset(brow + b - pad, 0, pad * sizeof(double));
+        }
+    }
+    if (rows % b) {
+        size_t first = rows % b;
+        for (size_t bc = 0; bc < bcols; bc++) {
+            double* block = out + ((brows - 1) * bcols + bc) * b * b;
+            memset(block + first * b, 0, (b - first) * b * sizeof(double));
+        }
+    }
+}
+
+int matrix_tree_c_collapse_layout(MatrixTreeNode* node, double* output, uint32_t layout, uint32_t block_dim) {
+    if (!node || !output) return -1;
+    if (layout == MATRIX_TREE_LAYOUT_ROW_MAJOR) return matrix_tree_c_collapse_ex(node, output, MATRIX_TREE_COLLAPSE_AUTO);
+    if (layout != MATRIX_TREE_LAYOUT_COL_MAJOR && layout != MATRIX_TREE_LAYOUT_BLOCKED) return -1;
+
+    size_t rows = node->rows, cols = node->cols;
+    size_t b = block_dim ? block_dim : MATRIX_TREE_BLOCK_DIM;
+    size_t unit = layout == MATRIX_TREE_LAYOUT_BLOCKED ? b : 8;
+    size_t th, tw;
+    c_layout_tile(rows, cols, unit, &th, &tw);
+    double* c_tile = c_tile_get(MATRIX_TREE_WS_TILE, th * tw);
+    if (!c_tile) return -1;
+
+    for (size_t r0 = 0; r0 < rows; r0 += th) {
+        size_t h = rows - r0 < th ? rows - r0 : th;
+        for (size_t c0 = 0; c0 < cols; c0 += tw) {
+            size_t w = cols - c0 < tw ? cols - c0 : tw;
+            memset(c_tile, 0, h * w * sizeof(double));
+            for (size_t i = 0; i < h; i++) c_accumulate(node, c_tile + i * w, (r0 + i) * cols + c0, w);
+
+            if (layout == MATRIX_TREE_LAYOUT_COL_MAJOR) {
+                c_store_col_major(output, c_tile, rows, r0, c0, h, w);
+            } else {
+                c_store_blocked(output, c_tile, cols, b, r0, c0, h, w);
+            }
+        }
+    }
+
+    if (layout == MATRIX_TREE_LAYOUT_BLOCKED) c_zero_block_padding(output, rows, cols, b);
+    return 0;
+}
+
+int matrix_tree_c_multiply_collapsed(MatrixTreeNode* node, const double* x, double* y) {
+    size_t total = (size_t)node->rows * node->cols;
+    size_t cols = node->cols;
+    double* c_tile = c_tile_get(MATRIX_TREE_WS_TILE, matrix_tree_tile_elems);
+    if (!c_tile) return -1;
+    memset(y, 0, node->rows * sizeof(double));
+
+    for (size_t start = 0; start < total; start += matrix_tree_tile_elems) {
+        size_t len = c_tile_len(start, total);
+        memset(c_tile, 0, len * sizeof(double));
+        c_accumulate(node, c_tile, start, len);
+
+        // Walk the tile in row segments: a tile may start or end mid-row
+        size_t pos = 0;
+        while (pos < len) {
+            size_t row = (start + pos) / cols;
+            size_t col = (start + pos) % cols;
+            size_t seg = cols - col;
+            if (seg > len - pos) seg = len - pos;
+            y[row] += c_kernels->dot(c_tile + pos, x + col, seg);
+            pos += seg;
+        }
+    }
+    return 0;
+}
+
+// Several right-hand sides (x: count x cols, y: count x rows, row-major).
+// Each tile is accumulated once and applied to every vector.
+int matrix_tree_c_multiply_batch(MatrixTreeNode* node, const double* x, uint64_t count, double* y) {
+    size_t rows = node->rows;
+    size_t cols = node->cols;
+    size_t total = rows * cols;
+    double* c_tile = c_tile_get(MATRIX_TREE_WS_TILE, matrix_tree_tile_elems);
+    if (!c_tile) return -1;
+    memset(y, 0, count * rows * sizeof(double));
+
+    for (size_t start = 0; start < total; start += matrix_tree_tile_elems) {
+        size_t len = c_tile_len(start, total);
+        memset(c_tile, 0, len * sizeof(double));
+        c_accumulate(node, c_tile, start, len);
+
+        size_t pos = 0;
+        while (pos < len) {
+            size_t row = (start + pos) / cols;
+            size_t col = (start + pos) % cols;
+            size_t seg = cols - col;
+            if (seg > len - pos) seg = len - pos;
+            for (uint64_t v = 0; v < count; v++) {
+                y[v * rows + row] += c_kernels->dot(c_tile + pos, x + v * cols + col, seg);
+            }
+            pos += seg;
+        }
+    }
+    return 0;
+}
+
+void matrix_tree_c_scale(MatrixTreeNode* node, double scalar) {
+    if (node->node_type != NODE_TYPE_INTERNAL) {
+        c_kernels->scale((double*)node->data_ptr, scalar, (size_t)matrix_tree_leaf_elems(node));
+        return;
+    }
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) matrix_tree_c_scale(children[i], scalar);
+}
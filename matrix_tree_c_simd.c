@@ -0,0 +1,298 @@
+// Matrix-Tree C backend vector kernels
+// Compiled once per x86-64 ISA level (MATRIX_TREE_C_LEVEL = v1, v3 or v4, see
+// CMakeLists.txt); each build picks the widest vectors its flags allow and
+// exports them as matrix_tree_c_kernels_<level>. matrix_tree_c_init binds the
+// best level the running CPU supports.
+
+#include "matrix_tree_internal.h"
+#include <immintrin.h>
+
+#ifndef MATRIX_TREE_C_LEVEL
+#define MATRIX_TREE_C_LEVEL v1
+#endif
+
+#define MT_CAT2(a, b) a##_##b
+#define MT_CAT(a, b) MT_CAT2(a, b)
+
+#if defined(__AVX512F__)
+
+#define MT_LEVEL_ISA MATRIX_TREE_ISA_AVX512
+
+static void level_add(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512d a0 = _mm512_add_pd(_mm512_loadu_pd(dst + i), _mm512_loadu_pd(src + i));
+        __m512d a1 = _mm512_add_pd(_mm512_loadu_pd(dst + i + 8), _mm512_loadu_pd(src + i + 8));
+        _mm512_storeu_pd(dst + i, a0);
+        _mm512_storeu_pd(dst + i + 8, a1);
+    }
+    for (; i < n; i++) dst[i] += src[i];
+}
+
+static void level_sub(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm512_storeu_pd(dst + i, _mm512_sub_pd(_mm512_loadu_pd(dst + i), _mm512_loadu_pd(src + i)));
+    for (; i < n; i++) dst[i] -= src[i];
+}
+
+static void level_mul(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm512_storeu_pd(dst + i, _mm512_mul_pd(_mm512_loadu_pd(dst + i), _mm512_loadu_pd(src + i)));
+    for (; i < n; i++) dst[i] *= src[i];
+}
+
+static double level_dot(const double* a, const double* x, size_t n) {
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(x + i), acc0);
+        acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(x + i + 8), acc1);
+    }
+    double sum = _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+    for (; i < n; i++) sum += a[i] * x[i];
+    return sum;
+}
+
+static double level_sum(const double* a, size_t n) {
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_add_pd(acc0, _mm512_loadu_pd(a + i));
+        acc1 = _mm512_add_pd(acc1, _mm512_loadu_pd(a + i + 8));
+    }
+    double sum = _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+    for (; i < n; i++) sum += a[i];
+    return sum;
+}
+
+// One Welford step with the k-th sample x (inv_k = 1 / k)
+static void level_welford(double* mean, double* m2, double* lo, double* hi, const double* x, double inv_k,
+                          size_t n) {
+    __m512d vinv = _mm512_set1_pd(inv_k);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d vx = _mm512_loadu_pd(x + i), vm = _mm512_loadu_pd(mean + i);
+        __m512d d = _mm512_sub_pd(vx, vm);
+        vm = _mm512_fmadd_pd(d, vinv, vm);
+        _mm512_storeu_pd(mean + i, vm);
+        _mm512_storeu_pd(m2 + i, _mm512_fmadd_pd(d, _mm512_sub_pd(vx, vm), _mm512_loadu_pd(m2 + i)));
+        _mm512_storeu_pd(lo + i, _mm512_min_pd(_mm512_loadu_pd(lo + i), vx));
+        _mm512_storeu_pd(hi + i, _mm512_max_pd(_mm512_loadu_pd(hi + i), vx));
+    }
+    for (; i < n; i++) {
+        double d = x[i] - mean[i];
+        mean[i] += d * inv_k;
+        m2[i] += d * (x[i] - mean[i]);
+        lo[i] = x[i] < lo[i] ? x[i] : lo[i];
+        hi[i] = x[i] > hi[i] ? x[i] : hi[i];
+    }
+}
+
+static void level_scale(double* data, double s, size_t n) {
+    __m512d vs = _mm512_set1_pd(s);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) _mm512_storeu_pd(data + i, _mm512_mul_pd(_mm512_loadu_pd(data + i), vs));
+    for (; i < n; i++) data[i] *= s;
+}
+
+static void level_axpy(double* y, double a, const double* x, size_t n) {
+    __m512d va = _mm512_set1_pd(a);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_pd(y + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i)));
+    }
+    for (; i < n; i++) y[i] += a * x[i];
+}
+
+#elif defined(__AVX2__)
+
+#define MT_LEVEL_ISA MATRIX_TREE_ISA_AVX2
+
+static void level_add(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d a0 = _mm256_add_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i));
+        __m256d a1 = _mm256_add_pd(_mm256_loadu_pd(dst + i + 4), _mm256_loadu_pd(src + i + 4));
+        _mm256_storeu_pd(dst + i, a0);
+        _mm256_storeu_pd(dst + i + 4, a1);
+    }
+    for (; i < n; i++) dst[i] += src[i];
+}
+
+static void level_sub(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(dst + i, _mm256_sub_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
+    for (; i < n; i++) dst[i] -= src[i];
+}
+
+static void level_mul(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
+    for (; i < n; i++) dst[i] *= src[i];
+}
+
+static double level_dot(const double* a, const double* x, size_t n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(x + i), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(x + i + 4), acc1);
+    }
+    acc0 = _mm256_add_pd(acc0, acc1);
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+    double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    for (; i < n; i++) sum += a[i] * x[i];
+    return sum;
+}
+
+static double level_sum(const double* a, size_t n) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    acc0 = _mm256_add_pd(acc0, acc1);
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+    double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+    for (; i < n; i++) sum += a[i];
+    return sum;
+}
+
+// One Welford step with the k-th sample x (inv_k = 1 / k)
+static void level_welford(double* mean, double* m2, double* lo, double* hi, const double* x, double inv_k,
+                          size_t n) {
+    __m256d vinv = _mm256_set1_pd(inv_k);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d vx = _mm256_loadu_pd(x + i), vm = _mm256_loadu_pd(mean + i);
+        __m256d d = _mm256_sub_pd(vx, vm);
+        vm = _mm256_fmadd_pd(d, vinv, vm);
+        _mm256_storeu_pd(mean + i, vm);
+        _mm256_storeu_pd(m2 + i, _mm256_fmadd_pd(d, _mm256_sub_pd(vx, vm), _mm256_loadu_pd(m2 + i)));
+        _mm256_storeu_pd(lo + i, _mm256_min_pd(_mm256_loadu_pd(lo + i), vx));
+        _mm256_storeu_pd(hi + i, _mm256_max_pd(_mm256_loadu_pd(hi + i), vx));
+    }
+    for (; i < n; i++) {
+        double d = x[i] - mean[i];
+        mean[i] += d * inv_k;
+        m2[i] += d * (x[i] - mean[i]);
+        lo[i] = x[i] < lo[i] ? x[i] : lo[i];
+        hi[i] = x[i] > hi[i] ? x[i] : hi[i];
+    }
+}
+
+static void level_scale(double* data, double s, size_t n) {
+    __m256d vs = _mm256_set1_pd(s);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(data + i, _mm256_mul_pd(_mm256_loadu_pd(data + i), vs));
+    for (; i < n; i++) data[i] *= s;
+}
+
+static void level_axpy(double* y, double a, const double* x, size_t n) {
+    __m256d va = _mm256_set1_pd(a);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+    for (; i < n; i++) y[i] += a * x[i];
+}
+
+#else
+
+#define MT_LEVEL_ISA MATRIX_TREE_ISA_SSE2
+
+static void level_add(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128d a0 = _mm_add_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i));
+        __m128d a1 = _mm_add_pd(_mm_loadu_pd(dst + i + 2), _mm_loadu_pd(src + i + 2));
+        _mm_storeu_pd(dst + i, a0);
+        _mm_storeu_pd(dst + i + 2, a1);
+    }
+    for (; i < n; i++) dst[i] += src[i];
+}
+
+static void level_sub(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(dst + i, _mm_sub_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+    for (; i < n; i++) dst[i] -= src[i];
+}
+
+static void level_mul(double* dst, const double* src, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(dst + i), _mm_loadu_pd(src + i)));
+    for (; i < n; i++) dst[i] *= src[i];
+}
+
+static double level_dot(const double* a, const double* x, size_t n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(x + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(x + i + 2)));
+    }
+    acc0 = _mm_add_pd(acc0, acc1);
+    double sum = _mm_cvtsd_f64(_mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0)));
+    for (; i < n; i++) sum += a[i] * x[i];
+    return sum;
+}
+
+static double level_sum(const double* a, size_t n) {
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    acc0 = _mm_add_pd(acc0, acc1);
+    double sum = _mm_cvtsd_f64(_mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0)));
+    for (; i < n; i++) sum += a[i];
+    return sum;
+}
+
+// One Welford step with the k-th sample x (inv_k = 1 / k)
+static void level_welford(double* mean, double* m2, double* lo, double* hi, const double* x, double inv_k,
+                          size_t n) {
+    __m128d vinv = _mm_set1_pd(inv_k);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d vx = _mm_loadu_pd(x + i), vm = _mm_loadu_pd(mean + i);
+        __m128d d = _mm_sub_pd(vx, vm);
+        vm = _mm_add_pd(vm, _mm_mul_pd(d, vinv));
+        _mm_storeu_pd(mean + i, vm);
+        _mm_storeu_pd(m2 + i, _mm_add_pd(_mm_loadu_pd(m2 + i), _mm_mul_pd(d, _mm_sub_pd(vx, vm))));
+        _mm_storeu_pd(lo + i, _mm_min_pd(_mm_loadu_pd(lo + i), vx));
+        _mm_storeu_pd(hi + i, _mm_max_pd(_mm_loadu_pd(hi + i), vx));
+    }
+    for (; i < n; i++) {
+        double d = x[i] - mean[i];
+        mean[i] += d * inv_k;
+        m2[i] += d * (x[i] - mean[i]);
+        lo[i] = x[i] < lo[i] ? x[i] : lo[i];
+        hi[i] = x[i] > hi[i] ? x[i] : hi[i];
+    }
+}
+
+static void level_scale(double* data, double s, size_t n) {
+    __m128d vs = _mm_set1_pd(s);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) _mm_storeu_pd(data + i, _mm_mul_pd(_mm_loadu_pd(data + i), vs));
+    for (; i < n; i++) data[i] *= s;
+}
+
+static void level_axpy(double* y, double a, const double* x, size_t n) {
+    __m128d va = _mm_set1_pd(a);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(va, _mm_loadu_pd(x + i))));
+    }
+    for (; i < n; i++) y[i] += a * x[i];
+}
+
+#endif
+
+const MatrixTreeCKernels MT_CAT(matrix_tree_c_kernels, MATRIX_TREE_C_LEVEL) = {
+    MT_LEVEL_ISA, level_add, level_dot, level_scale, level_axpy, level_sub, level_mul, level_sum,
+    level_welford
+};
@@ -0,0 +1,432 @@
+// Matrix-Tree subtree freezing
+// Freezing collapses an internal node once and turns it, in place, into a
+// dense leaf holding the sum: constant folding for parts of a tree that no
+// longer change. A kept original (children array and count) is parked in a
+// side table so the 32-byte node layout the assembly shares stays untouched,
+// and thaw puts it back.
+//
+// Auto mode watches one root. Every evaluation of that root advances its
+// epoch; direct children of the root not modified for idle_evals epochs are
+// frozen (kept), and a modification anywhere inside a frozen child thaws it
+// at the next evaluation. Modifications are the set_leaf, set_internal and
+// scale calls, logged by the dispatchers and matched against the children
+// only when the root is evaluated.
+//
+// The tables are shared by all threads and guarded by one lock. It is
+// recursive, since freezing collapses, destroys and scales through the
+// dispatchers, which call the hooks here again. While nothing is frozen or
+// watched, the hooks return after one atomic load without taking it.
+//
+// The lock covers the tables, not evaluations. Evaluating the watched root
+// rewrites its children in place, so a watched tree is evaluated by one
+// thread at a time. Holding the lock across the evaluation instead would
+// deadlock the threaded stats and top-k walks, whose workers evaluate
+// children of the locked root.
+
+#include "matrix_tree_internal.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+typedef struct FrozenRecord {
+    MatrixTreeNode* node;
+    MatrixTreeNode** children;  // Original children array
+    uint64_t num_children;
+} FrozenRecord;
+
+static FrozenRecord* frozen;
+static size_t frozen_count;
+static size_t frozen_capacity;
+
+// Auto mode state (one watched root)
+#define FREEZE_DIRTY_MAX 64
+
+typedef struct FreezeStamp {
+    MatrixTreeNode* child;
+    uint64_t touched;           // Epoch of the last modification seen
+} FreezeStamp;
+
+static MatrixTreeNode* auto_root;
+static uint64_t auto_idle;
+static uint64_t auto_epoch;
+static FreezeStamp* auto_stamps;
+static uint64_t auto_stamp_count;
+static MatrixTreeNode* dirty[FREEZE_DIRTY_MAX];
+static size_t dirty_count;
+static int dirty_overflow;
+
+static mtx_t freeze_mtx;
+static once_flag freeze_once = ONCE_FLAG_INIT;
+static atomic_int freeze_active;        // Anything frozen or watched
+
+static void freeze_mtx_init(void) {
+    mtx_init(&freeze_mtx, mtx_plain | mtx_recursive);
+}
+
+static void freeze_lock(void) {
+    call_once(&freeze_once, freeze_mtx_init);
+    mtx_lock(&freeze_mtx);
+}
+
+static void freeze_unlock(void) {
+    atomic_store_explicit(&freeze_active, frozen_count != 0 || auto_root != NULL, memory_order_release);
+    mtx_unlock(&freeze_mtx);
+}
+
+static int freeze_idle(void) {
+    return !atomic_load_explicit(&freeze_active, memory_order_acquire);
+}
+
+static int freeze_auto(MatrixTreeNode* root, uint32_t idle_evals);
+
+static FrozenRecord* freeze_find(const MatrixTreeNode* node) {
+    for (size_t i = 0; i < frozen_count; i++) {
+        if (frozen[i].node == node) return &frozen[i];
+    }
+    return NULL;
+}
+
+static void freeze_drop(FrozenRecord* record) {
+    *record = frozen[--frozen_count];
+}
+
+int matrix_tree_is_frozen(const MatrixTreeNode* node) {
+    if (!node || freeze_idle()) return 0;
+    freeze_lock();
+    int frozen_node = freeze_find(node) != NULL;
+    freeze_unlock();
+    return frozen_node;
+}
+
+// Nodes the freeze tables point at, which must not be freed behind them
+int matrix_tree_freeze_pinned(const MatrixTreeNode* node) {
+    if (!node || freeze_idle()) return 0;
+    freeze_lock();
+    int pinned = node == auto_root || freeze_find(node) != NULL;
+    freeze_unlock();
+    return pinned;
+}
+
+static int freeze_node(MatrixTreeNode* node, int keep) {
+    if (node->node_type != NODE_TYPE_INTERNAL) return 0;
+
+    if (keep && frozen_count == frozen_capacity) {
+        size_t capacity = frozen_capacity ? frozen_capacity * 2 : 16;
+        FrozenRecord* grown = realloc(frozen, capacity * sizeof(FrozenRecord));
+        if (!grown) return -1;
+        frozen = grown;
+        frozen_capacity = capacity;
+    }
+
+    double* sum = malloc((size_t)node->rows * node->cols * sizeof(double));
+    if (!sum || matrix_tree_collapse(node, sum) != 0) {
+        free(sum);
+        return -1;
+    }
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    if (keep) {
+        frozen[frozen_count++] = (FrozenRecord){ node, children, node->num_children };
+    } else {
+        for (uint64_t i = 0; i < node->num_children; i++) matrix_tree_destroy(children[i]);
+        matrix_tree_children_free(children, node->num_children);
+    }
+
+    node->node_type = NODE_TYPE_LEAF;
+    node->data_ptr = sum;
+    node->num_children = 0;
+    return 0;
+}
+
+int matrix_tree_freeze(MatrixTreeNode* node, int keep) {
+    if (!node) return -1;
+    freeze_lock();
+    int result = freeze_node(node, keep);
+    freeze_unlock();
+    return result;
+}
+
+static int freeze_thaw(MatrixTreeNode* node) {
+    FrozenRecord* record = freeze_find(node);
+    if (!record) return -1;
+
+    free(node->data_ptr);
+    node->node_type = NODE_TYPE_INTERNAL;
+    node->data_ptr = record->children;
+    node->num_children = record->num_children;
+    freeze_drop(record);
+    return 0;
+}
+
+int matrix_tree_thaw(MatrixTreeNode* node) {
+    if (!node) return -1;
+    freeze_lock();
+    int result = freeze_thaw(node);
+    freeze_unlock();
+    return result;
+}
+
+// Whether target is node or lies below it, kept originals included
+static int freeze_contains(const MatrixTreeNode* node, const MatrixTreeNode* target) {
+    if (node == target) return 1;
+
+    MatrixTreeNode** children;
+    uint64_t count;
+    FrozenRecord* record = freeze_find(node);
+    if (record) {
+        children = record->children;
+        count = record->num_children;
+    } else if (node->node_type == NODE_TYPE_INTERNAL) {
+        children = (MatrixTreeNode**)node->data_ptr;
+        count = node->num_children;
+    } else {
+        return 0;
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        if (freeze_contains(children[i], target)) return 1;
+    }
+    return 0;
+}
+
+// Frozen nodes under node (live tree only; a frozen node is a leaf here).
+// Fails when the list cannot grow, leaving it incomplete.
+static int freeze_collect(MatrixTreeNode* node, MatrixTreeNode*** out, size_t* count, size_t* capacity) {
+    if (freeze_find(node)) {
+        if (*count == *capacity) {
+            size_t grown_capacity = *capacity ? *capacity * 2 : 8;
+            MatrixTreeNode** grown = realloc(*out, grown_capacity * sizeof(MatrixTreeNode*));
+            if (!grown) return -1;
+            *out = grown;
+            *capacity = grown_capacity;
+        }
+        (*out)[(*count)++] = node;
+        return 0;
+    }
+    if (node->node_type != NODE_TYPE_INTERNAL) return 0;
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        if (freeze_collect(children[i], out, count, capacity) != 0) return -1;
+    }
+    return 0;
+}
+
+// Whether target is node or lies below it in the live tree
+static int freeze_live_contains(const MatrixTreeNode* node, const MatrixTreeNode* target) {
+    if (node == target) return 1;
+    if (node->node_type != NODE_TYPE_INTERNAL) return 0;
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        if (freeze_live_contains(children[i], target)) return 1;
+    }
+    return 0;
+}
+
+// The record's originals are destroyed, which releases any frozen inside them
+static void freeze_discard(FrozenRecord* record) {
+    MatrixTreeNode** children = record->children;
+    uint64_t num_children = record->num_children;
+    freeze_drop(record);
+    for (uint64_t c = 0; c < num_children; c++) matrix_tree_destroy(children[c]);
+    matrix_tree_children_free(children, num_children);
+}
+
+static void freeze_release(MatrixTreeNode* node) {
+    if (auto_root && freeze_contains(node, auto_root)) freeze_auto(NULL, 0);
+    if (frozen_count == 0) return;
+
+    MatrixTreeNode** list = NULL;
+    size_t count = 0, capacity = 0;
+    if (freeze_collect(node, &list, &count, &capacity) != 0) {
+        // No list: nothing is destroyed from a partial one. Scan the table
+        // instead, restarting after each discard since it reorders records.
+        free(list);
+        for (size_t i = 0; i < frozen_count;) {
+            if (!freeze_live_contains(node, frozen[i].node)) {
+                i++;
+                continue;
+            }
+            freeze_discard(&frozen[i]);
+            i = 0;
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        FrozenRecord* record = freeze_find(list[i]);
+        if (record) freeze_discard(record);
+    }
+    free(list);
+}
+
+void matrix_tree_freeze_release(MatrixTreeNode* node) {
+    if (!node || freeze_idle()) return;
+    freeze_lock();
+    freeze_release(node);
+    freeze_unlock();
+}
+
+// Kept originals of a node frozen with keep, or NULL
+MatrixTreeNode** matrix_tree_freeze_kept(const MatrixTreeNode* node, uint64_t* count) {
+    if (!node || freeze_idle()) return NULL;
+    freeze_lock();
+    FrozenRecord* record = freeze_find(node);
+    MatrixTreeNode** children = record ? record->children : NULL;
+    if (record) *count = record->num_children;
+    freeze_unlock();
+    return children;
+}
+
+// Recomputes a frozen sum after its kept originals changed underneath it
+int matrix_tree_freeze_refresh(MatrixTreeNode* node) {
+    if (!node || freeze_idle()) return 0;
+    freeze_lock();
+    FrozenRecord* record = freeze_find(node);
+    if (!record) {
+        freeze_unlock();
+        return 0;
+    }
+
+    size_t elems = (size_t)node->rows * node->cols;
+    double* part = malloc(elems * sizeof(double));
+    double* sum = (double*)node->data_ptr;
+    int result = part ? 0 : -1;
+    if (part) memset(sum, 0, elems * sizeof(double));
+    for (uint64_t i = 0; i < record->num_children && result == 0; i++) {
+        result = matrix_tree_collapse(record->children[i], part);
+        if (result == 0) matrix_tree_c_bound_kernels()->add(sum, part, elems);
+    }
+    free(part);
+    freeze_unlock();
+    return result;
+}
+
+// Keeps kept originals in step with a scale of the live tree
+void matrix_tree_freeze_scaled(MatrixTreeNode* node, double scalar) {
+    if (!node || freeze_idle()) return;
+    freeze_lock();
+
+    MatrixTreeNode** list = NULL;
+    size_t count = 0, capacity = 0;
+    int listed = freeze_collect(node, &list, &count, &capacity) == 0;
+
+    // Without a full list, every record is checked against the live tree
+    size_t total = listed ? count : frozen_count;
+    for (size_t i = 0; i < total; i++) {
+        FrozenRecord* record = listed ? freeze_find(list[i]) : &frozen[i];
+        if (!listed && !freeze_live_contains(node, record->node)) continue;
+        for (uint64_t c = 0; c < record->num_children; c++) matrix_tree_scale(record->children[c], scalar);
+    }
+    free(list);
+    freeze_unlock();
+}
+
+void matrix_tree_freeze_touched(MatrixTreeNode* node) {
+    if (!node || freeze_idle()) return;
+    freeze_lock();
+    if (auto_root && dirty_count == FREEZE_DIRTY_MAX) {
+        dirty_overflow = 1;
+    } else if (auto_root) {
+        dirty[dirty_count++] = node;
+    }
+    freeze_unlock();
+}
+
+// Re-syncs the stamps with the root's current children, keeping known ones
+static int freeze_sync_stamps(void) {
+    MatrixTreeNode** children = (MatrixTreeNode**)auto_root->data_ptr;
+    uint64_t count = auto_root->num_children;
+
+    int same = count == auto_stamp_count;
+    for (uint64_t i = 0; same && i < count; i++) same = auto_stamps[i].child == children[i];
+    if (same) return 0;
+
+    FreezeStamp* stamps = malloc((count ? count : 1) * sizeof(FreezeStamp));
+    if (!stamps) return -1;
+    for (uint64_t i = 0; i < count; i++) {
+        stamps[i].child = children[i];
+        stamps[i].touched = auto_epoch;
+        for (uint64_t j = 0; j < auto_stamp_count; j++) {
+            if (auto_stamps[j].child == children[i]) stamps[i].touched = auto_stamps[j].touched;
+        }
+    }
+    free(auto_stamps);
+    auto_stamps = stamps;
+    auto_stamp_count = count;
+    return 0;
+}
+
+// Whether a logged modification lies at or below node
+static int freeze_dirty(const MatrixTreeNode* node) {
+    int touched = dirty_overflow;
+    for (size_t d = 0; d < dirty_count && !touched; d++) touched = freeze_contains(node, dirty[d]);
+    return touched;
+}
+
+// Thaws every frozen node above a modification. Frozen children need not be
+// direct ones: a rebalance or set_internal may have moved them further down.
+static void freeze_thaw_dirty(MatrixTreeNode* node) {
+    if (!freeze_dirty(node)) return;
+    if (freeze_find(node)) freeze_thaw(node);
+    if (node->node_type != NODE_TYPE_INTERNAL) return;
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) freeze_thaw_dirty(children[i]);
+}
+
+static void freeze_evaluated(MatrixTreeNode* node) {
+    if (node != auto_root || node->node_type != NODE_TYPE_INTERNAL) return;
+    if (freeze_sync_stamps() != 0) return;
+
+    // A modified child is live again. The root's own changes need nothing: a
+    // new children array resyncs above, and scale keeps originals in step
+    for (uint64_t i = 0; i < auto_stamp_count; i++) {
+        MatrixTreeNode* child = auto_stamps[i].child;
+        if (!freeze_dirty(child)) continue;
+        auto_stamps[i].touched = auto_epoch;
+        freeze_thaw_dirty(child);
+    }
+    dirty_count = 0;
+    dirty_overflow = 0;
+
+    auto_epoch++;
+    for (uint64_t i = 0; i < auto_stamp_count; i++) {
+        MatrixTreeNode* child = auto_stamps[i].child;
+        if (child->node_type != NODE_TYPE_INTERNAL) continue;
+        if (auto_epoch - auto_stamps[i].touched >= auto_idle) freeze_node(child, 1);
+    }
+}
+
+void matrix_tree_freeze_evaluated(MatrixTreeNode* node) {
+    if (!node || freeze_idle()) return;
+    freeze_lock();
+    freeze_evaluated(node);
+    freeze_unlock();
+}
+
+static int freeze_auto(MatrixTreeNode* root, uint32_t idle_evals) {
+    free(auto_stamps);
+    auto_stamps = NULL;
+    auto_stamp_count = 0;
+    auto_root = NULL;
+    dirty_count = 0;
+    dirty_overflow = 0;
+
+    if (!root || idle_evals == 0) return 0;
+    if (root->node_type != NODE_TYPE_INTERNAL) return -1;
+
+    auto_root = root;
+    auto_idle = idle_evals;
+    auto_epoch = 0;
+    return freeze_sync_stamps();
+}
+
+int matrix_tree_freeze_auto(MatrixTreeNode* root, uint32_t idle_evals) {
+    freeze_lock();
+    int result = freeze_auto(root, idle_evals);
+    freeze_unlock();
+    return result;
+}
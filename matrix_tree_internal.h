@@ -0,0 +1,134 @@
+#ifndef MATRIX_TREE_INTERNAL_H
+#define MATRIX_TREE_INTERNAL_H
+
+// Library-internal state shared by the assembly kernels and the C support code
+
+#include "matrix_tree.h"
+#include <stdatomic.h>
+
+// Registered fixed-shape kernels (must match assembly layout, 24 bytes)
+typedef struct MatrixTreeShapeKernel {
+    uint32_t rows;
+    uint32_t cols;
+    void (*add)(double* dst, const double* src);
+    void (*gemv)(const double* a, const double* x, double* y);
+} MatrixTreeShapeKernel;
+
+#define MATRIX_TREE_MAX_SHAPE_KERNELS 64
+
+// Assembly data section. runtime_ready is a plain quadword there; C reads
+// and publishes it atomically.
+extern _Atomic uint64_t matrix_tree_runtime_ready;
+extern uint64_t matrix_tree_tile_elems;
+extern uint64_t matrix_tree_stream_threshold;
+
+// Assembly backend (matrix_tree_linux.asm / matrix_tree.asm)
+MatrixTreeNode* matrix_tree_asm_create(uint32_t rows, uint32_t cols, uint64_t node_type);
+void matrix_tree_asm_destroy(MatrixTreeNode* node);
+int matrix_tree_asm_set_leaf(MatrixTreeNode* node, const double* data, size_t data_size);
+int matrix_tree_asm_set_internal(MatrixTreeNode* node, MatrixTreeNode** children, uint64_t num_children);
+int matrix_tree_asm_collapse_ex(MatrixTreeNode* node, double* output, uint32_t flags);
+int matrix_tree_asm_multiply_collapsed(MatrixTreeNode* node, const double* x, double* y);
+void matrix_tree_asm_scale(MatrixTreeNode* node, double scalar);
+
+// C backend vector kernels, one table per ISA level (matrix_tree_c_simd.c)
+typedef struct MatrixTreeCKernels {
+    int isa;                                                    // MATRIX_TREE_ISA_*
+    void (*add)(double* dst, const double* src, size_t n);
+    double (*dot)(const double* a, const double* x, size_t n);
+    void (*scale)(double* data, double s, size_t n);
+    void (*axpy)(double* y, double a, const double* x, size_t n);   // y += a x
+    void (*sub)(double* dst, const double* src, size_t n);
+    void (*mul)(double* dst, const double* src, size_t n);         // Elementwise
+    double (*sum)(const double* a, size_t n);
+    void (*welford)(double* mean, double* m2, double* lo, double* hi, const double* x, double inv_k,
+                    size_t n);                                      // One Welford step, inv_k = 1 / k
+} MatrixTreeCKernels;
+
+extern const MatrixTreeCKernels matrix_tree_c_kernels_v1;      // x86-64 (SSE2)
+extern const MatrixTreeCKernels matrix_tree_c_kernels_v3;      // x86-64-v3 (AVX2, FMA)
+extern const MatrixTreeCKernels matrix_tree_c_kernels_v4;      // x86-64-v4 (AVX-512)
+
+// Portable C backend (matrix_tree_c.c)
+void matrix_tree_c_init(void);
+const MatrixTreeCKernels* matrix_tree_c_bound_kernels(void);   // Level bound for this CPU
+MatrixTreeNode* matrix_tree_c_create(uint32_t rows, uint32_t cols, uint64_t node_type);
+void matrix_tree_c_destroy(MatrixTreeNode* node);
+int matrix_tree_c_set_leaf(MatrixTreeNode* node, const double* data, size_t data_size);
+int matrix_tree_c_set_internal(MatrixTreeNode* node, MatrixTreeNode** children, uint64_t num_children);
+MatrixTreeNode** matrix_tree_c_children(MatrixTreeNode** node, uint64_t* count);   // Direct children, leaf as its own
+int matrix_tree_c_collapse_ex(MatrixTreeNode* node, double* output, uint32_t flags);
+int matrix_tree_c_collapse_layout(MatrixTreeNode* node, double* output, uint32_t layout, uint32_t block_dim);
+void matrix_tree_c_accumulate(const MatrixTreeNode* node, double* tile, uint64_t start, uint64_t len);
+int matrix_tree_c_sum_squares(const MatrixTreeNode* node, double* squares);
+int matrix_tree_c_elementwise(MatrixTreeNode* a, MatrixTreeNode* b, int op, double* output);
+int matrix_tree_c_multiply_collapsed(MatrixTreeNode* node, const double* x, double* y);
+int matrix_tree_c_multiply_batch(MatrixTreeNode* node, const double* x, uint64_t count, double* y);
+void matrix_tree_c_scale(MatrixTreeNode* node, double scalar);
+
+// matrix_tree_backend.c
+void matrix_tree_runtime_init(void);
+uint64_t matrix_tree_backend_mask(void);            // bit op set = C backend
+void matrix_tree_set_backend_mask(uint64_t mask);
+int matrix_tree_backend_chosen(void);               // By $MATRIX_TREE_BACKEND or set_backend
+
+// matrix_tree_kernels.c
+extern MatrixTreeShapeKernel matrix_tree_shape_kernels[MATRIX_TREE_MAX_SHAPE_KERNELS];
+extern uint64_t matrix_tree_shape_kernel_count;
+void matrix_tree_kernels_init(void);
+
+// matrix_tree_structured.c (node types above NODE_TYPE_INTERNAL)
+#define MATRIX_TREE_NODE_TYPE_COUNT (NODE_TYPE_BANDED + 1)
+int matrix_tree_is_structured(uint64_t node_type);
+int matrix_tree_structured_valid(uint64_t node_type, uint32_t rows, uint32_t cols, uint64_t aux);
+uint64_t matrix_tree_leaf_elems(const MatrixTreeNode* node);   // Stored doubles of any leaf kind
+MatrixTreeNode* matrix_tree_structured_create(uint32_t rows, uint32_t cols, uint64_t node_type, uint64_t aux);
+int matrix_tree_structured_set(MatrixTreeNode* node, const double* data, size_t data_size);
+void matrix_tree_structured_accumulate(const MatrixTreeNode* node, double* tile, uint64_t start, uint64_t len);
+void matrix_tree_structured_gemv(const MatrixTreeNode* node, const double* x, double* y);   // y += A x
+void matrix_tree_structured_column(const MatrixTreeNode* node, uint32_t col, double v, double* y);   // y += v A[:, col]
+void matrix_tree_structured_rank_update(MatrixTreeNode* node, const double* g, const double* x,
+                                        uint64_t count, double alpha);
+void matrix_tree_structured_sums(const MatrixTreeNode* node, double* sum, double* trace);   // += per leaf
+int matrix_tree_structured_only(const MatrixTreeNode* node);
+int matrix_tree_structured_multiply(const MatrixTreeNode* node, const double* x, double* y);
+
+// matrix_tree_blas.c: external CBLAS above the size thresholds; -1 = not taken
+int matrix_tree_blas_multiply(const MatrixTreeNode* node, const double* x, uint64_t count, double* y);
+void matrix_tree_blas_axpy(double* y, double a, const double* x, size_t n);
+
+// matrix_tree_shm.c: whether name was republished or unpublished since root
+// was attached from it
+int matrix_tree_attach_stale(const MatrixTreeNode* root, const char* name);
+
+// matrix_tree_freeze.c: dispatcher hooks, no-ops while nothing is frozen or watched
+void matrix_tree_freeze_release(MatrixTreeNode* node);             // Before destroy
+void matrix_tree_freeze_scaled(MatrixTreeNode* node, double scalar);
+void matrix_tree_freeze_touched(MatrixTreeNode* node);             // set_leaf, set_internal, scale
+void matrix_tree_freeze_evaluated(MatrixTreeNode* node);           // Before collapse or multiply
+int matrix_tree_freeze_pinned(const MatrixTreeNode* node);         // Frozen, or the watched root
+MatrixTreeNode** matrix_tree_freeze_kept(const MatrixTreeNode* node, uint64_t* count);
+int matrix_tree_freeze_refresh(MatrixTreeNode* node);              // After its kept originals change
+
+// matrix_tree_pool.c: every node and children array, from both backends, comes
+// from here. A children array is freed with the count it was allocated for,
+// so code that drops children reallocates the array to the new count.
+MatrixTreeNode* matrix_tree_node_alloc(void);
+void matrix_tree_node_free(MatrixTreeNode* node);
+MatrixTreeNode** matrix_tree_children_alloc(uint64_t count);
+void matrix_tree_children_free(MatrixTreeNode** children, uint64_t count);
+
+// matrix_tree_workspace.c: per-thread scratch, grown to the high-water mark
+// and reused; a call and the helpers it runs use different slots
+#define MATRIX_TREE_WS_TILE     0       // C collapse tile
+#define MATRIX_TREE_WS_TILE_B   1       // Second operand's tile (elementwise)
+#define MATRIX_TREE_WS_SCRATCH  2       // Helper scratch (optimize plans)
+#define MATRIX_TREE_WS_CALL     3       // Per-call arrays (weighted, update, job tables)
+#define MATRIX_TREE_WS_SLOTS    4
+
+void* matrix_tree_workspace(uint32_t slot, size_t bytes);          // 64-byte aligned, contents kept on growth
+
+// matrix_tree_tune.c
+void matrix_tree_tune_init(void);
+
+#endif // MATRIX_TREE_INTERNAL_H
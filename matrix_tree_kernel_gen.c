@@ -0,0 +1,351 @@
+// Matrix-Tree kernel generator (build-time host tool)
+// Emits fully unrolled, register-allocated kernels for a list of fixed shapes:
+//   add:  dst[i] += src[i]            (collapse accumulation of one leaf)
+//   gemv: y = A * x                   (collapsed multiply)
+// plus the matrix_tree_gen_kernels table the runtime registry dispatches from.
+//
+// Usage: matrix_tree_kernel_gen <gas|masm> <output> <rows>x<cols>:<isa> ...
+//   isa = sse2 | avx2 | avx512
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GEN_MAX_ELEMS 1024          // Must fit one collapse tile (MATRIX_TREE_MAX_TILE_ELEMS)
+
+typedef enum { SYNTAX_GAS, SYNTAX_MASM } Syntax;
+
+typedef struct {
+    const char* name;
+    int id;                         // MATRIX_TREE_ISA_* in matrix_tree.h
+    int width;                      // doubles per vector register
+    const char* vreg;               // vector register prefix
+    int vex;                        // 3-operand VEX/EVEX forms available
+} Isa;
+
+static const Isa isas[] = {
+    { "sse2",   0, 2, "xmm", 0 },
+    { "avx2",   1, 4, "ymm", 1 },
+    { "avx512", 2, 8, "zmm", 1 },
+};
+
+typedef struct {
+    unsigned rows, cols;
+    const Isa* isa;
+} Shape;
+
+static FILE* out;
+static Syntax syntax;
+static int num_vregs;               // allocatable vector registers
+
+// Argument registers: add(dst, src) and gemv(A, x, y)
+static const char* arg_reg(int i) {
+    static const char* gas[] = { "rdi", "rsi", "rdx" };
+    static const char* masm[] = { "rcx", "rdx", "r8" };
+    return syntax == SYNTAX_GAS ? gas[i] : masm[i];
+}
+
+static const char* reg(const char* prefix, int n) {
+    static char bufs[8][16];
+    static int next;
+    char* b = bufs[next++ & 7];
+    snprintf(b, 16, syntax == SYNTAX_GAS ? "%%%s%d" : "%s%d", prefix, n);
+    return b;
+}
+
+// Memory operand of `bytes` width at base + offset
+static const char* mem(int arg, unsigned offset, int bytes) {
+    static char bufs[8][48];
+    static int next;
+    char* b = bufs[next++ & 7];
+    if (syntax == SYNTAX_GAS) {
+        snprintf(b, 48, "%u(%%%s)", offset, arg_reg(arg));
+    } else {
+        const char* size = bytes == 8 ? "QWORD" : bytes == 16 ? "XMMWORD"
+                         : bytes == 32 ? "YMMWORD" : "ZMMWORD";
+        snprintf(b, 48, "%s PTR [%s+%u]", size, arg_reg(arg), offset);
+    }
+    return b;
+}
+
+static const char* imm(int value) {
+    static char bufs[4][16];
+    static int next;
+    char* b = bufs[next++ & 3];
+    snprintf(b, 16, syntax == SYNTAX_GAS ? "$%d" : "%d", value);
+    return b;
+}
+
+// Emit one instruction; operands are given in Intel order
+static void ins(const char* op, int n, const char* a, const char* b, const char* c) {
+    const char* ops[3] = { a, b, c };
+    fprintf(out, "    %s", op);
+    for (int i = 0; i < n; i++) {
+        int k = syntax == SYNTAX_GAS ? n - 1 - i : i;
+        fprintf(out, "%s%s", i ? ", " : " ", ops[k]);
+    }
+    fputc('\n', out);
+}
+
+#define INS2(op, a, b)    ins(op, 2, a, b, NULL)
+#define INS3(op, a, b, c) ins(op, 3, a, b, c)
+
+static void kernel_name(char* buf, size_t size, const char* kind, const Shape* s) {
+    snprintf(buf, size, "matrix_tree_gen_%s_%ux%u_%s", kind, s->rows, s->cols, s->isa->name);
+}
+
+static void begin_function(const char* name) {
+    if (syntax == SYNTAX_GAS) {
+        fprintf(out, "\n    .global %s\n    .type %s, @function\n    .p2align 4\n%s:\n",
+                name, name, name);
+    } else {
+        fprintf(out, "\nPUBLIC %s\nALIGN 16\n%s PROC\n", name, name);
+    }
+}
+
+static void end_function(const char* name, const Isa* isa) {
+    if (isa->vex) ins("vzeroupper", 0, NULL, NULL, NULL);
+    fprintf(out, "    ret\n");
+    if (syntax == SYNTAX_MASM) fprintf(out, "%s ENDP\n", name);
+}
+
+// dst[i] += src[i] over rows*cols doubles, rotating through the register file
+static void emit_add(const Shape* s) {
+    char name[96];
+    kernel_name(name, sizeof(name), "add", s);
+    begin_function(name);
+
+    const Isa* isa = s->isa;
+    unsigned n = s->rows * s->cols;
+    unsigned vbytes = (unsigned)isa->width * 8;
+    unsigned chunks = n / (unsigned)isa->width;
+    int pair = 0;
+
+    for (unsigned k = 0; k < chunks; k++, pair = (pair + 2) % (num_vregs & ~1)) {
+        unsigned off = k * vbytes;
+        const char* r = reg(isa->vreg, pair);
+        if (isa->vex) {
+            INS2("vmovupd", r, mem(1, off, (int)vbytes));
+            INS3("vaddpd", r, r, mem(0, off, (int)vbytes));
+            INS2("vmovupd", mem(0, off, (int)vbytes), r);
+        } else {
+            const char* t = reg(isa->vreg, pair + 1);
+            INS2("movupd", r, mem(0, off, (int)vbytes));
+            INS2("movupd", t, mem(1, off, (int)vbytes));
+            INS2("addpd", r, t);
+            INS2("movupd", mem(0, off, (int)vbytes), r);
+        }
+    }
+
+    for (unsigned i = chunks * (unsigned)isa->width; i < n; i++) {
+        const char* r = reg("xmm", 0);
+        if (isa->vex) {
+            INS2("vmovsd", r, mem(0, i * 8, 8));
+            INS3("vaddsd", r, r, mem(1, i * 8, 8));
+            INS2("vmovsd", mem(0, i * 8, 8), r);
+        } else {
+            INS2("movsd", r, mem(0, i * 8, 8));
+            INS2("addsd", r, mem(1, i * 8, 8));
+            INS2("movsd", mem(0, i * 8, 8), r);
+        }
+    }
+
+    end_function(name, isa);
+}
+
+// Reduce the vector accumulator `acc` into its low lane using temp `t`
+static void emit_hsum(const Isa* isa, int acc, int t) {
+    if (isa->width == 8) {
+        INS3("vextractf64x4", reg("ymm", t), reg("zmm", acc), imm(1));
+        INS3("vaddpd", reg("ymm", acc), reg("ymm", acc), reg("ymm", t));
+    }
+    if (isa->width >= 4) {
+        INS3("vextractf128", reg("xmm", t), reg("ymm", acc), imm(1));
+        INS3("vaddpd", reg("xmm", acc), reg("xmm", acc), reg("xmm", t));
+        INS3("vunpckhpd", reg("xmm", t), reg("xmm", acc), reg("xmm", acc));
+        INS3("vaddsd", reg("xmm", acc), reg("xmm", acc), reg("xmm", t));
+    } else {
+        INS2("movapd", reg("xmm", t), reg("xmm", acc));
+        INS2("unpckhpd", reg("xmm", t), reg("xmm", t));
+        INS2("addsd", reg("xmm", acc), reg("xmm", t));
+    }
+}
+
+// y = A * x; the leading column chunks of x stay resident in registers
+static void emit_gemv(const Shape* s) {
+    char name[96];
+    kernel_name(name, sizeof(name), "gemv", s);
+    begin_function(name);
+
+    const Isa* isa = s->isa;
+    unsigned w = (unsigned)isa->width;
+    unsigned vbytes = w * 8;
+    unsigned chunks = s->cols / w;
+    const int acc = 0, t = 1, t2 = 2, xbase = 3;
+    unsigned resident = chunks;
+    if (resident > (unsigned)(num_vregs - xbase)) resident = (unsigned)(num_vregs - xbase);
+
+    for (unsigned k = 0; k < resident; k++) {
+        INS2(isa->vex ? "vmovupd" : "movupd", reg(isa->vreg, xbase + (int)k),
+             mem(1, k * vbytes, (int)vbytes));
+    }
+
+    for (unsigned r = 0; r < s->rows; r++) {
+        unsigned row = r * s->cols * 8;
+
+        for (unsigned k = 0; k < chunks; k++) {
+            unsigned a_off = row + k * vbytes;
+            const char* x;
+            if (k < resident) {
+                x = reg(isa->vreg, xbase + (int)k);
+            } else {
+                x = reg(isa->vreg, t2);
+                INS2(isa->vex ? "vmovupd" : "movupd", x, mem(1, k * vbytes, (int)vbytes));
+            }
+
+            if (isa->vex) {
+                if (k == 0) {
+                    INS3("vmulpd", reg(isa->vreg, acc), x, mem(0, a_off, (int)vbytes));
+                } else {
+                    INS3("vfmadd231pd", reg(isa->vreg, acc), x, mem(0, a_off, (int)vbytes));
+                }
+            } else if (k == 0) {
+                INS2("movupd", reg("xmm", acc), mem(0, a_off, (int)vbytes));
+                INS2("mulpd", reg("xmm", acc), x);
+            } else {
+                INS2("movupd", reg("xmm", t), mem(0, a_off, (int)vbytes));
+                INS2("mulpd", reg("xmm", t), x);
+                INS2("addpd", reg("xmm", acc), reg("xmm", t));
+            }
+        }
+
+        if (chunks > 0) {
+            emit_hsum(isa, acc, t);
+        } else if (isa->vex) {
+            INS3("vxorpd", reg("xmm", acc), reg("xmm", acc), reg("xmm", acc));
+        } else {
+            INS2("xorpd", reg("xmm", acc), reg("xmm", acc));
+        }
+
+        // Leftover columns in scalar
+        for (unsigned c = chunks * w; c < s->cols; c++) {
+            if (isa->vex) {
+                INS2("vmovsd", reg("xmm", t), mem(0, row + c * 8, 8));
+                INS3("vfmadd231sd", reg("xmm", acc), reg("xmm", t), mem(1, c * 8, 8));
+            } else {
+                INS2("movsd", reg("xmm", t), mem(0, row + c * 8, 8));
+                INS2("mulsd", reg("xmm", t), mem(1, c * 8, 8));
+                INS2("addsd", reg("xmm", acc), reg("xmm", t));
+            }
+        }
+
+        INS2(isa->vex ? "vmovsd" : "movsd", mem(2, r * 8, 8), reg("xmm", acc));
+    }
+
+    end_function(name, isa);
+}
+
+static int parse_shape(const char* text, Shape* s) {
+    char isa_name[16];
+    if (sscanf(text, "%ux%u:%15s", &s->rows, &s->cols, isa_name) != 3) return -1;
+    if (s->rows == 0 || s->cols == 0 || s->rows * s->cols > GEN_MAX_ELEMS) return -1;
+
+    for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+        if (strcmp(isa_name, isas[i].name) == 0) {
+            s->isa = &isas[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void emit_table(const Shape* shapes, int count) {
+    char add[96], gemv[96];
+
+    if (syntax == SYNTAX_GAS) {
+        fprintf(out, "\n.section .data\n    .align 8\n");
+        fprintf(out, "    .global matrix_tree_gen_kernel_count\n");
+        fprintf(out, "    .global matrix_tree_gen_kernels\n");
+        fprintf(out, "matrix_tree_gen_kernel_count: .quad %d\n", count);
+        fprintf(out, "matrix_tree_gen_kernels:\n");
+        for (int i = 0; i < count; i++) {
+            kernel_name(add, sizeof(add), "add", &shapes[i]);
+            kernel_name(gemv, sizeof(gemv), "gemv", &shapes[i]);
+            fprintf(out, "    .long %u, %u, %d, 0\n    .quad %s, %s\n",
+                    shapes[i].rows, shapes[i].cols, shapes[i].isa->id, add, gemv);
+        }
+        // Keep a valid symbol even for an empty table
+        if (count == 0) fprintf(out, "    .quad 0\n");
+        fprintf(out, "\n.section .note.GNU-stack,\"\",@progbits\n");
+    } else {
+        fprintf(out, "\n.data\n    ALIGN 8\n");
+        fprintf(out, "PUBLIC matrix_tree_gen_kernel_count\n");
+        fprintf(out, "PUBLIC matrix_tree_gen_kernels\n");
+        fprintf(out, "matrix_tree_gen_kernel_count QWORD %d\n", count);
+        fprintf(out, "matrix_tree_gen_kernels LABEL QWORD\n");
+        for (int i = 0; i < count; i++) {
+            kernel_name(add, sizeof(add), "add", &shapes[i]);
+            kernel_name(gemv, sizeof(gemv), "gemv", &shapes[i]);
+            fprintf(out, "    DWORD %u, %u, %d, 0\n    QWORD %s, %s\n",
+                    shapes[i].rows, shapes[i].cols, shapes[i].isa->id, add, gemv);
+        }
+        if (count == 0) fprintf(out, "    QWORD 0\n");
+        fprintf(out, "\nEND\n");
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <gas|masm> <output> <rows>x<cols>:<isa> ...\n", argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "gas") == 0) {
+        syntax = SYNTAX_GAS;
+        num_vregs = 16;
+    } else if (strcmp(argv[1], "masm") == 0) {
+        // xmm6-xmm15 are callee-saved on Win64; stay within the volatile set
+        syntax = SYNTAX_MASM;
+        num_vregs = 6;
+    } else {
+        fprintf(stderr, "unknown syntax '%s'\n", argv[1]);
+        return 1;
+    }
+
+    int count = argc - 3;
+    Shape* shapes = calloc((size_t)(count > 0 ? count : 1), sizeof(Shape));
+    if (!shapes) return 1;
+    for (int i = 0; i < count; i++) {
+        if (parse_shape(argv[i + 3], &shapes[i]) != 0) {
+            fprintf(stderr, "bad kernel shape '%s' (want RxC:isa, RxC <= %d)\n",
+                    argv[i + 3], GEN_MAX_ELEMS);
+            free(shapes);
+            return 1;
+        }
+    }
+
+    out = fopen(argv[2], "w");
+    if (!out) {
+        perror(argv[2]);
+        free(shapes);
+        return 1;
+    }
+
+    if (syntax == SYNTAX_GAS) {
+        fprintf(out, "# Generated by matrix_tree_kernel_gen - do not edit\n");
+        fprintf(out, "# Fixed-shape collapse (add) and multiply (gemv) kernels\n\n.text\n");
+    } else {
+        fprintf(out, "; Generated by matrix_tree_kernel_gen - do not edit\n");
+        fprintf(out, "; Fixed-shape collapse (add) and multiply (gemv) kernels\n\n");
+        fprintf(out, "OPTION CASEMAP:NONE\n\n.code\n");
+    }
+
+    for (int i = 0; i < count; i++) {
+        emit_add(&shapes[i]);
+        emit_gemv(&shapes[i]);
+    }
+    emit_table(shapes, count);
+
+    free(shapes);
+    return fclose(out) == 0 ? 0 : 1;
+}
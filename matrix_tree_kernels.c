@@ -0,0 +1,125 @@
+// Matrix-Tree kernel registry
+// Binds the build-time generated fixed-shape kernels (matrix_tree_kernel_gen)
+// to the running CPU: for every shape the widest variant the CPU supports is
+// registered in matrix_tree_shape_kernels, which the assembly collapse and
+// multiply consult before falling back to their generic loops.
+
+#include "matrix_tree_internal.h"
+
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// Generated table entry (must match matrix_tree_kernel_gen output, 32 bytes)
+typedef struct GenKernel {
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t isa;
+    uint32_t reserved;
+    void (*add)(double* dst, const double* src);
+    void (*gemv)(const double* a, const double* x, double* y);
+} GenKernel;
+
+extern const uint64_t matrix_tree_gen_kernel_count;
+extern const GenKernel matrix_tree_gen_kernels[];
+
+MatrixTreeShapeKernel matrix_tree_shape_kernels[MATRIX_TREE_MAX_SHAPE_KERNELS];
+uint64_t matrix_tree_shape_kernel_count;
+
+// ISA level of each registered entry, for matrix_tree_shape_kernel_isa
+static int shape_kernel_isa[MATRIX_TREE_MAX_SHAPE_KERNELS];
+
+static uint64_t cpu_xcr0(void) {
+#ifdef _WIN32
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+static void cpu_id(uint32_t leaf, uint32_t sub, uint32_t regs[4]) {
+#ifdef _WIN32
+    int info[4];
+    __cpuidex(info, (int)leaf, (int)sub);
+    for (int i = 0; i < 4; i++) regs[i] = (uint32_t)info[i];
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Levels follow the x86-64 psABI: the C backend's v3/v4 builds may use any
+// instruction of their level, not just the vector ones
+int matrix_tree_cpu_isa(void) {
+    uint32_t regs[4];
+
+    cpu_id(0, 0, regs);
+    uint32_t max_leaf = regs[0];
+    cpu_id(1, 0, regs);
+    int osxsave = (regs[2] >> 27) & 1;
+    int fma = (regs[2] >> 12) & 1;
+    int movbe = (regs[2] >> 22) & 1;
+    int f16c = (regs[2] >> 29) & 1;
+    if (max_leaf < 7 || !osxsave) return MATRIX_TREE_ISA_SSE2;
+
+    cpu_id(0x80000001u, 0, regs);
+    int lzcnt = (regs[2] >> 5) & 1;
+
+    // The OS must save the wider register state too
+    uint64_t xcr0 = cpu_xcr0();
+    cpu_id(7, 0, regs);
+    int avx2 = (regs[1] >> 5) & 1;
+    int bmi = ((regs[1] >> 3) & 1) && ((regs[1] >> 8) & 1);
+    // AVX-512 F, DQ, CD, BW, VL
+    int avx512 = (regs[1] & 0xd0030000u) == 0xd0030000u;
+
+    int v3 = avx2 && fma && bmi && movbe && f16c && lzcnt && (xcr0 & 0x6) == 0x6;
+    if (v3 && avx512 && (xcr0 & 0xe6) == 0xe6) return MATRIX_TREE_ISA_AVX512;
+    if (v3) return MATRIX_TREE_ISA_AVX2;
+    return MATRIX_TREE_ISA_SSE2;
+}
+
+void matrix_tree_kernels_init(void) {
+    int cpu = matrix_tree_cpu_isa();
+    uint64_t count = 0;
+
+    for (uint64_t i = 0; i < matrix_tree_gen_kernel_count; i++) {
+        const GenKernel* gen = &matrix_tree_gen_kernels[i];
+        if ((int)gen->isa > cpu) continue;
+
+        // One entry per shape: keep the widest supported variant
+        uint64_t slot = 0;
+        while (slot < count && (matrix_tree_shape_kernels[slot].rows != gen->rows ||
+                                matrix_tree_shape_kernels[slot].cols != gen->cols)) {
+            slot++;
+        }
+        if (slot == count) {
+            if (count == MATRIX_TREE_MAX_SHAPE_KERNELS) continue;
+            count++;
+        } else if (shape_kernel_isa[slot] >= (int)gen->isa) {
+            continue;
+        }
+
+        matrix_tree_shape_kernels[slot].rows = gen->rows;
+        matrix_tree_shape_kernels[slot].cols = gen->cols;
+        matrix_tree_shape_kernels[slot].add = gen->add;
+        matrix_tree_shape_kernels[slot].gemv = gen->gemv;
+        shape_kernel_isa[slot] = (int)gen->isa;
+    }
+
+    matrix_tree_shape_kernel_count = count;
+}
+
+int matrix_tree_shape_kernel_isa(uint32_t rows, uint32_t cols) {
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    for (uint64_t i = 0; i < matrix_tree_shape_kernel_count; i++) {
+        if (matrix_tree_shape_kernels[i].rows == rows && matrix_tree_shape_kernels[i].cols == cols) {
+            return shape_kernel_isa[i];
+        }
+    }
+    return -1;
+}
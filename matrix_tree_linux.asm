@@ -9,18 +9,38 @@ err_null_ptr:    .asciz "Error: NULL pointer\n"
 err_bad_alloc:   .asciz "Error: Allocation failed\n"
 err_bad_dim:     .asciz "Error: Invalid dimensions\n"
 
-.section .bss
     .align 8
-    .lcomm temp_buffer, 8192    # Temporary computation buffer
+    # Runtime tuning (see matrix_tree_tune.c); defaults match matrix_tree.h
+    .global matrix_tree_stream_threshold
+    .global matrix_tree_tile_elems
+    .global matrix_tree_runtime_ready
+    # Outputs at least this many bytes are collapsed with non-temporal stores
+matrix_tree_stream_threshold: .quad 4194304
+    # Doubles per collapse tile (1..TILE_ELEMS)
+matrix_tree_tile_elems:       .quad 1024
+    # Nonzero once matrix_tree_runtime_init has run
+matrix_tree_runtime_ready:     .quad 0
+
+.section .bss
+    .local temp_buffer
+    .comm temp_buffer, 8192, 64     # Temporary computation buffer (one collapse tile)
+
+# Node types and collapse flags (must match matrix_tree.h)
+.equ NODE_TYPE_LEAF, 0
+.equ NODE_TYPE_INTERNAL, 1        # Higher types are structured leaves (matrix_tree_structured.c)
+.equ MATRIX_TREE_COLLAPSE_STREAM, 1
+.equ MATRIX_TREE_COLLAPSE_CACHED, 2
+.equ TILE_ELEMS, 1024           # temp_buffer capacity in doubles
+.equ SHAPE_KERNEL_SIZE, 24      # MatrixTreeShapeKernel: rows, cols, add, gemv
 
 .section .text
-    .global matrix_tree_create
-    .global matrix_tree_destroy
-    .global matrix_tree_set_leaf
-    .global matrix_tree_set_internal
-    .global matrix_tree_collapse
-    .global matrix_tree_multiply_collapsed
-    .global matrix_tree_scale
+    .global matrix_tree_asm_create
+    .global matrix_tree_asm_destroy
+    .global matrix_tree_asm_set_leaf
+    .global matrix_tree_asm_set_internal
+    .global matrix_tree_asm_collapse_ex
+    .global matrix_tree_asm_multiply_collapsed
+    .global matrix_tree_asm_scale
 
 # Data Structure Layout (in memory):
 # TreeNode structure (32 bytes):
@@ -30,11 +50,11 @@ err_bad_dim:     .asciz "Error: Invalid dimensions\n"
 #   +16: data_ptr (8 bytes) - points to matrix data if leaf, or children array if internal
 #   +24: num_children (8 bytes) - only used for internal nodes
 
-# Function: matrix_tree_create
+# Function: matrix_tree_asm_create
 # Creates a new matrix tree node
 # Args: %rdi = rows, %rsi = cols, %rdx = node_type (0=leaf, 1=internal)
 # Returns: %rax = pointer to new node, or NULL on failure
-matrix_tree_create:
+matrix_tree_asm_create:
     pushq %rbp
     movq %rsp, %rbp
     pushq %rbx
@@ -53,9 +73,8 @@ matrix_tree_create:
     testq %r13, %r13
     jz .create_error
     
-    # Allocate TreeNode structure (32 bytes)
-    movq $32, %rdi
-    call malloc@PLT
+    # Allocate TreeNode structure (32 bytes, node pool)
+    call matrix_tree_node_alloc@PLT
     testq %rax, %rax
     jz .create_error
     
@@ -103,7 +122,7 @@ matrix_tree_create:
 
 .create_cleanup:
     movq %rbx, %rdi
-    call free@PLT
+    call matrix_tree_node_free@PLT
 .create_error:
     xorq %rax, %rax
     popq %r14
@@ -113,16 +132,17 @@ matrix_tree_create:
     popq %rbp
     ret
 
-# Function: matrix_tree_destroy
+# Function: matrix_tree_asm_destroy
 # Recursively destroys a matrix tree node and all children
 # Args: %rdi = pointer to node
 # Returns: void
-matrix_tree_destroy:
+matrix_tree_asm_destroy:
     pushq %rbp
     movq %rsp, %rbp
     pushq %rbx
     pushq %r12
     pushq %r13
+    pushq %r14                  # Also keeps calls 16-byte aligned
     
     # Check for NULL
     testq %rdi, %rdi
@@ -144,24 +164,23 @@ matrix_tree_destroy:
     testq %r12, %r12
     jz .destroy_node
     
-    xorq %rcx, %rcx             # counter
+    xorq %r14, %r14             # counter
 .destroy_loop:
-    cmpq %r13, %rcx
+    cmpq %r13, %r14
     jge .destroy_children_done
     
-    # Destroy child at index rcx
-    movq (%r12, %rcx, 8), %rdi
-    pushq %rcx
-    call matrix_tree_destroy
-    popq %rcx
+    # Destroy child at index r14
+    movq (%r12, %r14, 8), %rdi
+    call matrix_tree_asm_destroy
     
-    incq %rcx
+    incq %r14
     jmp .destroy_loop
     
 .destroy_children_done:
-    # Free children array
+    # Free children array (back to its size class)
     movq %r12, %rdi
-    call free@PLT
+    movq %r13, %rsi
+    call matrix_tree_children_free@PLT
     jmp .destroy_node
     
 .destroy_leaf:
@@ -174,20 +193,21 @@ matrix_tree_destroy:
 .destroy_node:
     # Free the node itself
     movq %rbx, %rdi
-    call free@PLT
+    call matrix_tree_node_free@PLT
     
 .destroy_done:
+    popq %r14
     popq %r13
     popq %r12
     popq %rbx
     popq %rbp
     ret
 
-# Function: matrix_tree_set_leaf
+# Function: matrix_tree_asm_set_leaf
 # Sets the matrix data for a leaf node
 # Args: %rdi = node pointer, %rsi = data pointer, %rdx = data_size
 # Returns: %rax = 0 on success, -1 on error
-matrix_tree_set_leaf:
+matrix_tree_asm_set_leaf:
     pushq %rbp
     movq %rsp, %rbp
     pushq %rbx
@@ -225,15 +245,17 @@ matrix_tree_set_leaf:
     popq %rbp
     ret
 
-# Function: matrix_tree_set_internal
+# Function: matrix_tree_asm_set_internal
 # Sets children for an internal node
 # Args: %rdi = node pointer, %rsi = children array, %rdx = num_children
 # Returns: %rax = 0 on success, -1 on error
-matrix_tree_set_internal:
+matrix_tree_asm_set_internal:
     pushq %rbp
     movq %rsp, %rbp
     pushq %rbx
     pushq %r12
+    pushq %r13
+    subq $8, %rsp               # Keep calls 16-byte aligned
     
     # Validate node is internal type
     movq (%rdi), %rax
@@ -241,12 +263,12 @@ matrix_tree_set_internal:
     jne .setinternal_error
     
     movq %rdi, %rbx
+    movq %rsi, %r13             # children source (the call clobbers %rsi)
     movq %rdx, %r12
     
-    # Allocate array for child pointers
+    # Allocate array for child pointers (children pool)
     movq %r12, %rdi
-    shlq $3, %rdi               # * 8 bytes per pointer
-    call malloc@PLT
+    call matrix_tree_children_alloc@PLT
     testq %rax, %rax
     jz .setinternal_error
     
@@ -256,12 +278,14 @@ matrix_tree_set_internal:
     
     # Copy child pointers
     movq %rax, %rdi
-    # %rsi already has source
+    movq %r13, %rsi
     movq %r12, %rdx
     shlq $3, %rdx
     call memcpy@PLT
     
     xorq %rax, %rax
+    addq $8, %rsp
+    popq %r13
     popq %r12
     popq %rbx
     popq %rbp
@@ -269,16 +293,21 @@ matrix_tree_set_internal:
     
 .setinternal_error:
     movq $-1, %rax
+    addq $8, %rsp
+    popq %r13
     popq %r12
     popq %rbx
     popq %rbp
     ret
 
-# Function: matrix_tree_collapse
-# Collapses a tree into a single matrix by summing all leaf nodes
-# Args: %rdi = node pointer, %rsi = output buffer (pre-allocated)
+# Function: matrix_tree_asm_collapse_ex
+# Collapses a tree into a single matrix with an explicit store policy
+# The sum is accumulated one temp_buffer tile at a time and each finished tile
+# is written to the output exactly once. When streaming, that final write uses
+# non-temporal stores (movntpd) so the output never displaces the working set.
+# Args: %rdi = node pointer, %rsi = output buffer (pre-allocated), %rdx = flags
 # Returns: %rax = 0 on success, -1 on error
-matrix_tree_collapse:
+matrix_tree_asm_collapse_ex:
     pushq %rbp
     movq %rsp, %rbp
     pushq %rbx
@@ -286,79 +315,146 @@ matrix_tree_collapse:
     pushq %r13
     pushq %r14
     pushq %r15
-    
+    subq $24, %rsp              # -48(%rbp): tile length, -56(%rbp): shape kernel
+
+    # Register kernels and load cached tuning on first use
+    cmpq $0, matrix_tree_runtime_ready(%rip)
+    jne .collapse_tuned
+    movq %rdi, %rbx
+    movq %rsi, %r12
+    movq %rdx, %r13
+    call matrix_tree_runtime_init@PLT
+    movq %rbx, %rdi
+    movq %r12, %rsi
+    movq %r13, %rdx
+.collapse_tuned:
+
+    testq %rdi, %rdi
+    jz .collapse_error
+    testq %rsi, %rsi
+    jz .collapse_error
+
     movq %rdi, %rbx             # node
     movq %rsi, %r12             # output buffer
-    
-    # Check node type
-    movq (%rbx), %rax
-    testq %rax, %rax
-    jz .collapse_leaf
-    
-    # Internal node - recursively collapse children and sum
-    movq 16(%rbx), %r13         # children array
-    movq 24(%rbx), %r14         # num_children
-    
+
     # Get matrix dimensions
     movl 8(%rbx), %eax          # rows
     movl 12(%rbx), %ecx         # cols
     imulq %rcx, %rax
     movq %rax, %r15             # total elements
-    
-    # Zero output buffer
+
+    # Pick the store policy: %r13 = 1 streams the final write pass
+    xorq %r13, %r13
+    testq $MATRIX_TREE_COLLAPSE_CACHED, %rdx
+    jnz .collapse_policy_done
+    movq $1, %r13
+    testq $MATRIX_TREE_COLLAPSE_STREAM, %rdx
+    jnz .collapse_policy_done
+    movq %r15, %rax
+    shlq $3, %rax
+    cmpq matrix_tree_stream_threshold(%rip), %rax
+    jae .collapse_policy_done
+    xorq %r13, %r13
+.collapse_policy_done:
+
+    # A leaf written through the cache is a plain copy
+    cmpq $NODE_TYPE_LEAF, (%rbx)
+    jne .collapse_tiled
+    testq %r13, %r13
+    jnz .collapse_tiled
+
     movq %r12, %rdi
-    xorq %rsi, %rsi
+    movq 16(%rbx), %rsi
     movq %r15, %rdx
     shlq $3, %rdx
+    call memcpy@PLT
+    jmp .collapse_done
+
+.collapse_tiled:
+    # A single-tile output with a generated kernel for its shape adds whole leaves
+    movq $0, -56(%rbp)
+    cmpq matrix_tree_tile_elems(%rip), %r15
+    ja .collapse_tile_start
+    movq %rbx, %rdi
+    call find_shape_kernel
+    testq %rax, %rax
+    jz .collapse_tile_start
+    movq 8(%rax), %rax          # add kernel
+    movq %rax, -56(%rbp)
+
+.collapse_tile_start:
+    xorq %r14, %r14             # tile start (element index)
+.collapse_tile_loop:
+    cmpq %r15, %r14
+    jge .collapse_fence
+
+    # Tile length = min(tile_elems, total - start)
+    movq %r15, %rax
+    subq %r14, %rax
+    movq matrix_tree_tile_elems(%rip), %rcx
+    cmpq %rcx, %rax
+    cmova %rcx, %rax
+    movq %rax, -48(%rbp)
+
+    # Zero the tile
+    leaq temp_buffer(%rip), %rdi
+    xorq %rsi, %rsi
+    movq %rax, %rdx
+    shlq $3, %rdx
     call memset@PLT
-    
-    # Sum all children
-    xorq %rcx, %rcx             # child counter
-.collapse_sum_loop:
-    cmpq %r14, %rcx
-    jge .collapse_done
-    
-    # Collapse child into temp buffer
-    movq (%r13, %rcx, 8), %rdi
+
+    # Add every leaf's slice of this tile
+    movq %rbx, %rdi
+    movq %r14, %rsi
+    movq -48(%rbp), %rdx
+    movq -56(%rbp), %rcx
+    call collapse_accumulate
+
+    # Write the finished tile to the output
+    leaq (%r12, %r14, 8), %rdi  # destination
     leaq temp_buffer(%rip), %rsi
-    pushq %rcx
-    call matrix_tree_collapse
-    popq %rcx
-    
-    # Add temp buffer to output
-    xorq %rdx, %rdx             # element counter
-.collapse_add_loop:
-    cmpq %r15, %rdx
-    jge .collapse_next_child
-    
-    # Load and add doubles
-    movsd (%r12, %rdx, 8), %xmm0
-    leaq temp_buffer(%rip), %rax
-    movsd (%rax, %rdx, 8), %xmm1
-    addsd %xmm1, %xmm0
-    movsd %xmm0, (%r12, %rdx, 8)
-    
-    incq %rdx
-    jmp .collapse_add_loop
-    
-.collapse_next_child:
-    incq %rcx
-    jmp .collapse_sum_loop
-    
-.collapse_leaf:
-    # Leaf node - copy data to output
-    movl 8(%rbx), %eax          # rows
-    movl 12(%rbx), %ecx         # cols
-    imulq %rcx, %rax
-    shlq $3, %rax
-    
-    movq %r12, %rdi
-    movq 16(%rbx), %rsi
-    movq %rax, %rdx
+    movq -48(%rbp), %rdx        # element count
+    testq %r13, %r13
+    jnz .collapse_stream_tile
+
+    shlq $3, %rdx
     call memcpy@PLT
-    
+    jmp .collapse_next_tile
+
+.collapse_stream_tile:
+    xorq %rcx, %rcx
+    testq $8, %rdi              # movntpd needs a 16-byte aligned target
+    jz .collapse_stream_pairs
+    movsd (%rsi), %xmm0
+    movsd %xmm0, (%rdi)
+    incq %rcx
+.collapse_stream_pairs:
+    leaq 1(%rcx), %rax
+    cmpq %rdx, %rax
+    jge .collapse_stream_tail
+    movupd (%rsi, %rcx, 8), %xmm0
+    movntpd %xmm0, (%rdi, %rcx, 8)
+    addq $2, %rcx
+    jmp .collapse_stream_pairs
+.collapse_stream_tail:
+    cmpq %rdx, %rcx
+    jge .collapse_next_tile
+    movsd (%rsi, %rcx, 8), %xmm0
+    movsd %xmm0, (%rdi, %rcx, 8)
+
+.collapse_next_tile:
+    addq matrix_tree_tile_elems(%rip), %r14
+    jmp .collapse_tile_loop
+
+.collapse_fence:
+    testq %r13, %r13
+    jz .collapse_done
+    sfence                      # Make streamed stores globally visible
+
 .collapse_done:
     xorq %rax, %rax
+.collapse_return:
+    addq $24, %rsp
     popq %r15
     popq %r14
     popq %r13
@@ -367,71 +463,255 @@ matrix_tree_collapse:
     popq %rbp
     ret
 
-# Function: matrix_tree_multiply_collapsed
+.collapse_error:
+    movq $-1, %rax
+    jmp .collapse_return
+
+# Function: collapse_accumulate (internal)
+# Adds elements [start, start + len) of every leaf under a node into temp_buffer
+# Args: %rdi = node pointer, %rsi = start element, %rdx = len (<= TILE_ELEMS),
+#       %rcx = whole-leaf add kernel (only when the tile is the whole matrix) or 0
+# Returns: void
+collapse_accumulate:
+    pushq %rbp
+    movq %rsp, %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp               # -48(%rbp): add kernel
+
+    movq %rdi, %rbx             # node
+    movq %rsi, %r12             # start
+    movq %rdx, %r13             # len
+    movq %rcx, -48(%rbp)
+
+    movq (%rbx), %rax
+    cmpq $NODE_TYPE_INTERNAL, %rax
+    je .accumulate_internal
+    cmpq $NODE_TYPE_LEAF, %rax
+    jne .accumulate_structured
+
+    testq %rcx, %rcx
+    jz .accumulate_generic
+    leaq temp_buffer(%rip), %rdi
+    movq 16(%rbx), %rsi
+    call *%rcx
+    jmp .accumulate_done
+
+.accumulate_generic:
+    # Leaf node - temp[i] += data[start + i]
+    movq 16(%rbx), %rsi
+    leaq (%rsi, %r12, 8), %rsi
+    leaq temp_buffer(%rip), %rdi
+    xorq %rcx, %rcx
+.accumulate_pairs:
+    leaq 1(%rcx), %rax
+    cmpq %r13, %rax
+    jge .accumulate_tail
+    movupd (%rdi, %rcx, 8), %xmm0
+    movupd (%rsi, %rcx, 8), %xmm1
+    addpd %xmm1, %xmm0
+    movupd %xmm0, (%rdi, %rcx, 8)
+    addq $2, %rcx
+    jmp .accumulate_pairs
+.accumulate_tail:
+    cmpq %r13, %rcx
+    jge .accumulate_done
+    movsd (%rdi, %rcx, 8), %xmm0
+    addsd (%rsi, %rcx, 8), %xmm0
+    movsd %xmm0, (%rdi, %rcx, 8)
+    jmp .accumulate_done
+
+.accumulate_structured:
+    # Packed/structured leaf - expands its slice of the tile in C
+    movq %rbx, %rdi
+    leaq temp_buffer(%rip), %rsi
+    movq %r12, %rdx
+    movq %r13, %rcx
+    call matrix_tree_structured_accumulate@PLT
+    jmp .accumulate_done
+
+.accumulate_internal:
+    # Internal node - accumulate every child over the same tile
+    movq 16(%rbx), %r14         # children array
+    movq 24(%rbx), %r15         # num_children
+    xorq %rbx, %rbx             # child counter
+.accumulate_children_loop:
+    cmpq %r15, %rbx
+    jge .accumulate_done
+    movq (%r14, %rbx, 8), %rdi
+    movq %r12, %rsi
+    movq %r13, %rdx
+    movq -48(%rbp), %rcx
+    call collapse_accumulate
+    incq %rbx
+    jmp .accumulate_children_loop
+
+.accumulate_done:
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+
+# Function: matrix_tree_asm_multiply_collapsed
 # Multiplies collapsed matrix by vector: y = A*x
+# The collapse is produced tile by tile in temp_buffer and consumed immediately,
+# so trees of any size are supported without a full-size scratch matrix.
 # Args: %rdi = node, %rsi = input vector x, %rdx = output vector y
 # Returns: %rax = 0 on success
-matrix_tree_multiply_collapsed:
+matrix_tree_asm_multiply_collapsed:
     pushq %rbp
     movq %rsp, %rbp
     pushq %rbx
     pushq %r12
     pushq %r13
     pushq %r14
-    
+    pushq %r15
+    subq $24, %rsp              # -48(%rbp): tile length, -56(%rbp): shape kernel
+
     movq %rdi, %rbx             # node
     movq %rsi, %r12             # x vector
     movq %rdx, %r13             # y vector
-    
-    # Collapse tree to temp buffer
-    movq %rbx, %rdi
-    leaq temp_buffer(%rip), %rsi
-    call matrix_tree_collapse
-    
+
+    # Register kernels and load cached tuning on first use
+    cmpq $0, matrix_tree_runtime_ready(%rip)
+    jne .mvcollapse_tuned
+    call matrix_tree_runtime_init@PLT
+.mvcollapse_tuned:
+
     # Get dimensions
     movl 8(%rbx), %eax          # rows
     movl 12(%rbx), %ecx         # cols
-    movl %eax, %r14d            # rows
-    
-    # Perform matrix-vector multiplication
-    xorq %r8, %r8               # row counter
-.mvcollapse_row_loop:
-    cmpl %r14d, %r8d
+    imulq %rcx, %rax
+    movq %rax, %r15             # total elements
+
+    # Single-tile shapes with generated kernels skip the generic loops
+    movq $0, -56(%rbp)
+    cmpq matrix_tree_tile_elems(%rip), %r15
+    ja .mvcollapse_generic
+    movq %rbx, %rdi
+    call find_shape_kernel
+    movq %rax, -56(%rbp)
+    testq %rax, %rax
+    jz .mvcollapse_generic
+
+    leaq temp_buffer(%rip), %rdi
+    xorq %rsi, %rsi
+    movq %r15, %rdx
+    shlq $3, %rdx
+    call memset@PLT
+
+    movq %rbx, %rdi
+    xorq %rsi, %rsi
+    movq %r15, %rdx
+    movq -56(%rbp), %rax
+    movq 8(%rax), %rcx          # add kernel
+    call collapse_accumulate
+
+    leaq temp_buffer(%rip), %rdi
+    movq %r12, %rsi
+    movq %r13, %rdx
+    movq -56(%rbp), %rax
+    call *16(%rax)              # gemv kernel
+    jmp .mvcollapse_done
+
+.mvcollapse_generic:
+    # Zero y; rows are accumulated across tile boundaries
+    movq %r13, %rdi
+    xorq %rsi, %rsi
+    movl 8(%rbx), %edx
+    shlq $3, %rdx
+    call memset@PLT
+
+    xorq %r14, %r14             # tile start (element index)
+.mvcollapse_tile_loop:
+    cmpq %r15, %r14
     jge .mvcollapse_done
-    
-    # Compute dot product for this row
+
+    # Tile length = min(tile_elems, total - start)
+    movq %r15, %rax
+    subq %r14, %rax
+    movq matrix_tree_tile_elems(%rip), %rcx
+    cmpq %rcx, %rax
+    cmova %rcx, %rax
+    movq %rax, -48(%rbp)
+
+    # Collapse this tile into temp_buffer
+    leaq temp_buffer(%rip), %rdi
+    xorq %rsi, %rsi
+    movq %rax, %rdx
+    shlq $3, %rdx
+    call memset@PLT
+
+    movq %rbx, %rdi
+    movq %r14, %rsi
+    movq -48(%rbp), %rdx
+    xorq %rcx, %rcx
+    call collapse_accumulate
+
+    # Locate the tile start: %r8 = row, %r9 = col
+    movl 12(%rbx), %ecx         # cols
+    movq %r14, %rax
+    xorq %rdx, %rdx
+    divq %rcx
+    movq %rax, %r8
+    movq %rdx, %r9
+
+    leaq temp_buffer(%rip), %r10
+    xorq %r11, %r11             # element within tile
+    movq -48(%rbp), %rsi        # tile length
+
+    # Perform matrix-vector multiplication over the tile
+.mvcollapse_row_loop:
+    # Partial dot product for the current row
     xorpd %xmm0, %xmm0          # accumulator
-    xorq %r9, %r9               # col counter
-    
+
 .mvcollapse_col_loop:
-    cmpl %ecx, %r9d
-    jge .mvcollapse_store
-    
-    # Compute offset: row * cols + col
-    movq %r8, %rax
-    imulq %rcx, %rax
-    addq %r9, %rax
-    
+    cmpq %rsi, %r11
+    jge .mvcollapse_flush
+
     # Load matrix element and vector element
-    leaq temp_buffer(%rip), %r10
-    movsd (%r10, %rax, 8), %xmm1
+    movsd (%r10, %r11, 8), %xmm1
     movsd (%r12, %r9, 8), %xmm2
-    
+
     # Multiply and accumulate
     mulsd %xmm2, %xmm1
     addsd %xmm1, %xmm0
-    
+
+    incq %r11
     incq %r9
-    jmp .mvcollapse_col_loop
-    
+    cmpq %rcx, %r9
+    jl .mvcollapse_col_loop
+
 .mvcollapse_store:
-    # Store result
+    # Row complete - add to y[row]
+    addsd (%r13, %r8, 8), %xmm0
     movsd %xmm0, (%r13, %r8, 8)
     incq %r8
+    xorq %r9, %r9
     jmp .mvcollapse_row_loop
-    
+
+.mvcollapse_flush:
+    # Tile ended mid-row - carry the partial sum into y[row]
+    testq %r9, %r9
+    jz .mvcollapse_next_tile
+    addsd (%r13, %r8, 8), %xmm0
+    movsd %xmm0, (%r13, %r8, 8)
+
+.mvcollapse_next_tile:
+    addq matrix_tree_tile_elems(%rip), %r14
+    jmp .mvcollapse_tile_loop
+
 .mvcollapse_done:
     xorq %rax, %rax
+    addq $24, %rsp
+    popq %r15
     popq %r14
     popq %r13
     popq %r12
@@ -439,11 +719,34 @@ matrix_tree_multiply_collapsed:
     popq %rbp
     ret
 
-# Function: matrix_tree_scale
+# Function: find_shape_kernel (internal)
+# Looks up the registered generated kernel for a node's shape
+# Args: %rdi = node pointer
+# Returns: %rax = matrix_tree_shape_kernels entry, or 0 if none
+find_shape_kernel:
+    movq 8(%rdi), %rax          # rows | cols << 32
+    leaq matrix_tree_shape_kernels(%rip), %rcx
+    movq matrix_tree_shape_kernel_count(%rip), %rdx
+.find_kernel_loop:
+    testq %rdx, %rdx
+    jz .find_kernel_none
+    cmpq (%rcx), %rax
+    je .find_kernel_found
+    addq $SHAPE_KERNEL_SIZE, %rcx
+    decq %rdx
+    jmp .find_kernel_loop
+.find_kernel_found:
+    movq %rcx, %rax
+    ret
+.find_kernel_none:
+    xorq %rax, %rax
+    ret
+
+# Function: matrix_tree_asm_scale
 # Scales a matrix tree by a scalar: A' = s * A
 # Args: %rdi = node, %xmm0 = scalar
 # Returns: void
-matrix_tree_scale:
+matrix_tree_asm_scale:
     pushq %rbp
     movq %rsp, %rbp
     pushq %rbx
@@ -452,12 +755,14 @@ matrix_tree_scale:
     subq $16, %rsp              # Allocate space for scalar (16-byte aligned)
     
     movq %rdi, %rbx
-    movsd %xmm0, -8(%rbp)       # Save scalar on stack
+    movsd %xmm0, -32(%rbp)      # Save scalar below the saved registers
     
     # Check node type
     movq (%rbx), %rax
     testq %rax, %rax
     jz .scale_leaf
+    cmpq $NODE_TYPE_INTERNAL, %rax
+    jne .scale_structured
     
     # Internal node - scale all children
     movq 16(%rbx), %r12         # children
@@ -469,9 +774,9 @@ matrix_tree_scale:
     jge .scale_done
     
     movq (%r12, %rcx, 8), %rdi
-    movsd -8(%rbp), %xmm0
+    movsd -32(%rbp), %xmm0
     pushq %rcx
-    call matrix_tree_scale
+    call matrix_tree_asm_scale
     popq %rcx
     
     incq %rcx
@@ -486,7 +791,19 @@ matrix_tree_scale:
     
     movq 16(%rbx), %r13         # data
     xorq %rcx, %rcx
-    movsd -8(%rbp), %xmm15      # Load scalar
+    movsd -32(%rbp), %xmm15      # Load scalar
+    jmp .scale_loop
+
+.scale_structured:
+    # Structured leaf - scale just the stored elements
+    subq $8, %rsp               # Keep the call 16-byte aligned
+    movq %rbx, %rdi
+    call matrix_tree_leaf_elems@PLT
+    addq $8, %rsp
+    movq %rax, %r12
+    movq 16(%rbx), %r13
+    xorq %rcx, %rcx
+    movsd -32(%rbp), %xmm15
     
 .scale_loop:
     cmpq %r12, %rcx
@@ -0,0 +1,282 @@
+// Matrix-Tree structural optimization
+// Rewrites a tree in place into a cheaper shape with the same sum. Every
+// internal node is a plain sum of its children, so nested sums can be spliced
+// into their parent, sibling leaves of one kind can be added into a single
+// leaf, and wide sums can be regrouped into balanced fan-out trees, without
+// changing the matrix (up to floating-point reassociation).
+//
+// A node may be shared, reached from several children arrays. Each node's
+// incoming references are counted first: a shared sum is never spliced away,
+// a shared leaf is never added into, and a merged-away leaf is only freed
+// once its last reference is gone. Frozen leaves and the auto-freeze root are
+// left in place for the same reason: the freeze tables point at them.
+
+#include "matrix_tree_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct OptimizeRef {
+    const MatrixTreeNode* node;
+    uint64_t refs;              // Children-array slots pointing at node
+    int counted;                // Children already counted
+    int optimized;              // Subtree already optimized
+} OptimizeRef;
+
+// Open-addressed table keyed by node address
+typedef struct OptimizeRefs {
+    OptimizeRef* slots;
+    size_t mask;
+    size_t count;
+} OptimizeRefs;
+
+static size_t refs_hash(const MatrixTreeNode* node, size_t mask) {
+    return (size_t)(((uint64_t)(uintptr_t)node * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static OptimizeRef* refs_probe(OptimizeRef* slots, size_t mask, const MatrixTreeNode* node) {
+    size_t i = refs_hash(node, mask);
+    while (slots[i].node && slots[i].node != node) i = (i + 1) & mask;
+    return &slots[i];
+}
+
+// The entry for node, added if new; NULL when out of memory
+static OptimizeRef* refs_get(OptimizeRefs* refs, const MatrixTreeNode* node) {
+    OptimizeRef* ref = refs->slots ? refs_probe(refs->slots, refs->mask, node) : NULL;
+    if (ref && ref->node) return ref;
+
+    if (2 * (refs->count + 1) > refs->mask + 1) {
+        size_t capacity = refs->mask ? 2 * (refs->mask + 1) : 64;
+        OptimizeRef* slots = calloc(capacity, sizeof(OptimizeRef));
+        if (!slots) return NULL;
+        for (size_t i = 0; refs->mask && i <= refs->mask; i++) {
+            if (refs->slots[i].node) *refs_probe(slots, capacity - 1, refs->slots[i].node) = refs->slots[i];
+        }
+        free(refs->slots);
+        refs->slots = slots;
+        refs->mask = capacity - 1;
+        ref = refs_probe(slots, refs->mask, node);
+    }
+    ref->node = node;
+    refs->count++;
+    return ref;
+}
+
+// Counts every children-array slot below node, each sum's children once
+static int refs_count(OptimizeRefs* refs, const MatrixTreeNode* node) {
+    OptimizeRef* ref = refs_get(refs, node);
+    if (!ref) return -1;
+    if (ref->counted || node->node_type != NODE_TYPE_INTERNAL) return 0;
+    ref->counted = 1;
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        OptimizeRef* child = refs_get(refs, children[i]);
+        if (!child) return -1;
+        child->refs++;
+        if (refs_count(refs, children[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+// A sum spliced into its parent: referenced there only, and not watched by
+// auto freezing
+static int optimize_splices(OptimizeRefs* refs, const MatrixTreeNode* child) {
+    return child->node_type == NODE_TYPE_INTERNAL && refs_get(refs, child)->refs == 1 &&
+           !matrix_tree_freeze_pinned(child);
+}
+
+static uint64_t optimize_local(MatrixTreeNode** children, uint64_t count, const MatrixTreeNode* node) {
+    uint64_t local = 0;
+    for (uint64_t i = 0; i < count; i++) local += children[i] == node;
+    return local;
+}
+
+// Leaves whose stored values add elementwise into one leaf
+static int optimize_same_kind(const MatrixTreeNode* a, const MatrixTreeNode* b) {
+    if (a->node_type != b->node_type || a->node_type == NODE_TYPE_INTERNAL) return 0;
+    return a->node_type != NODE_TYPE_BANDED || a->num_children == b->num_children;
+}
+
+// Splices internal children (already flat) into node; empty sums vanish.
+// A sum with other references stays a child.
+static int optimize_flatten(MatrixTreeNode* node, OptimizeRefs* refs) {
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    uint64_t count = 0;
+    int nested = 0;
+
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        if (optimize_splices(refs, children[i])) {
+            count += children[i]->num_children;
+            nested = 1;
+        } else {
+            count++;
+        }
+    }
+    if (!nested) return 0;
+
+    MatrixTreeNode** list = matrix_tree_children_alloc(count);
+    if (!list) return -1;
+
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        MatrixTreeNode* child = children[i];
+        if (!optimize_splices(refs, child)) {
+            list[n++] = child;
+            continue;
+        }
+        if (child->num_children) {
+            memcpy(list + n, child->data_ptr, child->num_children * sizeof(MatrixTreeNode*));
+            n += child->num_children;
+        }
+        refs_get(refs, child)->refs = 0;
+        matrix_tree_children_free((MatrixTreeNode**)child->data_ptr, child->num_children);
+        matrix_tree_node_free(child);
+    }
+
+    matrix_tree_children_free(children, node->num_children);
+    node->data_ptr = list;
+    node->num_children = n;
+    return 0;
+}
+
+#define MERGE_KEEP   UINT64_MAX          // Stays a child as it is
+#define MERGE_TARGET (UINT64_MAX - 1)    // Stays, and absorbs later leaves of its kind
+#define MERGE_REPEAT (UINT64_MAX - 2)    // Another slot of a target, folded in by scaling
+
+// Adds each leaf into the first sibling leaf of its kind that node alone
+// references (the target). Frozen leaves, whose kept originals must match
+// their values, neither absorb nor are absorbed. Repeats of a target scale it instead of adding it
+// into itself. The survivors move to a children array of their own length,
+// planned before anything is merged so a failed allocation leaves the node as
+// it was.
+static int optimize_merge_leaves(MatrixTreeNode* node, OptimizeRefs* refs) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    uint64_t total = node->num_children, kinds = 0;
+
+    // plan[i]: a MERGE_* mark, or the slot of the target absorbing slot i
+    uint64_t* plan = matrix_tree_workspace(MATRIX_TREE_WS_SCRATCH, (total ? total : 1) * sizeof(uint64_t));
+    if (!plan) return -1;
+    for (uint64_t i = 0; i < total; i++) {
+        MatrixTreeNode* child = children[i];
+        plan[i] = MERGE_KEEP;
+        if (child->node_type == NODE_TYPE_INTERNAL || matrix_tree_freeze_pinned(child)) {
+            kinds++;
+            continue;
+        }
+
+        uint64_t j = 0;
+        while (j < i && !(plan[j] == MERGE_TARGET && optimize_same_kind(children[j], child))) j++;
+        if (j < i) {
+            plan[i] = children[j] == child ? MERGE_REPEAT : j;
+            continue;
+        }
+        kinds++;
+        if (refs_get(refs, child)->refs == optimize_local(children, total, child)) plan[i] = MERGE_TARGET;
+    }
+    if (kinds == total) return 0;
+
+    MatrixTreeNode** kept = matrix_tree_children_alloc(kinds);
+    if (!kept) return -1;
+
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < total; i++) {
+        MatrixTreeNode* child = children[i];
+        OptimizeRef* ref = refs_get(refs, child);
+        size_t elems = (size_t)matrix_tree_leaf_elems(child);
+
+        if (plan[i] == MERGE_KEEP || plan[i] == MERGE_TARGET) {
+            kept[n++] = child;
+            uint64_t repeats = plan[i] == MERGE_TARGET ? optimize_local(children, total, child) : 1;
+            if (repeats > 1) {
+                k->scale((double*)child->data_ptr, (double)repeats, elems);
+                ref->refs -= repeats - 1;
+            }
+            continue;
+        }
+        if (plan[i] == MERGE_REPEAT) continue;
+
+        k->add((double*)children[plan[i]]->data_ptr, (const double*)child->data_ptr, elems);
+        if (--ref->refs == 0) {
+            free(child->data_ptr);
+            matrix_tree_node_free(child);
+        }
+    }
+
+    matrix_tree_children_free(children, total);
+    node->data_ptr = kept;
+    node->num_children = n;
+    return 0;
+}
+
+// Groups children under new internal nodes, MATRIX_TREE_OPTIMIZE_FANOUT at a
+// time, until node itself has at most that many
+static int optimize_rebalance(MatrixTreeNode* node) {
+    const uint64_t f = MATRIX_TREE_OPTIMIZE_FANOUT;
+
+    while (node->num_children > f) {
+        MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+        uint64_t groups = (node->num_children + f - 1) / f;
+        MatrixTreeNode** list = matrix_tree_children_alloc(groups);
+        if (!list) return -1;
+
+        for (uint64_t g = 0; g < groups; g++) {
+            uint64_t first = g * f;
+            uint64_t count = node->num_children - first < f ? node->num_children - first : f;
+            list[g] = matrix_tree_c_create(node->rows, node->cols, NODE_TYPE_INTERNAL);
+            if (!list[g] || matrix_tree_c_set_internal(list[g], children + first, count) != 0) {
+                // Undo the groups built so far; their children still belong to node
+                for (uint64_t u = 0; u <= g && list[u]; u++) {
+                    matrix_tree_children_free((MatrixTreeNode**)list[u]->data_ptr, list[u]->num_children);
+                    matrix_tree_node_free(list[u]);
+                }
+                matrix_tree_children_free(list, groups);
+                return -1;
+            }
+        }
+
+        matrix_tree_children_free(children, node->num_children);
+        node->data_ptr = list;
+        node->num_children = groups;
+    }
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        if (children[i]->node_type == NODE_TYPE_INTERNAL && optimize_rebalance(children[i]) != 0) return -1;
+    }
+    return 0;
+}
+
+// Post-order: children are flat and merged before their parent splices
+// them; a shared sum is optimized once
+static int optimize_node(MatrixTreeNode* node, uint32_t policy, OptimizeRefs* refs) {
+    if (node->node_type != NODE_TYPE_INTERNAL) return 0;
+    OptimizeRef* ref = refs_get(refs, node);
+    if (ref->optimized) return 0;
+    ref->optimized = 1;
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        if (optimize_node(children[i], policy, refs) != 0) return -1;
+    }
+
+    if ((policy & MATRIX_TREE_OPTIMIZE_FLATTEN) && optimize_flatten(node, refs) != 0) return -1;
+    if ((policy & MATRIX_TREE_OPTIMIZE_MERGE_LEAVES) && optimize_merge_leaves(node, refs) != 0) return -1;
+    return 0;
+}
+
+int matrix_tree_optimize(MatrixTreeNode* root, uint32_t policy) {
+    if (!root) return -1;
+    if (root->node_type != NODE_TYPE_INTERNAL) return 0;
+
+    // Chains only balance once their sums are spliced into one wide node
+    if (policy & MATRIX_TREE_OPTIMIZE_REBALANCE) policy |= MATRIX_TREE_OPTIMIZE_FLATTEN;
+
+    // Every node is in the table before any is freed, so lookups never add
+    OptimizeRefs refs = { NULL, 0, 0 };
+    int result = refs_count(&refs, root) == 0 && optimize_node(root, policy, &refs) == 0 ? 0 : -1;
+    free(refs.slots);
+    if (result != 0) return -1;
+    if (policy & MATRIX_TREE_OPTIMIZE_REBALANCE) return optimize_rebalance(root);
+    return 0;
+}
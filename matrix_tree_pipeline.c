@@ -0,0 +1,203 @@
+// Matrix-Tree streaming pipeline
+// A producer pushes x vectors into an input ring; a compute thread takes
+// whatever has arrived (up to max_batch) as one micro-batch, multiplies it
+// against the tree's cached collapse and publishes the y vectors, in order,
+// into an output ring for the consumer. Push blocks while the input ring is
+// full and the compute thread waits while the output ring is full, so a slow
+// consumer throttles the producer. Slots being computed stay owned by the
+// compute thread, letting producer, compute and consumer overlap.
+//
+// Any number of threads may push and pop. Each call reserves its slot under
+// the lock, copies without it, and then publishes in reservation order, so a
+// slot is never handed out twice and vectors keep their reserved order.
+
+#include "matrix_tree_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Rows of A evaluated against the whole batch before moving on, so each
+// block of A is reused from cache by every vector
+#define PIPELINE_ROW_BLOCK 16
+
+struct MatrixTreePipeline {
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t capacity;          // Slots per ring
+    uint32_t max_batch;
+    double* a;                  // Cached collapse, row-major
+    double* in;                 // capacity x cols
+    double* out;                // capacity x rows
+
+    mtx_t lock;
+    cnd_t can_push;
+    cnd_t can_compute;
+    cnd_t can_pop;
+    thrd_t worker;
+
+    uint64_t in_reserved;       // Next slot a producer claims
+    uint64_t in_head;           // Slots before this are filled
+    uint64_t in_tail;           // Next slot the compute thread takes
+    uint64_t out_head;          // Next slot the compute thread fills
+    uint64_t out_reserved;      // Next slot a consumer claims
+    uint64_t out_tail;          // Slots before this are read
+    int closed;
+    int worker_done;
+};
+
+// y[v] = A x[v] for `count` ring slots starting at `first`
+static void pipeline_compute(MatrixTreePipeline* p, uint64_t first_in, uint64_t first_out, uint32_t count) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+
+    for (uint32_t r0 = 0; r0 < p->rows; r0 += PIPELINE_ROW_BLOCK) {
+        uint32_t r1 = r0 + PIPELINE_ROW_BLOCK < p->rows ? r0 + PIPELINE_ROW_BLOCK : p->rows;
+        for (uint32_t v = 0; v < count; v++) {
+            const double* x = p->in + ((first_in + v) % p->capacity) * p->cols;
+            double* y = p->out + ((first_out + v) % p->capacity) * p->rows;
+            for (uint32_t r = r0; r < r1; r++) y[r] = k->dot(p->a + (size_t)r * p->cols, x, p->cols);
+        }
+    }
+}
+
+static int pipeline_worker(void* arg) {
+    MatrixTreePipeline* p = arg;
+
+    mtx_lock(&p->lock);
+    for (;;) {
+        uint64_t ready = p->in_head - p->in_tail;
+        uint64_t room = p->capacity - (p->out_head - p->out_tail);
+        if (ready == 0 && p->closed && p->in_reserved == p->in_head) break;
+        if (ready == 0 || room == 0) {
+            cnd_wait(&p->can_compute, &p->lock);
+            continue;
+        }
+
+        uint32_t count = (uint32_t)(ready < room ? ready : room);
+        if (count > p->max_batch) count = p->max_batch;
+        uint64_t first_in = p->in_tail, first_out = p->out_head;
+
+        mtx_unlock(&p->lock);
+        pipeline_compute(p, first_in, first_out, count);
+        mtx_lock(&p->lock);
+
+        p->in_tail += count;
+        p->out_head += count;
+        cnd_broadcast(&p->can_push);
+        cnd_broadcast(&p->can_pop);
+    }
+    p->worker_done = 1;
+    cnd_broadcast(&p->can_pop);
+    mtx_unlock(&p->lock);
+    return 0;
+}
+
+MatrixTreePipeline* matrix_tree_pipeline_create(MatrixTreeNode* root, uint32_t capacity, uint32_t max_batch) {
+    if (!root || capacity == 0 || max_batch == 0) return NULL;
+
+    MatrixTreePipeline* p = calloc(1, sizeof(MatrixTreePipeline));
+    if (!p) return NULL;
+
+    p->rows = root->rows;
+    p->cols = root->cols;
+    p->capacity = capacity;
+    p->max_batch = max_batch < capacity ? max_batch : capacity;
+    p->a = malloc((size_t)p->rows * p->cols * sizeof(double));
+    p->in = malloc((size_t)capacity * p->cols * sizeof(double));
+    p->out = malloc((size_t)capacity * p->rows * sizeof(double));
+    if (!p->a || !p->in || !p->out || matrix_tree_collapse(root, p->a) != 0) goto fail;
+
+    if (mtx_init(&p->lock, mtx_plain) != thrd_success) goto fail;
+    cnd_init(&p->can_push);
+    cnd_init(&p->can_compute);
+    cnd_init(&p->can_pop);
+    if (thrd_create(&p->worker, pipeline_worker, p) != thrd_success) {
+        cnd_destroy(&p->can_push);
+        cnd_destroy(&p->can_compute);
+        cnd_destroy(&p->can_pop);
+        mtx_destroy(&p->lock);
+        goto fail;
+    }
+    return p;
+
+fail:
+    free(p->a);
+    free(p->in);
+    free(p->out);
+    free(p);
+    return NULL;
+}
+
+int matrix_tree_pipeline_push(MatrixTreePipeline* p, const double* x) {
+    mtx_lock(&p->lock);
+    while (!p->closed && p->in_reserved - p->in_tail == p->capacity) cnd_wait(&p->can_push, &p->lock);
+    if (p->closed) {
+        mtx_unlock(&p->lock);
+        return -1;
+    }
+    uint64_t ticket = p->in_reserved++;
+    mtx_unlock(&p->lock);
+
+    // The reserved slot is this producer's alone until it is published
+    memcpy(p->in + (ticket % p->capacity) * p->cols, x, p->cols * sizeof(double));
+
+    mtx_lock(&p->lock);
+    while (p->in_head != ticket) cnd_wait(&p->can_push, &p->lock);
+    p->in_head++;
+    cnd_broadcast(&p->can_push);
+    cnd_signal(&p->can_compute);
+    mtx_unlock(&p->lock);
+    return 0;
+}
+
+int matrix_tree_pipeline_pop(MatrixTreePipeline* p, double* y) {
+    mtx_lock(&p->lock);
+    while (p->out_head == p->out_reserved && !p->worker_done) cnd_wait(&p->can_pop, &p->lock);
+    if (p->out_head == p->out_reserved) {
+        mtx_unlock(&p->lock);
+        return -1;
+    }
+    uint64_t ticket = p->out_reserved++;
+    mtx_unlock(&p->lock);
+
+    memcpy(y, p->out + (ticket % p->capacity) * p->rows, p->rows * sizeof(double));
+
+    mtx_lock(&p->lock);
+    while (p->out_tail != ticket) cnd_wait(&p->can_pop, &p->lock);
+    p->out_tail++;
+    cnd_broadcast(&p->can_pop);
+    cnd_signal(&p->can_compute);
+    mtx_unlock(&p->lock);
+    return 0;
+}
+
+void matrix_tree_pipeline_close(MatrixTreePipeline* p) {
+    mtx_lock(&p->lock);
+    p->closed = 1;
+    cnd_broadcast(&p->can_push);
+    cnd_broadcast(&p->can_compute);
+    mtx_unlock(&p->lock);
+}
+
+void matrix_tree_pipeline_destroy(MatrixTreePipeline* p) {
+    if (!p) return;
+
+    // Results nobody will pop must not keep the worker waiting for room
+    matrix_tree_pipeline_close(p);
+    mtx_lock(&p->lock);
+    while (!p->worker_done) {
+        p->out_reserved = p->out_tail = p->out_head;
+        cnd_broadcast(&p->can_compute);
+        cnd_wait(&p->can_pop, &p->lock);
+    }
+    mtx_unlock(&p->lock);
+    thrd_join(p->worker, NULL);
+
+    cnd_destroy(&p->can_push);
+    cnd_destroy(&p->can_compute);
+    cnd_destroy(&p->can_pop);
+    mtx_destroy(&p->lock);
+    free(p->a);
+    free(p->in);
+    free(p->out);
+    free(p);
+}
@@ -0,0 +1,196 @@
+// Matrix-Tree node and children-array pools
+// Nodes (32 bytes) and child pointer arrays come from size-class slabs instead
+// of malloc. Each thread allocates from its own cache of free lists without
+// locking. A slab is aligned to its size, so a block's slab header (size
+// class, owning cache) is found by masking the pointer. A block freed by
+// another thread is pushed onto its owner's remote stack with a lock-free
+// CAS, and the owner takes the whole stack back in one exchange when a list
+// runs dry. When a thread exits, its cache (and every block it owns) is
+// parked for the next new thread to adopt. Slabs are kept for reuse rather
+// than returned to the system. Arrays larger than the biggest class, and every
+// allocation when built with MATRIX_TREE_USE_POOL=OFF, use malloc.
+
+#include "matrix_tree_internal.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#define POOL_SLAB_SIZE  65536       // Slab bytes, also its alignment
+#define POOL_HEADER     64          // Slab header; blocks follow
+#define POOL_MIN_SHIFT  5           // Smallest class: 32 bytes, one node
+#define POOL_CLASSES    8           // 32 .. 4096 bytes (up to 512 children)
+#define POOL_MAX_BYTES  ((size_t)1 << (POOL_MIN_SHIFT + POOL_CLASSES - 1))
+
+#ifndef MATRIX_TREE_NO_POOL
+
+typedef struct PoolCache PoolCache;
+
+typedef struct PoolSlab {
+    PoolCache* owner;
+    uint32_t cls;
+} PoolSlab;
+
+struct PoolCache {
+    void* free[POOL_CLASSES];       // Owner-only free lists, linked through the blocks
+    _Atomic(void*) remote;          // Blocks freed by other threads
+    PoolCache* next_orphan;
+};
+
+static _Thread_local PoolCache* pool_cache;
+static PoolCache* pool_orphans;     // Caches of exited threads, under pool_lock
+static mtx_t pool_lock;
+static tss_t pool_key;
+static int pool_key_ready;
+static once_flag pool_once = ONCE_FLAG_INIT;
+
+static void pool_thread_exit(void* cache) {
+    mtx_lock(&pool_lock);
+    ((PoolCache*)cache)->next_orphan = pool_orphans;
+    pool_orphans = cache;
+    mtx_unlock(&pool_lock);
+}
+
+static void pool_init(void) {
+    mtx_init(&pool_lock, mtx_plain);
+    pool_key_ready = tss_create(&pool_key, pool_thread_exit) == thrd_success;
+}
+
+// First allocation on a thread: adopt a parked cache or make one
+static PoolCache* pool_thread_cache(void) {
+    call_once(&pool_once, pool_init);
+
+    mtx_lock(&pool_lock);
+    PoolCache* cache = pool_orphans;
+    if (cache) pool_orphans = cache->next_orphan;
+    mtx_unlock(&pool_lock);
+
+    if (!cache) {
+        cache = calloc(1, sizeof(PoolCache));
+        if (!cache) return NULL;
+        atomic_init(&cache->remote, NULL);
+    }
+    if (pool_key_ready) tss_set(pool_key, cache);
+    pool_cache = cache;
+    return cache;
+}
+
+static uint32_t pool_class(size_t bytes) {
+    uint32_t cls = 0;
+    while (((size_t)1 << (POOL_MIN_SHIFT + cls)) < bytes) cls++;
+    return cls;
+}
+
+static PoolSlab* pool_slab_of(void* block) {
+    return (PoolSlab*)((uintptr_t)block & ~(uintptr_t)(POOL_SLAB_SIZE - 1));
+}
+
+static PoolSlab* pool_slab_alloc(void) {
+#ifdef _WIN32
+    return _aligned_malloc(POOL_SLAB_SIZE, POOL_SLAB_SIZE);
+#else
+    return aligned_alloc(POOL_SLAB_SIZE, POOL_SLAB_SIZE);
+#endif
+}
+
+// Refills a free list from the remote stack, else from a new slab
+static int pool_refill(PoolCache* cache, uint32_t cls) {
+    void* block = atomic_exchange_explicit(&cache->remote, NULL, memory_order_acquire);
+    while (block) {
+        void* next = *(void**)block;
+        uint32_t c = pool_slab_of(block)->cls;
+        *(void**)block = cache->free[c];
+        cache->free[c] = block;
+        block = next;
+    }
+    if (cache->free[cls]) return 0;
+
+    PoolSlab* slab = pool_slab_alloc();
+    if (!slab) return -1;
+    slab->owner = cache;
+    slab->cls = cls;
+
+    size_t size = (size_t)1 << (POOL_MIN_SHIFT + cls);
+    char* first = (char*)slab + POOL_HEADER;
+    for (size_t i = (POOL_SLAB_SIZE - POOL_HEADER) / size; i-- > 0;) {
+        *(void**)(first + i * size) = cache->free[cls];
+        cache->free[cls] = first + i * size;
+    }
+    return 0;
+}
+
+static void* pool_alloc(size_t bytes) {
+    if (bytes > POOL_MAX_BYTES) return malloc(bytes);
+
+    PoolCache* cache = pool_cache ? pool_cache : pool_thread_cache();
+    if (!cache) return NULL;
+
+    uint32_t cls = pool_class(bytes);
+    if (!cache->free[cls] && pool_refill(cache, cls) != 0) return NULL;
+    void* block = cache->free[cls];
+    cache->free[cls] = *(void**)block;
+    return block;
+}
+
+static void pool_free(void* block, size_t bytes) {
+    if (!block) return;
+    if (bytes > POOL_MAX_BYTES) {
+        free(block);
+        return;
+    }
+
+    PoolSlab* slab = pool_slab_of(block);
+    PoolCache* owner = slab->owner;
+    if (owner == pool_cache) {
+        *(void**)block = owner->free[slab->cls];
+        owner->free[slab->cls] = block;
+        return;
+    }
+
+    void* head = atomic_load_explicit(&owner->remote, memory_order_relaxed);
+    do {
+        *(void**)block = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->remote, &head, block, memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+#else
+
+static void* pool_alloc(size_t bytes) {
+    return malloc(bytes ? bytes : 1);
+}
+
+static void pool_free(void* block, size_t bytes) {
+    (void)bytes;
+    free(block);
+}
+
+#endif // MATRIX_TREE_NO_POOL
+
+MatrixTreeNode* matrix_tree_node_alloc(void) {
+    return pool_alloc(sizeof(MatrixTreeNode));
+}
+
+void matrix_tree_node_free(MatrixTreeNode* node) {
+    pool_free(node, sizeof(MatrixTreeNode));
+}
+
+MatrixTreeNode** matrix_tree_children_alloc(uint64_t count) {
+    return pool_alloc((size_t)count * sizeof(MatrixTreeNode*));
+}
+
+void matrix_tree_children_free(MatrixTreeNode** children, uint64_t count) {
+    pool_free(children, (size_t)count * sizeof(MatrixTreeNode*));
+}
+
+void matrix_tree_destroy_shallow(MatrixTreeNode* node) {
+    if (!node) return;
+    if (node->node_type == NODE_TYPE_INTERNAL) {
+        matrix_tree_children_free((MatrixTreeNode**)node->data_ptr, node->num_children);
+    } else {
+        free(node->data_ptr);
+    }
+    matrix_tree_node_free(node);
+}
@@ -0,0 +1,61 @@
+// Matrix-Tree reductions
+// Sum and trace are linear, so they are taken leaf by leaf and added up the
+// tree without touching a full-size buffer; trace reads only diagonals. The
+// Frobenius norm is not linear: it streams the collapse through the C tile and
+// squares each tile in cache.
+
+#include "matrix_tree_internal.h"
+#include <math.h>
+
+// Either of sum and trace may be NULL
+static void reduce_linear(const MatrixTreeNode* node, double* sum, double* trace) {
+    if (node->node_type == NODE_TYPE_INTERNAL) {
+        MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+        for (uint64_t i = 0; i < node->num_children; i++) reduce_linear(children[i], sum, trace);
+        return;
+    }
+    if (node->node_type != NODE_TYPE_LEAF) {
+        matrix_tree_structured_sums(node, sum, trace);
+        return;
+    }
+
+    const double* data = (const double*)node->data_ptr;
+    size_t rows = node->rows, cols = node->cols;
+    size_t diag = rows < cols ? rows : cols;
+    if (sum) *sum += matrix_tree_c_bound_kernels()->sum(data, rows * cols);
+    if (trace) {
+        for (size_t i = 0; i < diag; i++) *trace += data[i * cols + i];
+    }
+}
+
+int matrix_tree_sum(MatrixTreeNode* node, double* result) {
+    if (!node || !result) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    double sum = 0.0;
+    reduce_linear(node, &sum, NULL);
+    *result = sum;
+    return 0;
+}
+
+// Non-square trees sum the min(rows, cols) leading diagonal entries
+int matrix_tree_trace(MatrixTreeNode* node, double* result) {
+    if (!node || !result) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    double trace = 0.0;
+    reduce_linear(node, NULL, &trace);
+    *result = trace;
+    return 0;
+}
+
+int matrix_tree_frobenius_norm(MatrixTreeNode* node, double* result) {
+    if (!node || !result) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    matrix_tree_freeze_evaluated(node);
+    double squares;
+    if (matrix_tree_c_sum_squares(node, &squares) != 0) return -1;
+    *result = sqrt(squares);
+    return 0;
+}
@@ -0,0 +1,449 @@
+// Matrix-Tree evaluation server
+// Keeps published (shared-memory) trees attached and answers multiply
+// requests over a Unix domain socket. Requests that arrive within one batch
+// window are coalesced per tree into a single matrix_tree_multiply_batch
+// call, so concurrent callers share one collapse pass. Client sockets are
+// non-blocking: a reply that does not fit the socket waits in that client's
+// output buffer, so a client that stops reading holds up only itself.
+//
+// Wire format (host byte order, same host only):
+//   request: ServerRequest | tree name | count doubles (x)
+//   reply:   ServerReply | count doubles (y)
+
+#include "matrix_tree_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#define SERVER_MAGIC 0x5254534du        // "MSTR"
+#define SERVER_OP_MULTIPLY 1
+#define SERVER_OP_SHUTDOWN 2
+#define SERVER_NAME_MAX 255
+#define SERVER_MAX_COUNT (1u << 24)
+#define SERVER_MAX_CLIENTS 256
+#define SERVER_MAX_TREES 32
+#define SERVER_MAX_BATCH 64
+
+typedef struct ServerRequest {
+    uint32_t magic;
+    uint32_t op;
+    uint32_t name_len;
+    uint32_t count;             // Doubles of x that follow the name
+} ServerRequest;
+
+typedef struct ServerReply {
+    int32_t status;             // 0 = ok, -1 = failed
+    uint32_t count;             // Doubles of y that follow
+} ServerReply;
+
+#ifdef _WIN32
+
+int matrix_tree_serve(const char* socket_path, uint32_t batch_window_us, MatrixTreeServeStats* stats) {
+    (void)socket_path;
+    (void)batch_window_us;
+    (void)stats;
+    return -1;
+}
+
+int matrix_tree_remote_multiply(const char* socket_path, const char* tree_name,
+                                const double* x, uint32_t cols, double* y, uint32_t rows) {
+    (void)socket_path;
+    (void)tree_name;
+    (void)x;
+    (void)cols;
+    (void)y;
+    (void)rows;
+    return -1;
+}
+
+int matrix_tree_remote_shutdown(const char* socket_path) {
+    (void)socket_path;
+    return -1;
+}
+
+#else
+
+#ifdef MSG_NOSIGNAL
+#define SERVER_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SERVER_SEND_FLAGS 0
+#endif
+
+static int io_write(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, SERVER_SEND_FLAGS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int io_read(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int socket_address(const char* path, struct sockaddr_un* addr) {
+    if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec * 1e-3;
+}
+
+// ---------------------------------------------------------------------------
+// Server state
+
+typedef struct ServerClient {
+    int fd;
+    unsigned char* buf;
+    size_t len;
+    size_t cap;
+    int ready;                  // A complete request waits in buf
+    int failed;                 // Dropped by the poll loop
+    unsigned char* out;         // Reply bytes not yet sent
+    size_t out_len;
+    size_t out_sent;
+    size_t out_cap;
+} ServerClient;
+
+typedef struct ServerTree {
+    char name[SERVER_NAME_MAX + 1];
+    MatrixTreeNode* root;
+} ServerTree;
+
+typedef struct Server {
+    int listen_fd;
+    ServerClient clients[SERVER_MAX_CLIENTS];
+    size_t num_clients;
+    ServerTree trees[SERVER_MAX_TREES];
+    size_t num_trees;
+    size_t num_ready;
+    double first_ready_us;      // Arrival of the oldest waiting request
+    int stop;
+    MatrixTreeServeStats stats;
+} Server;
+
+static const ServerRequest* client_request(const ServerClient* c) {
+    return (const ServerRequest*)c->buf;
+}
+
+static const char* client_name(const ServerClient* c) {
+    return (const char*)c->buf + sizeof(ServerRequest);
+}
+
+// x follows the name unaligned; it is copied out, never read in place
+static const unsigned char* client_x(const ServerClient* c) {
+    return c->buf + sizeof(ServerRequest) + client_request(c)->name_len;
+}
+
+static void server_drop(Server* s, size_t i) {
+    close(s->clients[i].fd);
+    free(s->clients[i].buf);
+    free(s->clients[i].out);
+    s->clients[i] = s->clients[--s->num_clients];
+}
+
+// Trees are attached on first use and held until shutdown, or until the
+// name is republished; each batch checks, and re-attaches to the new copy
+static MatrixTreeNode* server_tree(Server* s, const char* name, size_t len) {
+    for (size_t i = 0; i < s->num_trees; i++) {
+        ServerTree* t = &s->trees[i];
+        if (strlen(t->name) != len || memcmp(t->name, name, len) != 0) continue;
+        if (!matrix_tree_attach_stale(t->root, t->name)) return t->root;
+
+        matrix_tree_detach(t->root);
+        t->root = matrix_tree_attach(t->name);
+        if (t->root) return t->root;
+        *t = s->trees[--s->num_trees];
+        return NULL;
+    }
+    if (s->num_trees == SERVER_MAX_TREES) return NULL;
+
+    ServerTree* t = &s->trees[s->num_trees];
+    memcpy(t->name, name, len);
+    t->name[len] = '\0';
+    t->root = matrix_tree_attach(t->name);
+    if (!t->root) return NULL;
+    s->num_trees++;
+    return t->root;
+}
+
+// Sends buffered output until done or the socket is full; -1 on error
+static int client_send(ServerClient* c) {
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, SERVER_SEND_FLAGS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n <= 0) return -1;
+        c->out_sent += (size_t)n;
+    }
+    c->out_len = 0;
+    c->out_sent = 0;
+    return 0;
+}
+
+static int client_queue(ServerClient* c, const void* data, size_t len) {
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + len) cap *= 2;
+        unsigned char* out = realloc(c->out, cap);
+        if (!out) return -1;
+        c->out = out;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+// Queues the reply and sends what the socket takes now; the rest goes out
+// as the poll loop sees POLLOUT. A failure marks the client for dropping.
+static void server_reply(ServerClient* c, int status, const double* y, uint32_t count) {
+    ServerReply reply = { status, status == 0 ? count : 0 };
+    if (client_queue(c, &reply, sizeof(reply)) != 0 ||
+        (reply.count && client_queue(c, y, reply.count * sizeof(double)) != 0) || client_send(c) != 0) {
+        c->failed = 1;
+    }
+}
+
+// Reads what is available; returns -1 once the client is gone or misbehaves
+static int server_receive(Server* s, ServerClient* c) {
+    if (c->len == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 4096;
+        unsigned char* buf = realloc(c->buf, cap);
+        if (!buf) return -1;
+        c->buf = buf;
+        c->cap = cap;
+    }
+
+    ssize_t n = recv(c->fd, c->buf + c->len, c->cap - c->len, 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (n <= 0) return -1;
+    c->len += (size_t)n;
+    if (c->len < sizeof(ServerRequest)) return 0;
+
+    const ServerRequest* req = client_request(c);
+    if (req->magic != SERVER_MAGIC || req->name_len == 0 || req->name_len > SERVER_NAME_MAX ||
+        req->count > SERVER_MAX_COUNT) return -1;
+
+    size_t need = sizeof(ServerRequest) + req->name_len + (size_t)req->count * sizeof(double);
+    if (c->len < need) return 0;
+
+    if (req->op == SERVER_OP_SHUTDOWN) {
+        s->stop = 1;
+        server_reply(c, 0, NULL, 0);
+        return -1;
+    }
+    if (req->op != SERVER_OP_MULTIPLY) return -1;
+
+    c->ready = 1;
+    if (s->num_ready++ == 0) s->first_ready_us = now_us();
+    return 0;
+}
+
+// Answers every waiting request, one batched multiply per tree
+static void server_flush(Server* s) {
+    ServerClient* batch[SERVER_MAX_CLIENTS];
+    size_t done = 0;
+
+    while (done < s->num_ready) {
+        // Gather the waiting requests for the first tree not yet served
+        size_t n = 0;
+        const ServerClient* lead = NULL;
+        for (size_t i = 0; i < s->num_clients; i++) {
+            ServerClient* c = &s->clients[i];
+            if (!c->ready) continue;
+            if (!lead) lead = c;
+            const ServerRequest* a = client_request(lead);
+            const ServerRequest* b = client_request(c);
+            if (a->name_len == b->name_len &&
+                memcmp(client_name(lead), client_name(c), a->name_len) == 0) {
+                batch[n++] = c;
+            }
+        }
+
+        MatrixTreeNode* root = server_tree(s, client_name(lead), client_request(lead)->name_len);
+        size_t rows = root ? root->rows : 0;
+        size_t cols = root ? root->cols : 0;
+        double* x = root ? malloc(n * cols * sizeof(double)) : NULL;
+        double* y = root ? malloc(n * rows * sizeof(double)) : NULL;
+        int ok = x && y;
+
+        size_t valid = 0;
+        for (size_t i = 0; ok && i < n; i++) {
+            if (client_request(batch[i])->count != cols) continue;
+            memcpy(x + valid * cols, client_x(batch[i]), cols * sizeof(double));
+            valid++;
+        }
+        if (ok && valid > 0) {
+            ok = matrix_tree_multiply_batch(root, x, valid, y) == 0;
+            s->stats.batches++;
+        }
+
+        valid = 0;
+        for (size_t i = 0; i < n; i++) {
+            ServerClient* c = batch[i];
+            int match = ok && client_request(c)->count == cols;
+            server_reply(c, match ? 0 : -1, match ? y + valid * rows : NULL, (uint32_t)rows);
+            if (match) valid++;
+            c->ready = 0;
+            c->len = 0;
+        }
+        s->stats.requests += n;
+        done += n;
+        free(x);
+        free(y);
+    }
+    s->num_ready = 0;
+}
+
+int matrix_tree_serve(const char* socket_path, uint32_t batch_window_us, MatrixTreeServeStats* stats) {
+    struct sockaddr_un addr;
+    if (!socket_path || socket_address(socket_path, &addr) != 0) return -1;
+
+    Server* s = calloc(1, sizeof(Server));
+    if (!s) return -1;
+
+    s->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (s->listen_fd < 0 || bind(s->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(s->listen_fd, SERVER_MAX_CLIENTS) != 0) {
+        if (s->listen_fd >= 0) close(s->listen_fd);
+        free(s);
+        return -1;
+    }
+
+    struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+    while (!s->stop) {
+        // Requests that already arrived stop being read until answered and
+        // the answer is sent
+        size_t nfds = 0;
+        fds[nfds].fd = s->listen_fd;
+        fds[nfds++].events = s->num_clients < SERVER_MAX_CLIENTS ? POLLIN : 0;
+        for (size_t i = 0; i < s->num_clients; i++) {
+            const ServerClient* c = &s->clients[i];
+            fds[nfds].fd = c->fd;
+            fds[nfds++].events = c->out_len ? POLLOUT : c->ready ? 0 : POLLIN;
+        }
+
+        int timeout = -1;
+        if (s->num_ready > 0) {
+            double left = s->first_ready_us + batch_window_us - now_us();
+            timeout = left > 0 ? (int)(left / 1000.0) + 1 : 0;
+        }
+
+        int rc = poll(fds, nfds, timeout);
+        if (rc < 0 && errno != EINTR) break;
+
+        // Clients first: fds[] indices shift once one is dropped
+        for (size_t i = nfds; i-- > 1;) {
+            ServerClient* c = &s->clients[i - 1];
+            short revents = rc > 0 ? fds[i].revents : 0;
+            if ((revents & POLLOUT) && client_send(c) != 0) c->failed = 1;
+            if (!c->failed && (revents & (POLLIN | POLLHUP | POLLERR)) && !c->out_len &&
+                server_receive(s, c) != 0) {
+                c->failed = 1;
+            }
+            if (c->failed) {
+                if (c->ready) s->num_ready--;
+                server_drop(s, i - 1);
+            }
+        }
+        if (rc > 0 && (fds[0].revents & POLLIN)) {
+            int fd = accept(s->listen_fd, NULL, NULL);
+            if (fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0) {
+                ServerClient c = { fd, NULL, 0, 0, 0, 0, NULL, 0, 0, 0 };
+                s->clients[s->num_clients++] = c;
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        if (s->num_ready > 0 && (s->num_ready >= SERVER_MAX_BATCH ||
+                                 now_us() - s->first_ready_us >= batch_window_us)) {
+            server_flush(s);
+            for (size_t i = s->num_clients; i-- > 0;) {
+                if (s->clients[i].failed) server_drop(s, i);
+            }
+        }
+    }
+
+    if (s->num_ready > 0) server_flush(s);
+    while (s->num_clients > 0) server_drop(s, 0);
+    for (size_t i = 0; i < s->num_trees; i++) matrix_tree_detach(s->trees[i].root);
+    close(s->listen_fd);
+    unlink(socket_path);
+    if (stats) *stats = s->stats;
+    free(s);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Client
+
+static int remote_call(const char* socket_path, uint32_t op, const char* name,
+                       const double* x, uint32_t count, double* y, uint32_t rows) {
+    struct sockaddr_un addr;
+    if (!socket_path || socket_address(socket_path, &addr) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t name_len = strlen(name);
+    ServerRequest req = { SERVER_MAGIC, op, (uint32_t)name_len, count };
+    ServerReply reply;
+    int rc = -1;
+    if (io_write(fd, &req, sizeof(req)) == 0 && io_write(fd, name, name_len) == 0 &&
+        (count == 0 || io_write(fd, x, count * sizeof(double)) == 0) &&
+        io_read(fd, &reply, sizeof(reply)) == 0 && reply.status == 0 && reply.count == rows &&
+        (rows == 0 || io_read(fd, y, rows * sizeof(double)) == 0)) {
+        rc = 0;
+    }
+    close(fd);
+    return rc;
+}
+
+int matrix_tree_remote_multiply(const char* socket_path, const char* tree_name,
+                                const double* x, uint32_t cols, double* y, uint32_t rows) {
+    if (!tree_name || !x || !y) return -1;
+    size_t len = strlen(tree_name);
+    if (len == 0 || len > SERVER_NAME_MAX) return -1;
+    return remote_call(socket_path, SERVER_OP_MULTIPLY, tree_name, x, cols, y, rows);
+}
+
+int matrix_tree_remote_shutdown(const char* socket_path) {
+    return remote_call(socket_path, SERVER_OP_SHUTDOWN, "-", NULL, 0, NULL, 0);
+}
+
+#endif
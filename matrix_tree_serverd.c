@@ -0,0 +1,27 @@
+// Matrix-Tree evaluation server
+// Usage: matrix_tree_serverd <socket path> [batch window in microseconds]
+// Serves trees published with matrix_tree_publish until a client calls
+// matrix_tree_remote_shutdown.
+
+#include "matrix_tree.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEFAULT_BATCH_WINDOW_US 200
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <socket path> [batch window us]\n", argv[0]);
+        return 2;
+    }
+    uint32_t window = argc == 3 ? (uint32_t)strtoul(argv[2], NULL, 10) : DEFAULT_BATCH_WINDOW_US;
+
+    MatrixTreeServeStats stats;
+    if (matrix_tree_serve(argv[1], window, &stats) != 0) {
+        fprintf(stderr, "%s: cannot serve on %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    printf("served %llu requests in %llu batches\n",
+           (unsigned long long)stats.requests, (unsigned long long)stats.batches);
+    return 0;
+}
@@ -0,0 +1,425 @@
+// Matrix-Tree shared-memory publishing
+// matrix_tree_publish serializes a tree into one named shared-memory segment
+// (POSIX shm, or a named file mapping on Windows) whose links are offsets
+// from the segment start. matrix_tree_attach maps it read-only and builds a
+// small private skeleton of nodes whose data_ptr point straight into the
+// mapping, so every process evaluates against one physical copy of the
+// matrix data with the unchanged kernels.
+//
+// Segment layout (pre-order, root first):
+//   ShmHeader | node records | child offset arrays | leaf data (64-byte aligned)
+
+#include "matrix_tree_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define SHM_MAGIC 0x31454552544d4d53ull     // "SMMTREE1"
+#define SHM_VERSION 1
+#define SHM_NAME_MAX 256
+#define SHM_DATA_ALIGN 64
+
+// Written last by the publisher (release); attach reads magic first
+// (acquire) and rejects the segment until it is set
+typedef struct ShmHeader {
+    _Atomic uint64_t magic;
+    uint64_t version;
+    uint64_t total_size;
+    uint64_t node_count;
+    uint64_t child_count;
+    uint64_t reserved[3];
+} ShmHeader;
+
+// Node record: the MatrixTreeNode layout with data_ptr as a segment offset
+typedef struct ShmNode {
+    uint64_t node_type;
+    uint32_t rows;
+    uint32_t cols;
+    uint64_t data_off;          // Leaf data, or the child offset array
+    uint64_t num_children;
+} ShmNode;
+
+// Private per-attach block; the skeleton nodes follow it directly
+typedef struct ShmAttach {
+    void* base;
+    uint64_t size;
+#ifdef _WIN32
+    HANDLE mapping;
+#else
+    dev_t dev;                  // Identity of the segment mapped, to notice
+    ino_t ino;                  // a republish under the same name
+#endif
+} ShmAttach;
+
+static uint64_t shm_align(uint64_t n) {
+    return (n + SHM_DATA_ALIGN - 1) & ~(uint64_t)(SHM_DATA_ALIGN - 1);
+}
+
+// ---------------------------------------------------------------------------
+// Publishing
+
+typedef struct ShmLayout {
+    uint64_t nodes;
+    uint64_t children;
+    uint64_t data;              // Bytes of leaf data, each leaf aligned
+} ShmLayout;
+
+static void shm_measure(const MatrixTreeNode* node, ShmLayout* layout) {
+    layout->nodes++;
+    if (node->node_type != NODE_TYPE_INTERNAL) {
+        layout->data += shm_align(matrix_tree_leaf_elems(node) * sizeof(double));
+        return;
+    }
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    layout->children += node->num_children;
+    for (uint64_t i = 0; i < node->num_children; i++) shm_measure(children[i], layout);
+}
+
+typedef struct ShmWriter {
+    char* base;
+    uint64_t node_pos;          // Next free node record (index)
+    uint64_t child_off;         // Next free child offset slot
+    uint64_t data_off;          // Next free leaf data byte
+} ShmWriter;
+
+// Writes node and its subtree in pre-order; returns the record's offset
+static uint64_t shm_write(const MatrixTreeNode* node, ShmWriter* w) {
+    uint64_t off = sizeof(ShmHeader) + w->node_pos++ * sizeof(ShmNode);
+    ShmNode* rec = (ShmNode*)(w->base + off);
+
+    rec->node_type = node->node_type;
+    rec->rows = node->rows;
+    rec->cols = node->cols;
+    rec->num_children = node->num_children;     // Kind parameter on structured leaves
+
+    if (node->node_type != NODE_TYPE_INTERNAL) {
+        size_t bytes = (size_t)matrix_tree_leaf_elems(node) * sizeof(double);
+        rec->data_off = w->data_off;
+        memcpy(w->base + w->data_off, node->data_ptr, bytes);
+        w->data_off += shm_align(bytes);
+        return off;
+    }
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    uint64_t slots = w->child_off;
+    rec->data_off = slots;
+    w->child_off += node->num_children * sizeof(uint64_t);
+
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        uint64_t child = shm_write(children[i], w);
+        memcpy(w->base + slots + i * sizeof(uint64_t), &child, sizeof(child));
+    }
+    return off;
+}
+
+static void shm_fill(char* base, const MatrixTreeNode* root, const ShmLayout* layout, uint64_t total) {
+    uint64_t child_start = sizeof(ShmHeader) + layout->nodes * sizeof(ShmNode);
+    uint64_t data_start = shm_align(child_start + layout->children * sizeof(uint64_t));
+    ShmWriter w = { base, 0, child_start, data_start };
+    ShmHeader* header = (ShmHeader*)base;
+
+    shm_write(root, &w);
+    header->version = SHM_VERSION;
+    header->total_size = total;
+    header->node_count = layout->nodes;
+    header->child_count = layout->children;
+
+    // Everything above becomes visible before the magic does
+    atomic_store_explicit(&header->magic, SHM_MAGIC, memory_order_release);
+}
+
+// ---------------------------------------------------------------------------
+// Attaching
+
+// Validates the records and builds the skeleton; returns the root or NULL
+static MatrixTreeNode* shm_build(ShmAttach* attach) {
+    const char* base = (const char*)attach->base;
+    const ShmHeader* header = (const ShmHeader*)base;
+    uint64_t n = header->node_count;
+    uint64_t nodes_end = sizeof(ShmHeader) + n * sizeof(ShmNode);
+
+    if (n == 0 || nodes_end > attach->size) return NULL;
+
+    const ShmNode* recs = (const ShmNode*)(base + sizeof(ShmHeader));
+    MatrixTreeNode* nodes = (MatrixTreeNode*)(attach + 1);
+    MatrixTreeNode** links = (MatrixTreeNode**)(nodes + n);
+    uint64_t used_links = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        const ShmNode* rec = &recs[i];
+        nodes[i].node_type = rec->node_type;
+        nodes[i].rows = rec->rows;
+        nodes[i].cols = rec->cols;
+        nodes[i].num_children = rec->num_children;
+
+        if (rec->node_type == NODE_TYPE_LEAF || matrix_tree_is_structured(rec->node_type)) {
+            // Structured kinds read only what leaf_elems covers
+            if (rec->node_type != NODE_TYPE_LEAF &&
+                !matrix_tree_structured_valid(rec->node_type, rec->rows, rec->cols, rec->num_children)) {
+                return NULL;
+            }
+            uint64_t bytes = matrix_tree_leaf_elems(&nodes[i]) * sizeof(double);
+            if (rec->data_off < nodes_end || rec->data_off > attach->size ||
+                bytes > attach->size - rec->data_off) return NULL;
+            nodes[i].data_ptr = (void*)(base + rec->data_off);
+            continue;
+        }
+        if (rec->node_type != NODE_TYPE_INTERNAL) return NULL;
+
+        uint64_t k = rec->num_children;
+        if (k > header->child_count - used_links || rec->data_off < nodes_end ||
+            rec->data_off > attach->size || k * sizeof(uint64_t) > attach->size - rec->data_off) {
+            return NULL;
+        }
+
+        // Children come later in pre-order, which also rules out cycles
+        nodes[i].data_ptr = &links[used_links];
+        for (uint64_t c = 0; c < k; c++) {
+            uint64_t child;
+            memcpy(&child, base + rec->data_off + c * sizeof(uint64_t), sizeof(child));
+            uint64_t idx = (child - sizeof(ShmHeader)) / sizeof(ShmNode);
+            if (child < sizeof(ShmHeader) || (child - sizeof(ShmHeader)) % sizeof(ShmNode) != 0 ||
+                idx <= i || idx >= n || recs[idx].rows != rec->rows || recs[idx].cols != rec->cols) {
+                return NULL;
+            }
+            links[used_links++] = &nodes[idx];
+        }
+    }
+    return nodes;
+}
+
+static ShmAttach* shm_attach_alloc(void* base, uint64_t size) {
+    const ShmHeader* header = (const ShmHeader*)base;
+    if (size < sizeof(ShmHeader) || atomic_load_explicit(&header->magic, memory_order_acquire) != SHM_MAGIC ||
+        header->version != SHM_VERSION || header->total_size > size) return NULL;
+    if (header->node_count > size / sizeof(ShmNode) || header->child_count > size / sizeof(uint64_t)) {
+        return NULL;
+    }
+
+    size_t bytes = sizeof(ShmAttach) + (size_t)header->node_count * sizeof(MatrixTreeNode) +
+                   (size_t)header->child_count * sizeof(MatrixTreeNode*);
+    ShmAttach* attach = malloc(bytes);
+    if (!attach) return NULL;
+
+    attach->base = base;
+    attach->size = size;
+    if (!shm_build(attach)) {
+        free(attach);
+        return NULL;
+    }
+    return attach;
+}
+
+// ---------------------------------------------------------------------------
+// Platform segments
+
+#ifdef _WIN32
+
+// Named mappings live while a handle is open: the publisher keeps one
+#define SHM_MAX_PUBLISHED 16
+static struct { char name[SHM_NAME_MAX]; HANDLE mapping; } shm_published[SHM_MAX_PUBLISHED];
+
+static void shm_os_name(const char* name, char* buf) {
+    if (name[0] == '/') name++;
+    snprintf(buf, SHM_NAME_MAX, "Local\\%s", name);
+}
+
+int matrix_tree_publish(const MatrixTreeNode* root, const char* name) {
+    if (!root || !name) return -1;
+
+    char os_name[SHM_NAME_MAX];
+    shm_os_name(name, os_name);
+    matrix_tree_unpublish(name);
+
+    int slot = 0;
+    while (slot < SHM_MAX_PUBLISHED && shm_published[slot].mapping) slot++;
+    if (slot == SHM_MAX_PUBLISHED) return -1;
+
+    ShmLayout layout = {0, 0, 0};
+    shm_measure(root, &layout);
+    uint64_t total = shm_align(sizeof(ShmHeader) + layout.nodes * sizeof(ShmNode) +
+                               layout.children * sizeof(uint64_t)) + layout.data;
+
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                        (DWORD)(total >> 32), (DWORD)total, os_name);
+    if (!mapping) return -1;
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return -1;
+    }
+
+    char* base = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)total);
+    if (!base) {
+        CloseHandle(mapping);
+        return -1;
+    }
+    shm_fill(base, root, &layout, total);
+    UnmapViewOfFile(base);
+
+    strncpy(shm_published[slot].name, os_name, SHM_NAME_MAX - 1);
+    shm_published[slot].mapping = mapping;
+    return 0;
+}
+
+int matrix_tree_unpublish(const char* name) {
+    char os_name[SHM_NAME_MAX];
+    shm_os_name(name, os_name);
+
+    for (int i = 0; i < SHM_MAX_PUBLISHED; i++) {
+        if (shm_published[i].mapping && strcmp(shm_published[i].name, os_name) == 0) {
+            CloseHandle(shm_published[i].mapping);
+            shm_published[i].mapping = NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+MatrixTreeNode* matrix_tree_attach(const char* name) {
+    if (!name) return NULL;
+
+    char os_name[SHM_NAME_MAX];
+    shm_os_name(name, os_name);
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, os_name);
+    if (!mapping) return NULL;
+
+    void* base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION info;
+    if (!base || !VirtualQuery(base, &info, sizeof(info))) {
+        if (base) UnmapViewOfFile(base);
+        CloseHandle(mapping);
+        return NULL;
+    }
+
+    ShmAttach* attach = shm_attach_alloc(base, info.RegionSize);
+    if (!attach) {
+        UnmapViewOfFile(base);
+        CloseHandle(mapping);
+        return NULL;
+    }
+    attach->mapping = mapping;
+    return (MatrixTreeNode*)(attach + 1);
+}
+
+void matrix_tree_detach(MatrixTreeNode* root) {
+    if (!root) return;
+    ShmAttach* attach = (ShmAttach*)root - 1;
+    UnmapViewOfFile(attach->base);
+    CloseHandle(attach->mapping);
+    free(attach);
+}
+
+// A mapping cannot be replaced while it is open, so an attach never goes stale
+int matrix_tree_attach_stale(const MatrixTreeNode* root, const char* name) {
+    (void)root;
+    (void)name;
+    return 0;
+}
+
+#else
+
+// POSIX names need exactly one leading slash
+static void shm_os_name(const char* name, char* buf) {
+    snprintf(buf, SHM_NAME_MAX, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+int matrix_tree_publish(const MatrixTreeNode* root, const char* name) {
+    if (!root || !name) return -1;
+
+    char os_name[SHM_NAME_MAX];
+    shm_os_name(name, os_name);
+
+    ShmLayout layout = {0, 0, 0};
+    shm_measure(root, &layout);
+    uint64_t total = shm_align(sizeof(ShmHeader) + layout.nodes * sizeof(ShmNode) +
+                               layout.children * sizeof(uint64_t)) + layout.data;
+
+    // A fresh segment: processes still attached to an older one keep it
+    shm_unlink(os_name);
+    int fd = shm_open(os_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, (off_t)total) != 0) {
+        close(fd);
+        shm_unlink(os_name);
+        return -1;
+    }
+
+    char* base = mmap(NULL, (size_t)total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(os_name);
+        return -1;
+    }
+    shm_fill(base, root, &layout, total);
+    munmap(base, (size_t)total);
+    return 0;
+}
+
+int matrix_tree_unpublish(const char* name) {
+    if (!name) return -1;
+    char os_name[SHM_NAME_MAX];
+    shm_os_name(name, os_name);
+    return shm_unlink(os_name) == 0 ? 0 : -1;
+}
+
+MatrixTreeNode* matrix_tree_attach(const char* name) {
+    if (!name) return NULL;
+
+    char os_name[SHM_NAME_MAX];
+    shm_os_name(name, os_name);
+    int fd = shm_open(os_name, O_RDONLY, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ShmHeader)) {
+        close(fd);
+        return NULL;
+    }
+    uint64_t size = (uint64_t)st.st_size;
+    void* base = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    ShmAttach* attach = shm_attach_alloc(base, size);
+    if (!attach) {
+        munmap(base, (size_t)size);
+        return NULL;
+    }
+    attach->dev = st.st_dev;
+    attach->ino = st.st_ino;
+    return (MatrixTreeNode*)(attach + 1);
+}
+
+void matrix_tree_detach(MatrixTreeNode* root) {
+    if (!root) return;
+    ShmAttach* attach = (ShmAttach*)root - 1;
+    munmap(attach->base, (size_t)attach->size);
+    free(attach);
+}
+
+// Publish replaces the segment rather than rewriting it, so a different
+// inode under the name (or none) means root maps an old copy
+int matrix_tree_attach_stale(const MatrixTreeNode* root, const char* name) {
+    const ShmAttach* attach = (const ShmAttach*)root - 1;
+    char os_name[SHM_NAME_MAX];
+    shm_os_name(name, os_name);
+    int fd = shm_open(os_name, O_RDONLY, 0);
+    if (fd < 0) return 1;
+
+    struct stat st;
+    int stale = fstat(fd, &st) != 0 || st.st_dev != attach->dev || st.st_ino != attach->ino;
+    close(fd);
+    return stale;
+}
+
+#endif
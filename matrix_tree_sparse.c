@@ -0,0 +1,88 @@
+// Matrix-Tree sparse input multiply
+// y = A x where x is given as (index, value) pairs. Only the columns that x
+// touches are read, either from every leaf of the tree or from an already
+// collapsed matrix in any MATRIX_TREE_LAYOUT_*, so the cost follows the
+// number of nonzeros rather than the column count.
+
+#include "matrix_tree_internal.h"
+#include <string.h>
+
+static int sparse_check(uint32_t cols, const uint32_t* index, uint64_t nnz) {
+    for (uint64_t k = 0; k < nnz; k++) {
+        if (index[k] >= cols) return -1;
+    }
+    return 0;
+}
+
+// Adds the gathered columns of every leaf under node into y
+static void sparse_accumulate(const MatrixTreeNode* node, const uint32_t* index,
+                              const double* value, uint64_t nnz, double* y) {
+    if (node->node_type == NODE_TYPE_INTERNAL) {
+        MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+        for (uint64_t i = 0; i < node->num_children; i++) {
+            sparse_accumulate(children[i], index, value, nnz, y);
+        }
+        return;
+    }
+
+    if (node->node_type != NODE_TYPE_LEAF) {
+        for (uint64_t k = 0; k < nnz; k++) matrix_tree_structured_column(node, index[k], value[k], y);
+        return;
+    }
+
+    const double* a = (const double*)node->data_ptr;
+    for (uint32_t r = 0; r < node->rows; r++) {
+        const double* row = a + (size_t)r * node->cols;
+        double sum = 0.0;
+        for (uint64_t k = 0; k < nnz; k++) sum += row[index[k]] * value[k];
+        y[r] += sum;
+    }
+}
+
+int matrix_tree_multiply_sparse(MatrixTreeNode* node, const uint32_t* index, const double* value,
+                                uint64_t nnz, double* y) {
+    if (!node || !y || (nnz && (!index || !value))) return -1;
+    if (sparse_check(node->cols, index, nnz) != 0) return -1;
+
+    memset(y, 0, node->rows * sizeof(double));
+    sparse_accumulate(node, index, value, nnz, y);
+    return 0;
+}
+
+int matrix_tree_multiply_sparse_collapsed(const double* a, uint32_t rows, uint32_t cols, uint32_t layout,
+                                          uint32_t block_dim, const uint32_t* index, const double* value,
+                                          uint64_t nnz, double* y) {
+    if (!a || !y || (nnz && (!index || !value))) return -1;
+    if (layout > MATRIX_TREE_LAYOUT_BLOCKED || sparse_check(cols, index, nnz) != 0) return -1;
+
+    memset(y, 0, rows * sizeof(double));
+
+    if (layout == MATRIX_TREE_LAYOUT_COL_MAJOR) {
+        // Each nonzero is one contiguous column: y += value * column
+        for (uint64_t i = 0; i < nnz; i++) matrix_tree_blas_axpy(y, value[i], a + (size_t)index[i] * rows, rows);
+        return 0;
+    }
+
+    if (layout == MATRIX_TREE_LAYOUT_BLOCKED) {
+        // Nonzeros in one block column share the cache lines of each block row
+        const size_t b = block_dim ? block_dim : MATRIX_TREE_BLOCK_DIM;
+        size_t block_cols = (cols + b - 1) / b;
+        for (uint64_t i = 0; i < nnz; i++) {
+            size_t bj = index[i] / b, c = index[i] % b;
+            for (size_t r0 = 0; r0 < rows; r0 += b) {
+                const double* blk = a + ((r0 / b) * block_cols + bj) * b * b + c;
+                size_t n = rows - r0 < b ? rows - r0 : b;
+                for (size_t r = 0; r < n; r++) y[r0 + r] += blk[r * b] * value[i];
+            }
+        }
+        return 0;
+    }
+
+    for (uint32_t r = 0; r < rows; r++) {
+        const double* row = a + (size_t)r * cols;
+        double sum = 0.0;
+        for (uint64_t k = 0; k < nnz; k++) sum += row[index[k]] * value[k];
+        y[r] = sum;
+    }
+    return 0;
+}
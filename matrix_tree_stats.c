@@ -0,0 +1,115 @@
+// Matrix-Tree per-element statistics across children
+// Mean, variance, min and max of every matrix entry over the direct children
+// of a node (ensemble members) in one pass: each output tile holds Welford
+// running state while every child's slice of that tile is folded in, so each
+// child is read once and nothing full-size is kept besides the outputs.
+// Output tiles are independent, so they are split across worker threads, each
+// with its own scratch tiles carved from the caller's call workspace, so
+// short-lived workers never grow workspaces of their own.
+
+#include "matrix_tree_internal.h"
+#include <string.h>
+#include <threads.h>
+
+typedef struct StatsJob {
+    MatrixTreeNode** children;
+    uint64_t count;
+    size_t first;               // Element range [first, last) of this worker
+    size_t last;
+    double* mean;
+    double* variance;
+    double* min;
+    double* max;
+    double* scratch;            // STATS_SCRATCH_TILES tiles of this worker
+} StatsJob;
+
+#define STATS_SCRATCH_TILES 5
+
+static int stats_worker(void* arg) {
+    StatsJob* job = arg;
+    size_t cap = (size_t)matrix_tree_tile_elems;
+    double *x = job->scratch, *mean = x + cap, *m2 = mean + cap, *lo = m2 + cap, *hi = lo + cap;
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+
+    for (size_t start = job->first; start < job->last; start += cap) {
+        size_t len = job->last - start < cap ? job->last - start : cap;
+
+        for (uint64_t j = 0; j < job->count; j++) {
+            const MatrixTreeNode* child = job->children[j];
+            const double* slice = x;
+            if (child->node_type == NODE_TYPE_LEAF) {
+                slice = (const double*)child->data_ptr + start;
+            } else {
+                memset(x, 0, len * sizeof(double));
+                matrix_tree_c_accumulate(child, x, start, len);
+            }
+
+            if (j == 0) {
+                memcpy(mean, slice, len * sizeof(double));
+                memcpy(lo, slice, len * sizeof(double));
+                memcpy(hi, slice, len * sizeof(double));
+                memset(m2, 0, len * sizeof(double));
+            } else {
+                k->welford(mean, m2, lo, hi, slice, 1.0 / (double)(j + 1), len);
+            }
+        }
+
+        if (job->mean) memcpy(job->mean + start, mean, len * sizeof(double));
+        if (job->variance) {
+            memcpy(job->variance + start, m2, len * sizeof(double));
+            k->scale(job->variance + start, 1.0 / (double)job->count, len);
+        }
+        if (job->min) memcpy(job->min + start, lo, len * sizeof(double));
+        if (job->max) memcpy(job->max + start, hi, len * sizeof(double));
+    }
+    return 0;
+}
+
+int matrix_tree_child_stats(MatrixTreeNode* node, double* mean, double* variance, double* min, double* max,
+                            uint32_t threads) {
+    if (!node) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    uint64_t count;
+    MatrixTreeNode** children = matrix_tree_c_children(&node, &count);
+    if (count == 0) return -1;
+    matrix_tree_freeze_evaluated(node);
+
+    // Workers get whole tiles; never more workers than tiles
+    size_t total = (size_t)node->rows * node->cols;
+    size_t cap = (size_t)matrix_tree_tile_elems;
+    size_t tiles = (total + cap - 1) / cap;
+    if (threads == 0) threads = 1;
+    if (threads > tiles) threads = tiles ? (uint32_t)tiles : 1;
+
+    // Call table: worker scratch tiles, jobs, thread handles, started flags
+    size_t tile_elems = STATS_SCRATCH_TILES * cap;
+    size_t table = threads * (tile_elems * sizeof(double) + sizeof(StatsJob) + sizeof(thrd_t) + sizeof(int));
+    double* scratch = matrix_tree_workspace(MATRIX_TREE_WS_CALL, table);
+    if (!scratch) return -1;
+    StatsJob* jobs = (StatsJob*)(scratch + threads * tile_elems);
+    thrd_t* workers = (thrd_t*)(jobs + threads);
+    int* started = (int*)(workers + threads);
+
+    size_t per = (tiles + threads - 1) / threads * cap;
+    for (uint32_t t = 0; t < threads; t++) {
+        size_t first = t * per < total ? t * per : total;
+        size_t last = first + per < total ? first + per : total;
+        jobs[t] = (StatsJob){ children, count, first, last, mean, variance, min, max, scratch + t * tile_elems };
+    }
+
+    // The calling thread takes the first range; a worker that fails to
+    // start has its range run here too
+    for (uint32_t t = 1; t < threads; t++) {
+        started[t] = thrd_create(&workers[t], stats_worker, &jobs[t]) == thrd_success;
+    }
+    stats_worker(&jobs[0]);
+    for (uint32_t t = 1; t < threads; t++) {
+        if (started[t]) {
+            thrd_join(workers[t], NULL);
+        } else {
+            stats_worker(&jobs[t]);
+        }
+    }
+    return 0;
+}
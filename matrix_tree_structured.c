@@ -0,0 +1,343 @@
+// Matrix-Tree structured leaves
+// Leaf kinds that store less than rows * cols doubles. Both backends treat
+// any node type above NODE_TYPE_INTERNAL as structured: collapse hands each
+// tile slice to matrix_tree_structured_accumulate, scale touches the
+// matrix_tree_leaf_elems stored values, and trees made only of structured
+// leaves multiply through the kernels here without a dense pass.
+//
+// Storage per kind (all square, n = rows = cols):
+//   NODE_TYPE_SYMMETRIC        upper triangle packed row by row; row r holds
+//                              columns r..n-1 from r * n - r * (r - 1) / 2
+//   NODE_TYPE_DIAGONAL         the n diagonal values
+//   NODE_TYPE_SCALED_IDENTITY  one value s, the matrix is s * I
+//   NODE_TYPE_BANDED           bandwidth b in num_children; row r holds columns
+//                              r-b..r+b at r * (2b + 1); slots outside the
+//                              matrix are never read
+
+#include "matrix_tree_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t packed_row(size_t n, size_t r) {
+    return r * n - r * (r - 1) / 2;
+}
+
+int matrix_tree_is_structured(uint64_t node_type) {
+    return node_type > NODE_TYPE_INTERNAL && node_type < MATRIX_TREE_NODE_TYPE_COUNT;
+}
+
+int matrix_tree_structured_valid(uint64_t node_type, uint32_t rows, uint32_t cols, uint64_t aux) {
+    if (!matrix_tree_is_structured(node_type) || rows == 0 || rows != cols) return 0;
+    return node_type != NODE_TYPE_BANDED || aux < rows;
+}
+
+uint64_t matrix_tree_leaf_elems(const MatrixTreeNode* node) {
+    uint64_t n = node->rows;
+
+    switch (node->node_type) {
+    case NODE_TYPE_LEAF:            return n * node->cols;
+    case NODE_TYPE_SYMMETRIC:       return n * (n + 1) / 2;
+    case NODE_TYPE_DIAGONAL:        return n;
+    case NODE_TYPE_SCALED_IDENTITY: return 1;
+    case NODE_TYPE_BANDED:          return n * (2 * node->num_children + 1);
+    default:                        return 0;
+    }
+}
+
+MatrixTreeNode* matrix_tree_structured_create(uint32_t rows, uint32_t cols, uint64_t node_type, uint64_t aux) {
+    if (!matrix_tree_structured_valid(node_type, rows, cols, aux)) return NULL;
+
+    MatrixTreeNode* node = matrix_tree_node_alloc();
+    if (!node) return NULL;
+
+    node->node_type = node_type;
+    node->rows = rows;
+    node->cols = cols;
+    node->num_children = aux;
+    node->data_ptr = calloc((size_t)matrix_tree_leaf_elems(node), sizeof(double));
+    if (!node->data_ptr) {
+        matrix_tree_node_free(node);
+        return NULL;
+    }
+    return node;
+}
+
+int matrix_tree_structured_set(MatrixTreeNode* node, const double* data, size_t data_size) {
+    size_t size = (size_t)matrix_tree_leaf_elems(node) * sizeof(double);
+    if (!matrix_tree_is_structured(node->node_type) || data_size != size) return -1;
+
+    memcpy(node->data_ptr, data, size);
+    return 0;
+}
+
+// Upper part of each row segment is contiguous in the packing; the mirrored
+// lower part is gathered down the earlier rows
+static void symmetric_accumulate(const MatrixTreeNode* node, double* tile, size_t start, size_t len) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    const double* p = (const double*)node->data_ptr;
+    size_t n = node->cols;
+    size_t pos = start, end = start + len;
+
+    while (pos < end) {
+        size_t r = pos / n, c0 = pos % n;
+        size_t c1 = c0 + (end - pos) < n ? c0 + (end - pos) : n;
+        double* t = tile + (pos - start);
+
+        size_t lower_end = r < c1 ? r : c1;
+        for (size_t c = c0; c < lower_end; c++) t[c - c0] += p[packed_row(n, c) + r - c];
+
+        size_t cs = c0 > r ? c0 : r;
+        if (cs < c1) k->add(t + (cs - c0), p + packed_row(n, r) + (cs - r), c1 - cs);
+        pos += c1 - c0;
+    }
+}
+
+// Only the diagonal positions inside [start, start + len) are touched
+static void diagonal_accumulate(const MatrixTreeNode* node, double* tile, size_t start, size_t len) {
+    const double* p = (const double*)node->data_ptr;
+    size_t n = node->cols;
+    size_t stride = node->node_type == NODE_TYPE_DIAGONAL ? 1 : 0;
+
+    for (size_t r = start / n; r < n && r * (n + 1) < start + len; r++) {
+        size_t pos = r * (n + 1);
+        if (pos >= start) tile[pos - start] += p[r * stride];
+    }
+}
+
+// Each row segment meets the band in at most one contiguous run
+static void banded_accumulate(const MatrixTreeNode* node, double* tile, size_t start, size_t len) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    const double* p = (const double*)node->data_ptr;
+    size_t n = node->cols, b = (size_t)node->num_children, w = 2 * b + 1;
+    size_t pos = start, end = start + len;
+
+    while (pos < end) {
+        size_t r = pos / n, c0 = pos % n;
+        size_t c1 = c0 + (end - pos) < n ? c0 + (end - pos) : n;
+        size_t lo = r > b ? r - b : 0, hi = r + b + 1 < n ? r + b + 1 : n;
+        if (lo < c0) lo = c0;
+        if (hi > c1) hi = c1;
+        if (lo < hi) k->add(tile + (pos - start) + (lo - c0), p + r * w + lo + b - r, hi - lo);
+        pos += c1 - c0;
+    }
+}
+
+void matrix_tree_structured_accumulate(const MatrixTreeNode* node, double* tile, uint64_t start, uint64_t len) {
+    switch (node->node_type) {
+    case NODE_TYPE_SYMMETRIC:
+        symmetric_accumulate(node, tile, (size_t)start, (size_t)len);
+        break;
+    case NODE_TYPE_DIAGONAL:
+    case NODE_TYPE_SCALED_IDENTITY:
+        diagonal_accumulate(node, tile, (size_t)start, (size_t)len);
+        break;
+    case NODE_TYPE_BANDED:
+        banded_accumulate(node, tile, (size_t)start, (size_t)len);
+        break;
+    default:
+        break;
+    }
+}
+
+// SYMV on the packed triangle: each stored off-diagonal element serves both
+// y[r] (as a dot) and y[c] (as an axpy)
+static void symmetric_gemv(const MatrixTreeNode* node, const double* x, double* y) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    const double* p = (const double*)node->data_ptr;
+    size_t n = node->cols;
+
+    for (size_t r = 0; r < n; r++) {
+        const double* row = p + packed_row(n, r);
+        size_t rest = n - r - 1;
+        y[r] += row[0] * x[r] + k->dot(row + 1, x + r + 1, rest);
+        k->axpy(y + r + 1, x[r], row + 1, rest);
+    }
+}
+
+static void banded_gemv(const MatrixTreeNode* node, const double* x, double* y) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    const double* p = (const double*)node->data_ptr;
+    size_t n = node->cols, b = (size_t)node->num_children, w = 2 * b + 1;
+
+    for (size_t r = 0; r < n; r++) {
+        size_t lo = r > b ? r - b : 0, hi = r + b + 1 < n ? r + b + 1 : n;
+        y[r] += k->dot(p + r * w + lo + b - r, x + lo, hi - lo);
+    }
+}
+
+// y += A x for a subtree without dense leaves
+void matrix_tree_structured_gemv(const MatrixTreeNode* node, const double* x, double* y) {
+    switch (node->node_type) {
+    case NODE_TYPE_INTERNAL: {
+        MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+        for (uint64_t i = 0; i < node->num_children; i++) matrix_tree_structured_gemv(children[i], x, y);
+        break;
+    }
+    case NODE_TYPE_SYMMETRIC:
+        symmetric_gemv(node, x, y);
+        break;
+    case NODE_TYPE_DIAGONAL: {
+        const double* d = (const double*)node->data_ptr;
+        for (uint32_t r = 0; r < node->rows; r++) y[r] += d[r] * x[r];
+        break;
+    }
+    case NODE_TYPE_SCALED_IDENTITY:
+        matrix_tree_c_bound_kernels()->axpy(y, *(const double*)node->data_ptr, x, node->rows);
+        break;
+    case NODE_TYPE_BANDED:
+        banded_gemv(node, x, y);
+        break;
+    default:
+        break;
+    }
+}
+
+// Reads only the stored nonzeros of the column: one value for diagonal kinds,
+// at most 2b + 1 for banded, and for symmetric the packed column above the
+// diagonal plus the contiguous row segment that mirrors the rest
+void matrix_tree_structured_column(const MatrixTreeNode* node, uint32_t col, double value, double* y) {
+    const double* p = (const double*)node->data_ptr;
+    size_t n = node->cols;
+
+    switch (node->node_type) {
+    case NODE_TYPE_SYMMETRIC:
+        for (size_t r = 0; r < col; r++) y[r] += value * p[packed_row(n, r) + col - r];
+        matrix_tree_c_bound_kernels()->axpy(y + col, value, p + packed_row(n, col), n - col);
+        break;
+    case NODE_TYPE_DIAGONAL:
+        y[col] += value * p[col];
+        break;
+    case NODE_TYPE_SCALED_IDENTITY:
+        y[col] += value * p[0];
+        break;
+    case NODE_TYPE_BANDED: {
+        size_t b = node->num_children;
+        size_t r0 = col > b ? col - b : 0;
+        size_t r1 = col + b < n - 1 ? col + b : n - 1;
+        for (size_t r = r0; r <= r1; r++) y[r] += value * p[r * (2 * b + 1) + col + b - r];
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// A += alpha sum_b g_b x_b^T projected onto the stored values: each stored
+// value moves by the gradient of every matrix entry it stands for
+void matrix_tree_structured_rank_update(MatrixTreeNode* node, const double* g, const double* x,
+                                        uint64_t count, double alpha) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    double* p = (double*)node->data_ptr;
+    size_t n = node->cols;
+
+    for (uint64_t v = 0; v < count; v++) {
+        const double* gv = g + v * n;
+        const double* xv = x + v * n;
+
+        switch (node->node_type) {
+        case NODE_TYPE_SYMMETRIC:
+            // Off-diagonal values stand for (r, c) and (c, r)
+            for (size_t r = 0; r < n; r++) {
+                double* row = p + packed_row(n, r);
+                row[0] += alpha * gv[r] * xv[r];
+                k->axpy(row + 1, alpha * gv[r], xv + r + 1, n - r - 1);
+                k->axpy(row + 1, alpha * xv[r], gv + r + 1, n - r - 1);
+            }
+            break;
+        case NODE_TYPE_DIAGONAL:
+            for (size_t r = 0; r < n; r++) p[r] += alpha * gv[r] * xv[r];
+            break;
+        case NODE_TYPE_SCALED_IDENTITY:
+            p[0] += alpha * k->dot(gv, xv, n);
+            break;
+        case NODE_TYPE_BANDED: {
+            size_t b = (size_t)node->num_children, w = 2 * b + 1;
+            for (size_t r = 0; r < n; r++) {
+                size_t lo = r > b ? r - b : 0, hi = r + b + 1 < n ? r + b + 1 : n;
+                k->axpy(p + r * w + lo + b - r, alpha * gv[r], xv + lo, hi - lo);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+// Adds the leaf's entry sum and trace (either may be NULL); off-diagonal
+// symmetric values count twice
+void matrix_tree_structured_sums(const MatrixTreeNode* node, double* sum, double* trace) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    const double* p = (const double*)node->data_ptr;
+    size_t n = node->cols;
+    double s = 0.0, t = 0.0;
+
+    switch (node->node_type) {
+    case NODE_TYPE_SYMMETRIC:
+        for (size_t r = 0; r < n; r++) {
+            const double* row = p + packed_row(n, r);
+            if (sum) s += 2.0 * k->sum(row, n - r) - row[0];
+            t += row[0];
+        }
+        break;
+    case NODE_TYPE_DIAGONAL:
+        s = t = k->sum(p, n);
+        break;
+    case NODE_TYPE_SCALED_IDENTITY:
+        s = t = p[0] * (double)n;
+        break;
+    case NODE_TYPE_BANDED: {
+        size_t b = (size_t)node->num_children, w = 2 * b + 1;
+        for (size_t r = 0; r < n; r++) {
+            size_t lo = r > b ? r - b : 0, hi = r + b + 1 < n ? r + b + 1 : n;
+            if (sum) s += k->sum(p + r * w + lo + b - r, hi - lo);
+            t += p[r * w + b];
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    if (sum) *sum += s;
+    if (trace) *trace += t;
+}
+
+int matrix_tree_structured_only(const MatrixTreeNode* node) {
+    if (matrix_tree_is_structured(node->node_type)) return 1;
+    if (node->node_type != NODE_TYPE_INTERNAL || node->num_children == 0) return 0;
+
+    MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+    for (uint64_t i = 0; i < node->num_children; i++) {
+        if (!matrix_tree_structured_only(children[i])) return 0;
+    }
+    return 1;
+}
+
+int matrix_tree_structured_multiply(const MatrixTreeNode* node, const double* x, double* y) {
+    memset(y, 0, node->rows * sizeof(double));
+    matrix_tree_structured_gemv(node, x, y);
+    return 0;
+}
+
+MatrixTreeNode* matrix_tree_create_symmetric(uint32_t n) {
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+    return matrix_tree_structured_create(n, n, NODE_TYPE_SYMMETRIC, 0);
+}
+
+MatrixTreeNode* matrix_tree_create_diagonal(uint32_t n) {
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+    return matrix_tree_structured_create(n, n, NODE_TYPE_DIAGONAL, 0);
+}
+
+MatrixTreeNode* matrix_tree_create_scaled_identity(uint32_t n, double scalar) {
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+    MatrixTreeNode* node = matrix_tree_structured_create(n, n, NODE_TYPE_SCALED_IDENTITY, 0);
+    if (node) *(double*)node->data_ptr = scalar;
+    return node;
+}
+
+MatrixTreeNode* matrix_tree_create_banded(uint32_t n, uint32_t bandwidth) {
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+    return matrix_tree_structured_create(n, n, NODE_TYPE_BANDED, bandwidth);
+}
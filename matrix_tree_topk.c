@@ -0,0 +1,190 @@
+// Matrix-Tree top-k children by response magnitude
+// Picks the k direct children of a node with the largest ||A_i x||. Each
+// worker evaluates its share of the children one at a time into a single
+// rows-sized buffer, takes the norm while the product is still in cache and
+// offers it to a bounded min-heap of size k, so only k products are ever kept
+// (and only when the caller wants them back). The per-worker heaps are merged
+// into one at the end.
+
+#include "matrix_tree_internal.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+typedef struct TopKEntry {
+    double norm2;
+    uint64_t index;
+    double* y;                  // Slot for the product when results are kept
+} TopKEntry;
+
+typedef struct TopKHeap {
+    TopKEntry* items;
+    uint32_t count;
+    uint32_t capacity;
+} TopKHeap;
+
+typedef struct TopKJob {
+    MatrixTreeNode** children;
+    uint64_t first;             // Children [first, last) of this worker
+    uint64_t last;
+    const double* x;
+    uint32_t rows;
+    int keep;                   // Keep the k products
+    TopKHeap heap;
+    double* slots;              // k x rows when keep is set
+    double* y;                  // rows, this worker's product
+} TopKJob;
+
+// Larger norm ranks higher; ties go to the lower index
+static int topk_above(const TopKEntry* a, const TopKEntry* b) {
+    return a->norm2 > b->norm2 || (a->norm2 == b->norm2 && a->index < b->index);
+}
+
+static void topk_sift_down(TopKHeap* h, uint32_t i) {
+    for (;;) {
+        uint32_t low = i, l = 2 * i + 1, r = l + 1;
+        if (l < h->count && topk_above(&h->items[low], &h->items[l])) low = l;
+        if (r < h->count && topk_above(&h->items[low], &h->items[r])) low = r;
+        if (low == i) return;
+        TopKEntry t = h->items[i];
+        h->items[i] = h->items[low];
+        h->items[low] = t;
+        i = low;
+    }
+}
+
+static void topk_sift_up(TopKHeap* h, uint32_t i) {
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!topk_above(&h->items[parent], &h->items[i])) return;
+        TopKEntry t = h->items[i];
+        h->items[i] = h->items[parent];
+        h->items[parent] = t;
+        i = parent;
+    }
+}
+
+// Offers a candidate to the min-heap. A newcomer takes the next free product
+// slot, or the slot of the entry it evicts, and y is copied there if kept.
+static void topk_offer(TopKHeap* h, double norm2, uint64_t index, const double* y, double* free_slot,
+                       size_t bytes) {
+    TopKEntry e = { norm2, index, free_slot };
+    if (h->count < h->capacity) {
+        if (e.y) memcpy(e.y, y, bytes);
+        h->items[h->count] = e;
+        topk_sift_up(h, h->count++);
+    } else if (topk_above(&e, &h->items[0])) {
+        e.y = h->items[0].y;
+        if (e.y) memcpy(e.y, y, bytes);
+        h->items[0] = e;
+        topk_sift_down(h, 0);
+    }
+}
+
+// y += A x over the leaves of node
+static void topk_product(const MatrixTreeNode* node, const double* x, double* y) {
+    if (node->node_type == NODE_TYPE_INTERNAL) {
+        MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+        for (uint64_t i = 0; i < node->num_children; i++) topk_product(children[i], x, y);
+    } else if (node->node_type == NODE_TYPE_LEAF) {
+        const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+        const double* a = (const double*)node->data_ptr;
+        for (uint32_t r = 0; r < node->rows; r++) y[r] += k->dot(a + (size_t)r * node->cols, x, node->cols);
+    } else {
+        matrix_tree_structured_gemv(node, x, y);
+    }
+}
+
+static int topk_worker(void* arg) {
+    TopKJob* job = arg;
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    size_t bytes = (size_t)job->rows * sizeof(double);
+    double* y = job->y;
+
+    for (uint64_t c = job->first; c < job->last; c++) {
+        memset(y, 0, bytes);
+        topk_product(job->children[c], job->x, y);
+        double norm2 = k->dot(y, y, job->rows);
+
+        TopKHeap* h = &job->heap;
+        double* free_slot = job->keep && h->count < h->capacity ? job->slots + (size_t)h->count * job->rows : NULL;
+        topk_offer(h, norm2, c, y, free_slot, bytes);
+    }
+    return 0;
+}
+
+static int topk_by_rank(const void* a, const void* b) {
+    const TopKEntry* ea = a;
+    const TopKEntry* eb = b;
+    return topk_above(eb, ea) - topk_above(ea, eb);
+}
+
+int matrix_tree_top_k_children(MatrixTreeNode* node, const double* x, uint32_t k, uint32_t threads,
+                               uint64_t* indices, double* norms, double* results) {
+    if (!node || !x || !indices) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    uint64_t count;
+    MatrixTreeNode** children = matrix_tree_c_children(&node, &count);
+    if (k > count) k = (uint32_t)count;
+    if (k == 0) return 0;
+    matrix_tree_freeze_evaluated(node);
+
+    if (threads == 0) threads = 1;
+    if (threads > count) threads = (uint32_t)count;
+    int keep = results != NULL;
+    size_t slot_elems = keep ? (size_t)k * node->rows : 0;
+
+    // Call table: kept products, worker products, heap entries, jobs, thread
+    // handles, started flags; workers allocate nothing of their own
+    size_t items_count = (size_t)threads * k;
+    size_t table = threads * (slot_elems + node->rows) * sizeof(double) + items_count * sizeof(TopKEntry) +
+                   threads * (sizeof(TopKJob) + sizeof(thrd_t) + sizeof(int));
+    double* slots = matrix_tree_workspace(MATRIX_TREE_WS_CALL, table);
+    if (!slots) return -1;
+    double* products = slots + threads * slot_elems;
+    TopKEntry* items = (TopKEntry*)(products + (size_t)threads * node->rows);
+    TopKJob* jobs = (TopKJob*)(items + items_count);
+    thrd_t* workers = (thrd_t*)(jobs + threads);
+    int* started = (int*)(workers + threads);
+
+    uint64_t per = (count + threads - 1) / threads;
+    for (uint32_t t = 0; t < threads; t++) {
+        uint64_t first = t * per < count ? t * per : count;
+        uint64_t last = first + per < count ? first + per : count;
+        jobs[t] = (TopKJob){ children, first, last, x, node->rows, keep,
+                             { items + (size_t)t * k, 0, k },
+                             keep ? slots + t * slot_elems : NULL, products + (size_t)t * node->rows };
+    }
+
+    // The calling thread takes the first share; a worker that fails to
+    // start has its share run here too
+    for (uint32_t t = 1; t < threads; t++) {
+        started[t] = thrd_create(&workers[t], topk_worker, &jobs[t]) == thrd_success;
+    }
+    topk_worker(&jobs[0]);
+    for (uint32_t t = 1; t < threads; t++) {
+        if (started[t]) {
+            thrd_join(workers[t], NULL);
+        } else {
+            topk_worker(&jobs[t]);
+        }
+    }
+
+    // Merge: every worker's survivors, best first, then the top k of those
+    size_t survivors = 0;
+    for (uint32_t t = 0; t < threads; t++) {
+        memmove(items + survivors, jobs[t].heap.items, jobs[t].heap.count * sizeof(TopKEntry));
+        survivors += jobs[t].heap.count;
+    }
+    qsort(items, survivors, sizeof(TopKEntry), topk_by_rank);
+
+    int found = (int)(survivors < k ? survivors : k);
+    for (int i = 0; i < found; i++) {
+        indices[i] = items[i].index;
+        if (norms) norms[i] = sqrt(items[i].norm2);
+        if (keep) memcpy(results + (size_t)i * node->rows, items[i].y, node->rows * sizeof(double));
+    }
+    return found;
+}
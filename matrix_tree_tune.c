@@ -0,0 +1,436 @@
+// Matrix-Tree runtime tuning
+// Micro-benchmarks the tunable kernel parameters on the current machine and
+// caches the winners in a small text file keyed by CPU model, one line per
+// model: "<cpu model>\t<tile_elems>\t<stream_threshold>\t<c_backend_ops>".
+
+#include "matrix_tree_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#include <direct.h>
+#else
+#include <time.h>
+#include <cpuid.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TUNE_LINE_MAX 256
+#define TUNE_MODEL_MAX 64
+#define TUNE_REPS 3
+
+// Set once the parameters were chosen explicitly or loaded
+static int tune_applied;
+
+static double tune_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+// CPU brand string, used as the cache key
+static void tune_cpu_model(char* model, size_t size) {
+    unsigned int regs[12];
+    int ok = 0;
+
+#ifdef _WIN32
+    int info[4];
+    __cpuid(info, 0x80000000);
+    if ((unsigned int)info[0] >= 0x80000004u) {
+        for (int i = 0; i < 3; i++) {
+            __cpuid(info, 0x80000002 + i);
+            memcpy(&regs[i * 4], info, sizeof(info));
+        }
+        ok = 1;
+    }
+#else
+    if (__get_cpuid_max(0x80000000u, NULL) >= 0x80000004u) {
+        for (unsigned int i = 0; i < 3; i++) {
+            __get_cpuid(0x80000002u + i, &regs[i * 4], &regs[i * 4 + 1],
+                        &regs[i * 4 + 2], &regs[i * 4 + 3]);
+        }
+        ok = 1;
+    }
+#endif
+
+    if (!ok) {
+        snprintf(model, size, "unknown");
+        return;
+    }
+
+    // Trim the padding and keep the key free of the file's separators
+    char brand[sizeof(regs) + 1];
+    memcpy(brand, regs, sizeof(regs));
+    brand[sizeof(regs)] = '\0';
+    const char* start = brand;
+    while (*start == ' ') start++;
+    snprintf(model, size, "%s", start);
+    size_t len = strlen(model);
+    while (len > 0 && model[len - 1] == ' ') model[--len] = '\0';
+    for (size_t i = 0; i < len; i++) {
+        if (model[i] == '\t' || model[i] == '\n') model[i] = ' ';
+    }
+}
+
+// Cache file: explicit path, then $MATRIX_TREE_TUNE_CACHE, then the user cache dir
+static const char* tune_cache_path(const char* path, char* buf, size_t size) {
+    if (path) return path;
+
+    const char* env = getenv("MATRIX_TREE_TUNE_CACHE");
+    if (env && *env) return env;
+
+#ifdef _WIN32
+    const char* dir = getenv("LOCALAPPDATA");
+    if (!dir) return NULL;
+    snprintf(buf, size, "%s\\matrix_tree.tune", dir);
+#else
+    const char* dir = getenv("XDG_CACHE_HOME");
+    if (dir && *dir) {
+        snprintf(buf, size, "%s/matrix_tree.tune", dir);
+    } else {
+        dir = getenv("HOME");
+        if (!dir) return NULL;
+        snprintf(buf, size, "%s/.cache/matrix_tree.tune", dir);
+    }
+#endif
+    return buf;
+}
+
+// Runtime init: pick up a previous autotune result unless already tuned
+void matrix_tree_tune_init(void) {
+    if (!tune_applied) matrix_tree_tune_load(NULL);
+}
+
+void matrix_tree_get_tuning(MatrixTreeTuning* tuning) {
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+    tuning->tile_elems = matrix_tree_tile_elems;
+    tuning->stream_threshold = matrix_tree_stream_threshold;
+    tuning->c_backend_ops = matrix_tree_backend_mask();
+}
+
+// Cached and measured backends only apply while the user has chosen none
+static int tune_apply(const MatrixTreeTuning* tuning, int backends) {
+    if (!tuning) return -1;
+    if (tuning->tile_elems == 0 || tuning->tile_elems > MATRIX_TREE_MAX_TILE_ELEMS) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    tune_applied = 1;
+    matrix_tree_tile_elems = tuning->tile_elems;
+    matrix_tree_stream_threshold = tuning->stream_threshold;
+    if (backends) matrix_tree_set_backend_mask(tuning->c_backend_ops);
+    return 0;
+}
+
+int matrix_tree_set_tuning(const MatrixTreeTuning* tuning) {
+    return tune_apply(tuning, 1);
+}
+
+int matrix_tree_tune_load(const char* cache_path) {
+    char path_buf[1024];
+    const char* path = tune_cache_path(cache_path, path_buf, sizeof(path_buf));
+    if (!path) return -1;
+
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+
+    char model[TUNE_MODEL_MAX];
+    tune_cpu_model(model, sizeof(model));
+
+    char line[TUNE_LINE_MAX];
+    int result = -1;
+    while (fgets(line, sizeof(line), f)) {
+        char* tab = strchr(line, '\t');
+        if (!tab) continue;
+        *tab = '\0';
+        if (strcmp(line, model) != 0) continue;
+
+        // Older entries have no backend field: keep the assembly backend
+        unsigned long long tile, threshold, backends = 0;
+        if (sscanf(tab + 1, "%llu\t%llu\t%llu", &tile, &threshold, &backends) < 2) continue;
+
+        MatrixTreeTuning tuning = { tile, threshold, backends };
+        result = tune_apply(&tuning, !matrix_tree_backend_chosen());
+        break;
+    }
+
+    fclose(f);
+    return result;
+}
+
+// Creates the directories leading to path that do not exist yet
+static void tune_make_dirs(const char* path) {
+    char dir[1024];
+    size_t len = strlen(path);
+    if (len >= sizeof(dir)) return;
+    memcpy(dir, path, len + 1);
+
+    for (size_t i = 1; i < len; i++) {
+        if (dir[i] != '/' && dir[i] != '\\') continue;
+        char sep = dir[i];
+        dir[i] = '\0';
+#ifdef _WIN32
+        _mkdir(dir);
+#else
+        mkdir(dir, 0755);
+#endif
+        dir[i] = sep;
+    }
+}
+
+// Rewrites the cache file with this model's line replaced. The new contents
+// go to a private temporary file that is renamed over the old one, so readers
+// and concurrent tuners see either file whole; nothing is written if the old
+// lines cannot all be kept.
+static int tune_store(const char* path, const char* model, const MatrixTreeTuning* tuning) {
+    char* kept = NULL;
+    size_t kept_len = 0;
+
+    FILE* f = fopen(path, "r");
+    if (f) {
+        char line[TUNE_LINE_MAX];
+        size_t model_len = strlen(model);
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, model, model_len) == 0 && line[model_len] == '\t') continue;
+            size_t len = strlen(line);
+            char* grown = realloc(kept, kept_len + len + 1);
+            if (!grown) {
+                free(kept);
+                fclose(f);
+                return -1;
+            }
+            kept = grown;
+            memcpy(kept + kept_len, line, len + 1);
+            kept_len += len;
+        }
+        fclose(f);
+    }
+
+    // A name of its own per tuner, threads of one process included
+    char tmp[1100];
+    tune_make_dirs(path);
+#ifdef _WIN32
+    snprintf(tmp, sizeof(tmp), "%s.%lu.%lu.tmp", path, (unsigned long)GetCurrentProcessId(),
+             (unsigned long)GetCurrentThreadId());
+    f = fopen(tmp, "w");
+#else
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd >= 0) fchmod(fd, 0644);
+    f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (fd >= 0 && !f) {
+        close(fd);
+        remove(tmp);
+    }
+#endif
+    if (!f) {
+        free(kept);
+        return -1;
+    }
+    if (kept) fputs(kept, f);
+    fprintf(f, "%s\t%llu\t%llu\t%llu\n", model,
+            (unsigned long long)tuning->tile_elems,
+            (unsigned long long)tuning->stream_threshold,
+            (unsigned long long)tuning->c_backend_ops);
+    free(kept);
+    if (fclose(f) != 0) {
+        remove(tmp);
+        return -1;
+    }
+
+#ifdef _WIN32
+    int moved = MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    int moved = rename(tmp, path) == 0;
+#endif
+    if (!moved) remove(tmp);
+    return moved ? 0 : -1;
+}
+
+// Internal node over `leaves` leaves of rows x cols filled with a ramp
+static MatrixTreeNode* tune_build_tree(uint32_t rows, uint32_t cols, int leaves) {
+    MatrixTreeNode* root = matrix_tree_create(rows, cols, NODE_TYPE_INTERNAL);
+    MatrixTreeNode** children = malloc(sizeof(MatrixTreeNode*) * (size_t)leaves);
+    if (!root || !children) {
+        matrix_tree_destroy(root);
+        free(children);
+        return NULL;
+    }
+
+    int built = 0;
+    for (; built < leaves; built++) {
+        children[built] = matrix_tree_create(rows, cols, NODE_TYPE_LEAF);
+        if (!children[built]) break;
+        double* data = (double*)children[built]->data_ptr;
+        size_t n = (size_t)rows * cols;
+        for (size_t i = 0; i < n; i++) data[i] = (double)((i + built) % 97);
+    }
+
+    if (built < leaves || matrix_tree_set_internal(root, children, (uint64_t)leaves) != 0) {
+        for (int i = 0; i < built; i++) matrix_tree_destroy(children[i]);
+        free(children);
+        matrix_tree_destroy(root);
+        return NULL;
+    }
+
+    free(children);
+    return root;
+}
+
+// Best-of-N time for one collapse (and optionally one multiply) of the tree
+static double tune_time(MatrixTreeNode* tree, double* out, const double* x, double* y,
+                        uint32_t flags) {
+    double best = 1e30;
+    for (int rep = 0; rep < TUNE_REPS; rep++) {
+        double start = tune_now();
+        matrix_tree_collapse_ex(tree, out, flags);
+        if (x) matrix_tree_multiply_collapsed(tree, x, y);
+        double elapsed = tune_now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// Tile size: the collapse tile is reused across every leaf, so the best size
+// balances per-tile overhead against keeping the tile resident in L1
+static uint64_t tune_tile_elems(void) {
+    static const uint64_t candidates[] = { 128, 256, 512, 1024 };
+    const uint32_t rows = 256, cols = 256;
+
+    MatrixTreeNode* tree = tune_build_tree(rows, cols, 8);
+    double* out = malloc(sizeof(double) * rows * cols);
+    double* x = malloc(sizeof(double) * cols);
+    double* y = malloc(sizeof(double) * rows);
+    uint64_t best_tile = matrix_tree_tile_elems;
+
+    if (tree && out && x && y) {
+        for (uint32_t j = 0; j < cols; j++) x[j] = 1.0;
+        double best = 1e30;
+        for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+            matrix_tree_tile_elems = candidates[i];
+            double t = tune_time(tree, out, x, y, MATRIX_TREE_COLLAPSE_CACHED);
+            if (t < best) {
+                best = t;
+                best_tile = candidates[i];
+            }
+        }
+    }
+
+    matrix_tree_destroy(tree);
+    free(out);
+    free(x);
+    free(y);
+    return best_tile;
+}
+
+// Stream threshold: the smallest output size from which non-temporal stores
+// win at every larger size measured; never stream if they never win
+static uint64_t tune_stream_threshold(void) {
+    static const uint64_t sizes[] = {
+        256u * 1024u, 1024u * 1024u, 4u * 1024u * 1024u, 16u * 1024u * 1024u,
+        32u * 1024u * 1024u
+    };
+    const int count = (int)(sizeof(sizes) / sizeof(sizes[0]));
+    uint64_t threshold = UINT64_MAX;
+
+    for (int i = count - 1; i >= 0; i--) {
+        uint32_t cols = 512;
+        uint32_t rows = (uint32_t)(sizes[i] / sizeof(double) / cols);
+        MatrixTreeNode* tree = tune_build_tree(rows, cols, 1);
+        double* out = malloc(sizes[i]);
+        int streamed_wins = 0;
+
+        if (tree && out) {
+            double cached = tune_time(tree, out, NULL, NULL, MATRIX_TREE_COLLAPSE_CACHED);
+            double streamed = tune_time(tree, out, NULL, NULL, MATRIX_TREE_COLLAPSE_STREAM);
+            streamed_wins = streamed < cached;
+        }
+
+        matrix_tree_destroy(tree);
+        free(out);
+        if (!streamed_wins) break;
+        threshold = sizes[i];
+    }
+
+    return threshold;
+}
+
+// Best-of-N time for one call of a compute operation
+static double tune_op_time(int op, MatrixTreeNode* tree, double* out, const double* x, double* y) {
+    double best = 1e30;
+    for (int rep = 0; rep < TUNE_REPS; rep++) {
+        double start = tune_now();
+        switch (op) {
+        case MATRIX_TREE_OP_COLLAPSE: matrix_tree_collapse_ex(tree, out, MATRIX_TREE_COLLAPSE_AUTO); break;
+        case MATRIX_TREE_OP_MULTIPLY: matrix_tree_multiply_collapsed(tree, x, y); break;
+        default:                      matrix_tree_scale(tree, 1.0); break;
+        }
+        double elapsed = tune_now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    return best;
+}
+
+// Backend per compute operation: whichever of assembly and C is faster here.
+// Structural operations are allocation-bound and stay on the assembly. The
+// selection in force is put back afterwards.
+static uint64_t tune_backends(void) {
+    static const int ops[] = { MATRIX_TREE_OP_COLLAPSE, MATRIX_TREE_OP_MULTIPLY, MATRIX_TREE_OP_SCALE };
+    const uint32_t rows = 256, cols = 256;
+    uint64_t current = matrix_tree_backend_mask();
+
+    MatrixTreeNode* tree = tune_build_tree(rows, cols, 8);
+    double* out = malloc(sizeof(double) * rows * cols);
+    double* x = malloc(sizeof(double) * cols);
+    double* y = malloc(sizeof(double) * rows);
+    uint64_t mask = 0;
+
+    if (tree && out && x && y) {
+        for (uint32_t j = 0; j < cols; j++) x[j] = 1.0;
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            uint64_t bit = 1ull << ops[i];
+            matrix_tree_set_backend_mask(current & ~bit);
+            double asm_time = tune_op_time(ops[i], tree, out, x, y);
+            matrix_tree_set_backend_mask(current | bit);
+            double c_time = tune_op_time(ops[i], tree, out, x, y);
+            if (c_time < asm_time) mask |= bit;
+        }
+    }
+    matrix_tree_set_backend_mask(current);
+
+    matrix_tree_destroy(tree);
+    free(out);
+    free(x);
+    free(y);
+    return mask;
+}
+
+int matrix_tree_autotune(const char* cache_path) {
+    MatrixTreeTuning tuning;
+    tune_applied = 1;
+    tuning.tile_elems = tune_tile_elems();
+    matrix_tree_tile_elems = tuning.tile_elems;
+    tuning.stream_threshold = tune_stream_threshold();
+    matrix_tree_stream_threshold = tuning.stream_threshold;
+    tuning.c_backend_ops = tune_backends();
+    if (tune_apply(&tuning, !matrix_tree_backend_chosen()) != 0) return -1;
+
+    char path_buf[1024];
+    const char* path = tune_cache_path(cache_path, path_buf, sizeof(path_buf));
+    if (!path) return -1;
+
+    char model[TUNE_MODEL_MAX];
+    tune_cpu_model(model, sizeof(model));
+    return tune_store(path, model, &tuning);
+}
+
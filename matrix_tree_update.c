@@ -0,0 +1,135 @@
+// Matrix-Tree leaf gradient updates
+// For y = sum_j w_j A_j x over the direct children of a node, the gradient of
+// the loss with respect to every leaf below child j is w_j g x^T, where g is
+// the gradient with respect to y. The update A -= lr w_j g x^T is applied in
+// place, one row at a time as an axpy of x (a rank-1 update; a batch adds one
+// axpy per pair while the row stays in cache). A leaf reachable through
+// several paths is updated once with the sum of its path weights. Below a
+// frozen node the kept originals are updated, and the frozen sum recomputed.
+
+#include "matrix_tree_internal.h"
+#include <stdlib.h>
+
+typedef struct UpdateTarget {
+    MatrixTreeNode* leaf;
+    double weight;
+} UpdateTarget;
+
+typedef struct UpdateList {
+    UpdateTarget* items;
+    size_t count;
+    size_t capacity;
+    int frozen;                 // A frozen node was passed through
+} UpdateList;
+
+static int update_collect(MatrixTreeNode* node, double weight, UpdateList* list) {
+    uint64_t kept_count;
+    MatrixTreeNode** kept = matrix_tree_freeze_kept(node, &kept_count);
+    if (kept) {
+        list->frozen = 1;
+        for (uint64_t i = 0; i < kept_count; i++) {
+            if (update_collect(kept[i], weight, list) != 0) return -1;
+        }
+        return 0;
+    }
+
+    if (node->node_type == NODE_TYPE_INTERNAL) {
+        MatrixTreeNode** children = (MatrixTreeNode**)node->data_ptr;
+        for (uint64_t i = 0; i < node->num_children; i++) {
+            if (update_collect(children[i], weight, list) != 0) return -1;
+        }
+        return 0;
+    }
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        UpdateTarget* grown = matrix_tree_workspace(MATRIX_TREE_WS_CALL, capacity * sizeof(UpdateTarget));
+        if (!grown) return -1;
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = (UpdateTarget){ node, weight };
+    return 0;
+}
+
+static int update_by_leaf(const void* a, const void* b) {
+    uintptr_t la = (uintptr_t)((const UpdateTarget*)a)->leaf;
+    uintptr_t lb = (uintptr_t)((const UpdateTarget*)b)->leaf;
+    return (la > lb) - (la < lb);
+}
+
+// Frozen sums bottom-up, so an outer one adds inner ones already refreshed
+static int update_refresh(MatrixTreeNode* node) {
+    uint64_t count;
+    MatrixTreeNode** children = matrix_tree_freeze_kept(node, &count);
+    int frozen = children != NULL;
+    if (!frozen && node->node_type == NODE_TYPE_INTERNAL) {
+        children = (MatrixTreeNode**)node->data_ptr;
+        count = node->num_children;
+    }
+    for (uint64_t i = 0; children && i < count; i++) {
+        if (update_refresh(children[i]) != 0) return -1;
+    }
+    return frozen ? matrix_tree_freeze_refresh(node) : 0;
+}
+
+// A -= scale sum_v g_v x_v^T for a dense leaf
+static void update_dense(MatrixTreeNode* leaf, const double* g, const double* x, uint64_t count, double scale) {
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    double* a = (double*)leaf->data_ptr;
+    size_t rows = leaf->rows, cols = leaf->cols;
+
+    for (size_t r = 0; r < rows; r++) {
+        double* row = a + r * cols;
+        for (uint64_t v = 0; v < count; v++) {
+            double gr = g[v * rows + r];
+            if (gr != 0.0) k->axpy(row, -scale * gr, x + v * cols, cols);
+        }
+    }
+}
+
+int matrix_tree_update_leaves_batch(MatrixTreeNode* node, const double* g, const double* x, uint64_t count,
+                                    double lr, const double* child_weights) {
+    if (!node || !g || !x) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    UpdateList list = { NULL, 0, 0, 0 };
+    int failed = 0;
+    uint64_t kept_count;
+    MatrixTreeNode** kept = matrix_tree_freeze_kept(node, &kept_count);
+    if (kept || node->node_type == NODE_TYPE_INTERNAL) {
+        // A frozen node's direct children are its kept originals
+        MatrixTreeNode** children = kept ? kept : (MatrixTreeNode**)node->data_ptr;
+        uint64_t num_children = kept ? kept_count : node->num_children;
+        list.frozen = kept != NULL;
+        for (uint64_t j = 0; j < num_children && !failed; j++) {
+            double w = child_weights ? child_weights[j] : 1.0;
+            failed = update_collect(children[j], w, &list) != 0;
+        }
+    } else {
+        failed = update_collect(node, child_weights ? child_weights[0] : 1.0, &list) != 0;
+    }
+    if (failed) return -1;
+
+    // Shared leaves: one update with the summed weight
+    qsort(list.items, list.count, sizeof(UpdateTarget), update_by_leaf);
+    for (size_t i = 0; i < list.count;) {
+        MatrixTreeNode* leaf = list.items[i].leaf;
+        double weight = 0.0;
+        for (; i < list.count && list.items[i].leaf == leaf; i++) weight += list.items[i].weight;
+        if (weight == 0.0) continue;
+
+        if (leaf->node_type == NODE_TYPE_LEAF) {
+            update_dense(leaf, g, x, count, lr * weight);
+        } else {
+            matrix_tree_structured_rank_update(leaf, g, x, count, -lr * weight);
+        }
+        matrix_tree_freeze_touched(leaf);
+    }
+    return list.frozen ? update_refresh(node) : 0;
+}
+
+int matrix_tree_update_leaves(MatrixTreeNode* node, const double* g, const double* x, double lr,
+                              const double* child_weights) {
+    return matrix_tree_update_leaves_batch(node, g, x, 1, lr, child_weights);
+}
@@ -0,0 +1,38 @@
+// Matrix-Tree weighted child combinations
+// Evaluates y_s = sum_j w_sj A_j x for many weight rows w_s over the direct
+// children A_j of a node (Monte Carlo draws, scenario mixes). The products
+// A_j x do not depend on the weights, so they are computed once, one pass over
+// the tree's data, and each sample is then a small combination of them:
+// Y = W P with P the children x rows matrix of products.
+
+#include "matrix_tree_internal.h"
+#include <string.h>
+
+int matrix_tree_multiply_weighted(MatrixTreeNode* node, const double* x, const double* weights,
+                                  uint64_t samples, double* y) {
+    if (!node || !x || !y || (samples && !weights)) return -1;
+    if (!matrix_tree_runtime_ready) matrix_tree_runtime_init();
+
+    uint64_t count;
+    MatrixTreeNode** children = matrix_tree_c_children(&node, &count);
+    size_t rows = node->rows;
+
+    double* products = matrix_tree_workspace(MATRIX_TREE_WS_CALL, (count ? count : 1) * rows * sizeof(double));
+    if (!products) return -1;
+
+    for (uint64_t j = 0; j < count; j++) {
+        if (matrix_tree_multiply_collapsed(children[j], x, products + j * rows) != 0) return -1;
+    }
+
+    // Row s of Y accumulates the product rows weighted by row s of W
+    const MatrixTreeCKernels* k = matrix_tree_c_bound_kernels();
+    for (uint64_t s = 0; s < samples; s++) {
+        double* ys = y + s * rows;
+        const double* ws = weights + s * count;
+        memset(ys, 0, rows * sizeof(double));
+        for (uint64_t j = 0; j < count; j++) {
+            if (ws[j] != 0.0) k->axpy(ys, ws[j], products + j * rows, rows);
+        }
+    }
+    return 0;
+}
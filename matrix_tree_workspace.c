@@ -0,0 +1,75 @@
+// Matrix-Tree per-thread workspace
+// Scratch memory for evaluation, owned by the calling thread. Each slot grows
+// to the largest request it has seen and is then reused, so steady-state
+// collapse and multiply calls make no heap allocations; slots let a call and
+// the helpers it runs hold separate buffers at once. A thread's pool is freed
+// when the thread exits, or earlier with matrix_tree_workspace_trim.
+
+#include "matrix_tree_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define WORKSPACE_ALIGN 64
+
+typedef struct WorkspacePool {
+    void* raw[MATRIX_TREE_WS_SLOTS];        // As returned by malloc
+    void* base[MATRIX_TREE_WS_SLOTS];       // WORKSPACE_ALIGN-aligned start
+    size_t size[MATRIX_TREE_WS_SLOTS];      // Usable bytes from base
+    int registered;                         // Thread-exit destructor armed
+} WorkspacePool;
+
+static _Thread_local WorkspacePool ws_pool;
+static tss_t ws_key;
+static int ws_key_ready;
+static once_flag ws_once = ONCE_FLAG_INIT;
+
+static void ws_release(WorkspacePool* pool) {
+    for (int s = 0; s < MATRIX_TREE_WS_SLOTS; s++) {
+        free(pool->raw[s]);
+        pool->raw[s] = pool->base[s] = NULL;
+        pool->size[s] = 0;
+    }
+}
+
+static void ws_thread_exit(void* pool) {
+    ws_release(pool);
+}
+
+static void ws_key_init(void) {
+    ws_key_ready = tss_create(&ws_key, ws_thread_exit) == thrd_success;
+}
+
+// Grows slot to at least `bytes`, keeping its contents; NULL when out of memory
+void* matrix_tree_workspace(uint32_t slot, size_t bytes) {
+    WorkspacePool* pool = &ws_pool;
+    if (bytes <= pool->size[slot]) return pool->base[slot];
+
+    size_t size = (bytes + WORKSPACE_ALIGN - 1) & ~(size_t)(WORKSPACE_ALIGN - 1);
+    void* raw = malloc(size + WORKSPACE_ALIGN - 1);
+    if (!raw) return NULL;
+    void* base = (void*)(((uintptr_t)raw + WORKSPACE_ALIGN - 1) & ~(uintptr_t)(WORKSPACE_ALIGN - 1));
+    if (pool->size[slot]) memcpy(base, pool->base[slot], pool->size[slot]);
+    free(pool->raw[slot]);
+
+    pool->raw[slot] = raw;
+    pool->base[slot] = base;
+    pool->size[slot] = size;
+
+    if (!pool->registered) {
+        call_once(&ws_once, ws_key_init);
+        if (ws_key_ready) tss_set(ws_key, pool);
+        pool->registered = 1;
+    }
+    return base;
+}
+
+size_t matrix_tree_workspace_size(void) {
+    size_t total = 0;
+    for (int s = 0; s < MATRIX_TREE_WS_SLOTS; s++) total += ws_pool.size[s];
+    return total;
+}
+
+void matrix_tree_workspace_trim(void) {
+    ws_release(&ws_pool);
+}